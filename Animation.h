@@ -0,0 +1,209 @@
+/**
+@file Animation.h
+*/
+#pragma once
+#ifndef _ANIMATION_H_
+#define _ANIMATION_H_
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "PointVector.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "Image2D.h"
+#include "Image2DWriter.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A camera keyframe, given as the view box of Renderer::setViewBox.
+  struct CameraKey {
+    Real    time;
+    Point3  origin;
+    Vector3 dirUL, dirUR, dirLL, dirLR;
+  };
+
+  /// An object keyframe: the translation of the object at the given time,
+  /// relative to its position when the animation is created.
+  struct ObjectKey {
+    Real    time;
+    Vector3 translation;
+  };
+
+  /// The keyframes of one object.
+  struct ObjectTrack {
+    GraphicalObject*         object;
+    std::vector< ObjectKey > keys;
+  };
+
+  /**
+  Renders a sequence of frames, with the camera and some objects moving
+  along piecewise linear paths between keyframes. The scene and the
+  renderer are reused from one frame to the next: moved objects are
+  translated in place and the acceleration structure is only refitted
+  (see Scene::refit), so that the per-frame setup is negligible.
+
+  Frames are written as numbered images, e.g. frame0000.ppm,
+  frame0001.ppm, etc.
+  */
+  struct Animation {
+    std::vector< CameraKey >   myCameraKeys;
+    std::vector< ObjectTrack > myTracks;
+
+    /// Adds a camera keyframe (keys must be added in increasing time).
+    void addCameraKey( Real time, Point3 origin,
+                       Vector3 dirUL, Vector3 dirUR, Vector3 dirLL, Vector3 dirLR )
+    {
+      myCameraKeys.push_back( CameraKey{ time, origin, dirUL, dirUR, dirLL, dirLR } );
+    }
+
+    /// Adds a keyframe for object \a object (keys of one object must be
+    /// added in increasing time).
+    void addObjectKey( GraphicalObject* object, Real time, Vector3 translation )
+    {
+      for ( ObjectTrack& track : myTracks )
+        if ( track.object == object )
+          {
+            track.keys.push_back( ObjectKey{ time, translation } );
+            return;
+          }
+      myTracks.push_back( ObjectTrack{ object, { ObjectKey{ time, translation } } } );
+    }
+
+    /// @return the time of the first and last keyframes.
+    Real startTime() const;
+    Real endTime() const;
+
+    /// Renders the frames from startTime() to endTime() at \a fps frames
+    /// per second, into the files \a prefix followed by the frame number
+    /// and ".ppm". At the end, objects are put back at their initial place.
+    ///
+    /// @return the number of frames rendered.
+    int render( Scene& scene, Renderer& renderer, const std::string& prefix,
+                Real fps, int width, int height, int max_depth );
+
+    /// Linear interpolation of the camera at time \a t.
+    CameraKey cameraAt( Real t ) const;
+
+    /// Linear interpolation of the translation of \a track at time \a t.
+    static Vector3 translationAt( const ObjectTrack& track, Real t );
+  };
+
+  inline Real
+  Animation::startTime() const
+  {
+    Real t = myCameraKeys.empty() ? 0.0f : myCameraKeys.front().time;
+    for ( const ObjectTrack& track : myTracks )
+      if ( ! track.keys.empty() ) t = std::min( t, track.keys.front().time );
+    return t;
+  }
+
+  inline Real
+  Animation::endTime() const
+  {
+    Real t = myCameraKeys.empty() ? 0.0f : myCameraKeys.back().time;
+    for ( const ObjectTrack& track : myTracks )
+      if ( ! track.keys.empty() ) t = std::max( t, track.keys.back().time );
+    return t;
+  }
+
+  inline CameraKey
+  Animation::cameraAt( Real t ) const
+  {
+    assert( ! myCameraKeys.empty() );
+    if ( t <= myCameraKeys.front().time ) return myCameraKeys.front();
+    for ( std::size_t i = 1; i < myCameraKeys.size(); ++i )
+      {
+        const CameraKey& k0 = myCameraKeys[ i - 1 ];
+        const CameraKey& k1 = myCameraKeys[ i ];
+        if ( t > k1.time ) continue;
+        Real u = k1.time > k0.time ? ( t - k0.time ) / ( k1.time - k0.time ) : 1.0f;
+        Real v = 1.0f - u;
+        return CameraKey{ t, v * k0.origin + u * k1.origin,
+                          v * k0.dirUL + u * k1.dirUL, v * k0.dirUR + u * k1.dirUR,
+                          v * k0.dirLL + u * k1.dirLL, v * k0.dirLR + u * k1.dirLR };
+      }
+    return myCameraKeys.back();
+  }
+
+  inline Vector3
+  Animation::translationAt( const ObjectTrack& track, Real t )
+  {
+    if ( track.keys.empty() ) return Vector3( 0.0f, 0.0f, 0.0f );
+    if ( t <= track.keys.front().time ) return track.keys.front().translation;
+    for ( std::size_t i = 1; i < track.keys.size(); ++i )
+      {
+        const ObjectKey& k0 = track.keys[ i - 1 ];
+        const ObjectKey& k1 = track.keys[ i ];
+        if ( t > k1.time ) continue;
+        Real u = k1.time > k0.time ? ( t - k0.time ) / ( k1.time - k0.time ) : 1.0f;
+        return ( 1.0f - u ) * k0.translation + u * k1.translation;
+      }
+    return track.keys.back().translation;
+  }
+
+  inline int
+  Animation::render( Scene& scene, Renderer& renderer, const std::string& prefix,
+                     Real fps, int width, int height, int max_depth )
+  {
+    // Index of each animated object in the scene, found once.
+    std::map< GraphicalObject*, int > index;
+    for ( const ObjectTrack& track : myTracks ) index[ track.object ] = -1;
+    for ( int i = 0; i < (int) scene.myObjects.size(); ++i )
+      {
+        auto it = index.find( scene.myObjects[ i ] );
+        if ( it != index.end() ) it->second = i;
+      }
+    std::vector< Vector3 > applied( myTracks.size(), Vector3( 0.0f, 0.0f, 0.0f ) );
+    std::vector< int >     moved;
+
+    renderer.setScene( scene );
+    renderer.setResolution( width, height );
+    Image2D<Color> image( width, height );
+    Real t0 = startTime();
+    Real t1 = endTime();
+    int  nb = 1 + (int) floor( ( t1 - t0 ) * fps + 0.5f );
+    for ( int f = 0; f < nb; ++f )
+      {
+        Real t = t0 + f / fps;
+        // Objects are moved in place, then the scene is refitted.
+        moved.clear();
+        for ( std::size_t k = 0; k < myTracks.size(); ++k )
+          {
+            Vector3 delta = translationAt( myTracks[ k ], t ) - applied[ k ];
+            if ( delta.dot( delta ) == 0.0f ) continue;
+            myTracks[ k ].object->translate( delta );
+            applied[ k ] += delta;
+            int i = index[ myTracks[ k ].object ];
+            if ( i >= 0 ) moved.push_back( i );
+          }
+        scene.refit( moved );
+        if ( ! myCameraKeys.empty() )
+          {
+            CameraKey c = cameraAt( t );
+            renderer.setViewBox( c.origin, c.dirUL, c.dirUR, c.dirLL, c.dirLR );
+          }
+        renderer.render( image, max_depth );
+        char number[ 16 ];
+        snprintf( number, sizeof( number ), "%04d", f );
+        std::ofstream output( ( prefix + number + ".ppm" ).c_str(), std::ios::binary );
+        Image2DWriter<Color>::write( image, output, false );
+      }
+    // Puts the objects back.
+    moved.clear();
+    for ( std::size_t k = 0; k < myTracks.size(); ++k )
+      {
+        myTracks[ k ].object->translate( -1.0f * applied[ k ] );
+        int i = index[ myTracks[ k ].object ];
+        if ( i >= 0 ) moved.push_back( i );
+      }
+    scene.refit( moved );
+    return nb;
+  }
+
+} // namespace rt
+
+#endif // #define _ANIMATION_H_
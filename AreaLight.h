@@ -0,0 +1,160 @@
+/**
+@file AreaLight.h
+*/
+#pragma once
+#ifndef _AREA_LIGHT_H_
+#define _AREA_LIGHT_H_
+
+#include <algorithm>
+#include <cmath>
+#include "PointLight.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A light with an extent, which casts soft shadows. It is seen as a
+  /// point light at its center for shading and in the OpenGL window,
+  /// but its shadows are sampled over its surface, divided into n x n
+  /// strata (one sample per stratum).
+  ///
+  /// The samples are ordered so that the first four are the corner
+  /// strata, i.e. spread over the whole light: the renderer uses them
+  /// as probes to detect penumbra (see Renderer::myAdaptiveShadows).
+  ///
+  /// Area lights are baked with their shape (see BakedLight), so that
+  /// their shadows are sampled without calling them during a render.
+  struct AreaLight : public PointLight {
+
+    /// Constructor. The light is centered at \a center (at finite
+    /// distance), and sampled with \a strata x \a strata samples.
+    AreaLight( GLenum light_number, Point3 center, Color emission_color,
+               int strata = 4 )
+      : PointLight( light_number,
+                    Point4( center[ 0 ], center[ 1 ], center[ 2 ], 1.0f ),
+                    emission_color )
+    {
+      setStrata( strata );
+    }
+
+    /// Sets the number of strata along each dimension of the light.
+    void setStrata( int strata )
+    {
+      myStrata = std::max( 1, strata );
+    }
+
+    /// @return the number of strata along each dimension of the light.
+    int strata() const { return myStrata; }
+
+    int nbSamples() const { return myStrata * myStrata; }
+
+    void sample( const Vector3& p, int k, Real u, Real v,
+                 Vector3& L, Real& d ) const
+    {
+      int  s  = BakedLight::stratum( myStrata, k );
+      Real su = ( s % myStrata + u ) / myStrata;
+      Real sv = ( s / myStrata + v ) / myStrata;
+      L = samplePoint( p, su, sv ) - p;
+      d = L.norm();
+      L /= d;
+    }
+
+    /// The light is bounded when its center is, and then its bounding
+    /// sphere is enlarged by its extent.
+    bool boundingSphere( Real threshold, Point3& center, Real& radius ) const
+    {
+      if ( ! PointLight::boundingSphere( threshold, center, radius ) ) return false;
+      radius += extent();
+      return true;
+    }
+
+    /// @return the point (s,t) in [0,1)^2 of the surface of the light,
+    /// as seen from point \a p.
+    virtual Point3 samplePoint( const Vector3& p, Real s, Real t ) const = 0;
+
+    /// @return the maximal distance of a point of the light to its center.
+    virtual Real extent() const = 0;
+
+    /// @return the center of the light.
+    Point3 center() const { return Vector3( position.data() ) / position[ 3 ]; }
+
+    /// Bakes the light as a point light at its center, with its strata
+    /// (the shape is given by the subclasses).
+    bool bake( BakedLight& baked ) const
+    {
+      PointLight::bake( baked );
+      baked.strata = myStrata;
+      return true;
+    }
+
+  protected:
+    /// The number of strata along each dimension.
+    int myStrata;
+  };
+
+  /// A spherical light. Seen from a point, it is sampled over the disk
+  /// of its silhouette.
+  struct SphereLight : public AreaLight {
+    /// The radius of the light.
+    Real radius;
+
+    SphereLight( GLenum light_number, Point3 center, Real r, Color emission_color,
+                 int strata = 4 )
+      : AreaLight( light_number, center, emission_color, strata ), radius( r )
+    {}
+
+    /// Maps (s,t) onto the disk (see BakedLight::diskPoint).
+    Point3 samplePoint( const Vector3& p, Real s, Real t ) const
+    {
+      return BakedLight::diskPoint( center(), radius, p, s, t );
+    }
+
+    Real extent() const { return radius; }
+
+    bool bake( BakedLight& baked ) const
+    {
+      AreaLight::bake( baked );
+      baked.shape  = BakedLight::Disk;
+      baked.radius = radius;
+      return true;
+    }
+
+    Light* clone() const { return cloneLight( *this ); }
+  };
+
+  /// A parallelogram light, centered at its position and spanned by
+  /// two edges.
+  struct QuadLight : public AreaLight {
+    /// The two edges of the light.
+    Vector3 edge1, edge2;
+
+    QuadLight( GLenum light_number, Point3 center, Vector3 e1, Vector3 e2,
+               Color emission_color, int strata = 4 )
+      : AreaLight( light_number, center, emission_color, strata ),
+        edge1( e1 ), edge2( e2 )
+    {}
+
+    Point3 samplePoint( const Vector3& /* p */, Real s, Real t ) const
+    {
+      return BakedLight::quadPoint( center(), edge1, edge2, s, t );
+    }
+
+    Real extent() const
+    {
+      return 0.5f * std::max( ( edge1 + edge2 ).norm(), ( edge1 - edge2 ).norm() );
+    }
+
+    bool bake( BakedLight& baked ) const
+    {
+      AreaLight::bake( baked );
+      baked.shape = BakedLight::Quad;
+      baked.edge1 = edge1;
+      baked.edge2 = edge2;
+      return true;
+    }
+
+    Light* clone() const { return cloneLight( *this ); }
+  };
+
+} // namespace rt
+
+#endif // #define _AREA_LIGHT_H_
@@ -0,0 +1,132 @@
+/**
+@file BakedLight.h
+*/
+#pragma once
+#ifndef _BAKED_LIGHT_H_
+#define _BAKED_LIGHT_H_
+
+#include <cmath>
+#include "PointVector.h"
+#include "Color.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A snapshot of a light taken at the beginning of a render (see
+  /// Light::bake): plain data read by the renderer at each hit instead
+  /// of calling the virtual methods of the light. Later changes of the
+  /// light (e.g. moved by its manipulator in the viewer) do not affect
+  /// the render in progress. Area lights (see AreaLight.h) also bake the
+  /// shape over which their shadows are sampled.
+  struct BakedLight {
+    /// The kinds of baked lights.
+    enum Type {
+      Unbaked,     ///< the light must be queried through Light.
+      Directional, ///< a light at infinity.
+      Point,       ///< a light at finite distance, without attenuation.
+      Attenuated   ///< a light at finite distance, with attenuation.
+    };
+
+    /// The kind of the light.
+    Type type;
+    /// The position of the light, or the unit direction to it if it is
+    /// directional.
+    Vector3 position;
+    /// The emission color of the light.
+    Color emission;
+    /// The constant, linear and quadratic attenuation factors.
+    Vector3 attenuation;
+    /// The number of samples of its shadows (see Light::nbSamples).
+    int samples;
+
+    /// The shapes of baked area lights.
+    enum Shape {
+      NoShape, ///< a point light (or an area light sampled through Light).
+      Disk,    ///< a spherical light, sampled over its silhouette.
+      Quad     ///< a parallelogram light.
+    };
+    /// The shape of the light.
+    Shape shape;
+    /// The number of strata along each dimension of an area light.
+    int strata;
+    /// The radius of a spherical light.
+    Real radius;
+    /// The edges of a parallelogram light.
+    Vector3 edge1, edge2;
+
+    /// @return the unit direction from \a p to the light.
+    Vector3 direction( const Vector3& p ) const
+    {
+      if ( type == Directional ) return position;
+      Vector3 L = position - p;
+      return L / L.norm();
+    }
+
+    /// @return the color of the light seen from \a p.
+    Color color( const Vector3& p ) const
+    {
+      if ( type != Attenuated ) return emission;
+      Real d = distance( p, position );
+      return emission * ( 1.0f / ( attenuation[ 0 ]
+                                   + d * ( attenuation[ 1 ] + d * attenuation[ 2 ] ) ) );
+    }
+
+    /// Same as Light::sample, for an area light (shape != NoShape).
+    void sample( const Vector3& p, int k, Real u, Real v, Vector3& L, Real& d ) const
+    {
+      int  s  = stratum( strata, k );
+      Real su = ( s % strata + u ) / strata;
+      Real sv = ( s / strata + v ) / strata;
+      L = ( shape == Disk ? diskPoint( position, radius, p, su, sv )
+                          : quadPoint( position, edge1, edge2, su, sv ) ) - p;
+      d = L.norm();
+      L /= d;
+    }
+
+    /// @return the stratum of sample \a k of an area light of \a n x \a
+    /// n strata: the four corner strata come first, so that the first
+    /// samples are spread over the whole light, then the others in order.
+    static int stratum( int n, int k )
+    {
+      if ( n == 1 ) return 0;
+      const int corners[ 4 ] = { 0, n - 1, n * ( n - 1 ), n * n - 1 };
+      if ( k < 4 ) return corners[ k ];
+      int s = k - 4;
+      for ( int c : corners )
+        if ( c <= s ) ++s;
+      return s;
+    }
+
+    /// @return the point (s,t) in [0,1)^2 of the disk of center \a c and
+    /// radius \a r facing \a p, with the concentric mapping of Shirley
+    /// and Chiu, which keeps the strata compact.
+    static Point3 diskPoint( const Point3& c, Real r, const Vector3& p, Real s, Real t )
+    {
+      Vector3 w = c - p;
+      w /= w.norm();
+      Vector3 a = std::fabs( w[ 0 ] ) > 0.5f ? Vector3( 0.0f, 1.0f, 0.0f )
+                                              : Vector3( 1.0f, 0.0f, 0.0f );
+      Vector3 e1 = w.cross( a );
+      e1 /= e1.norm();
+      Vector3 e2 = w.cross( e1 );
+      Real x = 2.0f * s - 1.0f;
+      Real y = 2.0f * t - 1.0f;
+      Real rho, phi;
+      if ( x == 0.0f && y == 0.0f ) { rho = 0.0f; phi = 0.0f; }
+      else if ( std::fabs( x ) > std::fabs( y ) ) { rho = x; phi = ( M_PI / 4.0 ) * ( y / x ); }
+      else { rho = y; phi = ( M_PI / 2.0 ) - ( M_PI / 4.0 ) * ( x / y ); }
+      return c + ( r * rho * std::cos( phi ) ) * e1 + ( r * rho * std::sin( phi ) ) * e2;
+    }
+
+    /// @return the point (s,t) in [0,1)^2 of the parallelogram of center
+    /// \a c spanned by \a e1 and \a e2.
+    static Point3 quadPoint( const Point3& c, const Vector3& e1, const Vector3& e2,
+                             Real s, Real t )
+    {
+      return c + ( s - 0.5f ) * e1 + ( t - 0.5f ) * e2;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _BAKED_LIGHT_H_
@@ -6,6 +6,7 @@
 #ifndef _COLOR_HPP_
 #define _COLOR_HPP_
 
+#include <algorithm>
 #include "PointVector.h"
 
 namespace rt {
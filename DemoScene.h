@@ -0,0 +1,66 @@
+/**
+@file DemoScene.h
+*/
+#pragma once
+#ifndef _DEMO_SCENE_H_
+#define _DEMO_SCENE_H_
+
+#include "Scene.h"
+#include "Sphere.h"
+#include "Material.h"
+#include "PointLight.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Adds a transparent bubble, i.e. two concentric spheres, the inner
+  /// one having its refractive indices swapped. \a TScene is Scene or a
+  /// StaticScene of spheres.
+  template <typename TScene>
+  inline void addBubble( TScene& scene, Point3 c, Real r, Material transp_m )
+  {
+    Material revert_m = transp_m;
+    revert_m.setRefractiveIndices( transp_m.out_refractive_index, transp_m.in_refractive_index );
+    Sphere* sphere_out = new Sphere( c, r, transp_m );
+    Sphere* sphere_in  = new Sphere( c, r-0.02f, revert_m );
+    scene.addObject( sphere_out );
+    scene.addObject( sphere_in );
+  }
+
+  /// Fills \a scene with the reference scene, shared by the viewer,
+  /// the headless renderer, the tests and the benchmarks.
+  template <typename TScene>
+  inline void buildDemoScene( TScene& scene )
+  {
+    // Light at infinity
+    Light* light0 = new PointLight( GL_LIGHT0, Point4( 0,0,1,0 ),
+                                    Color( 1.0, 1.0, 1.0 ) );
+    Light* light1 = new PointLight( GL_LIGHT1, Point4( -10,-4,2,1 ),
+                                    Color( 1.0, 1.0, 1.0 ) );
+    scene.addLight( light0 );
+    scene.addLight( light1 );
+    // Objects
+    Sphere* sphere1 = new Sphere( Point3( 0, 0, 0), 2.0, Material::bronze() );
+    Sphere* sphere2 = new Sphere( Point3( 0, 4, 0), 1.0, Material::emerald() );
+    Sphere* sphere3 = new Sphere( Point3( 6, 6, 0), 3.0, Material::whitePlastic() );
+    scene.addObject( sphere1 );
+    scene.addObject( sphere2 );
+    scene.addObject( sphere3 );
+
+    addBubble( scene, Point3( -5, 4, -1 ), 2.0, Material::glass() );
+  }
+
+  /// Places the camera of \a renderer so that it sees the reference
+  /// scene roughly as the viewer does at startup.
+  template <typename TRenderer>
+  inline void setDemoCamera( TRenderer& renderer, int width, int height )
+  {
+    renderer.setLookAt( Point3( -14.0f, -12.0f, 8.0f ), Point3( 0.0f, 2.0f, 0.0f ),
+                        Vector3( 0.0f, 0.0f, 1.0f ), 45.0f,
+                        (Real) width / (Real) height );
+    renderer.setResolution( width, height );
+  }
+
+} // namespace rt
+
+#endif // #define _DEMO_SCENE_H_
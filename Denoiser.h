@@ -0,0 +1,122 @@
+/**
+@file Denoiser.h
+*/
+#pragma once
+#ifndef _DENOISER_H_
+#define _DENOISER_H_
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "RenderPasses.h"
+#include "Parallel.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Edge-aware denoiser for stochastic renders (e.g. with
+  Renderer::setMaxLights), using the passes of the same render as
+  guides: an edge-avoiding À-Trous wavelet filter (Dammertz et al.
+  2010). Each iteration is a 5x5 B3-spline blur whose taps are 2^i
+  pixels apart, so that a few iterations cover a large footprint. Each
+  tap is weighted by how much its guides match those of the center:
+  object id, normal, depth and (noisy) color.
+
+  The color is divided by the albedo before filtering and multiplied
+  back after, so that texture detail is not blurred with the noise.
+  Background pixels are left as is and never used as taps.
+
+  Iterations are run in parallel over the lines of the image.
+  */
+  struct ATrousDenoiser {
+    /// Number of iterations (the footprint is about 2^(iterations+2) pixels).
+    int  myIterations = 5;
+    /// Color deviation, halved at each iteration.
+    Real mySigmaColor = 2.0f;
+    /// Exponent of the normal weight max(0,n.n')^sigma.
+    Real mySigmaNormal = 64.0f;
+    /// Relative depth deviation.
+    Real mySigmaDepth = 0.02f;
+
+    /// Denoises \a noisy, rendered with guides \a passes, into \a out.
+    void denoise( const Image2D<Color>& noisy, const RenderPasses& passes,
+                  Image2D<Color>& out, int nb_threads = 0 ) const
+    {
+      int w = noisy.w();
+      int h = noisy.h();
+      std::vector< Vector3 > current( w * h ), next( w * h );
+      std::vector< Vector3 > albedo( w * h );
+      for ( int y = 0; y < h; ++y )
+        for ( int x = 0; x < w; ++x )
+          {
+            Color a = passes.albedo.at( x, y );
+            Color c = noisy.at( x, y );
+            Vector3 av( a.r() + EPSILON, a.g() + EPSILON, a.b() + EPSILON );
+            albedo[ x + y * w ]  = av;
+            current[ x + y * w ] = Vector3( c.r() / av[ 0 ], c.g() / av[ 1 ], c.b() / av[ 2 ] );
+          }
+      static const Real B3[ 5 ] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+      Real sigma_color = mySigmaColor;
+      for ( int it = 0; it < myIterations; ++it )
+        {
+          int  step  = 1 << it;
+          Real color = -1.0f / ( sigma_color * sigma_color );
+          parallelFor( 0, h, nb_threads, [&] ( long begin, long end ) {
+              for ( long y = begin; y < end; ++y )
+                for ( int x = 0; x < w; ++x )
+                  {
+                    int p = x + y * w;
+                    int id = passes.objectId.at( x, (int) y );
+                    if ( id < 0 ) { next[ p ] = current[ p ]; continue; }
+                    const Vector3& cp = current[ p ];
+                    Vector3 np = passes.normal.at( x, (int) y );
+                    Real    zp = passes.depth.at( x, (int) y );
+                    Vector3 sum( 0.0f, 0.0f, 0.0f );
+                    Real    total = 0.0f;
+                    for ( int j = -2; j <= 2; ++j )
+                      {
+                        int qy = (int) y + j * step;
+                        if ( qy < 0 || qy >= h ) continue;
+                        for ( int i = -2; i <= 2; ++i )
+                          {
+                            int qx = x + i * step;
+                            if ( qx < 0 || qx >= w ) continue;
+                            if ( passes.objectId.at( qx, qy ) != id ) continue;
+                            int     q  = qx + qy * w;
+                            Vector3 dc = current[ q ] - cp;
+                            Real    cn = std::max( 0.0f, np.dot( passes.normal.at( qx, qy ) ) );
+                            Real    dz = std::fabs( passes.depth.at( qx, qy ) - zp ) / ( mySigmaDepth * zp * step );
+                            Real    wq = B3[ i + 2 ] * B3[ j + 2 ]
+                              * exp( color * dc.dot( dc ) - dz ) * pow( cn, mySigmaNormal );
+                            sum   += wq * current[ q ];
+                            total += wq;
+                          }
+                      }
+                    next[ p ] = total > 0.0f ? sum / total : cp;
+                  }
+            } );
+          current.swap( next );
+          sigma_color *= 0.5f;
+        }
+      out = Image2D<Color>( w, h );
+      for ( int y = 0; y < h; ++y )
+        for ( int x = 0; x < w; ++x )
+          {
+            const Vector3& c = current[ x + y * w ];
+            const Vector3& a = albedo[ x + y * w ];
+            out.at( x, y ) = Color( c[ 0 ] * a[ 0 ], c[ 1 ] * a[ 1 ], c[ 2 ] * a[ 2 ] );
+          }
+    }
+
+  private:
+    /// Added to the albedo, so that black surfaces keep their color.
+    static constexpr Real EPSILON = 0.01f;
+  };
+
+} // namespace rt
+
+#endif // #define _DENOISER_H_
@@ -0,0 +1,468 @@
+/**
+@file DistributedRenderer.h
+
+POSIX only (fork, sockets, poll).
+*/
+#pragma once
+#ifndef _DISTRIBUTED_RENDERER_H_
+#define _DISTRIBUTED_RENDERER_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Color.h"
+#include "Image2D.h"
+#include "Scene.h"
+#include "Renderer.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Renders an image with several worker processes. The coordinator (the
+  calling process) splits the image into tiles and hands them out, one
+  at a time, to the workers. Each worker talks to the coordinator
+  through its own socket: it receives tile requests (x, y, w, h) and
+  sends back the tile pixels as floats.
+
+  - renderRemote() is the network mode: workers on other machines
+    connect to the coordinator over TCP (see work(), and
+    ray-tracer-headless --worker host:port). Each receives a Job (scene
+    identifier, view, resolution, depth) from which it builds its own
+    scene and renderer. Only these are sent: the other settings of the
+    renderer (background, environment light, light sampling, ...) are
+    the defaults of the workers. The job and the pixels are sent in the
+    native byte order, which the machines must share.
+  - render() forks local workers, which have the same scene and
+    renderer without any serialization. It is a harness to test the
+    scheduling on one machine.
+
+  If a worker dies (crash, killed, ...), its socket is closed; if it
+  does not answer within myTileTimeout (hung, or too slow), it is
+  dropped (and killed, if it was forked). Either way, the tile it was
+  rendering goes back to the queue and the other workers go on. If no
+  worker is left, the coordinator renders the remaining tiles itself.
+  */
+  struct DistributedRenderer {
+    /// What a remote worker needs to render tiles.
+    struct Job {
+      uint32_t magic;     ///< JOB_MAGIC.
+      int32_t  scene;     ///< the scene, see work().
+      int32_t  width, height, max_depth;
+      float    view[ 15 ]; ///< origin, dirUL, dirUR, dirLL, dirLR (see Renderer::setViewBox).
+    };
+    static constexpr uint32_t JOB_MAGIC = 0x31424a52; // "RJB1"
+
+    /// The number of worker processes (forked, or expected to connect).
+    int myWorkers = 4;
+    /// The size of the (square) tiles.
+    int myTileSize = 64;
+    /// The time (in seconds) a worker may take to render a tile, beyond
+    /// which it is dropped (<= 0: no limit).
+    double myTileTimeout = 60.0;
+    /// The time (in seconds) renderRemote() waits for its workers to
+    /// connect.
+    double myConnectTimeout = 30.0;
+    /// For testing fault tolerance: if >= 0, the first forked worker exits
+    /// without answering when it receives its (myFailAfter+1)-th tile.
+    int myFailAfter = -1;
+    /// For testing the timeout: if >= 0, the first forked worker hangs
+    /// (without exiting) when it receives its (myHangAfter+1)-th tile.
+    int myHangAfter = -1;
+    /// Counters for the last render.
+    int myDeadWorkers = 0, myReassignedTiles = 0, myLocalTiles = 0;
+
+    /// Renders the view of \a renderer into \a image, with myWorkers
+    /// forked workers.
+    /// @return 'false' if some workers could not be started (the image is
+    /// still complete, rendered by fewer processes), or if \a image could
+    /// not be given the size of the render (nothing is rendered, see
+    /// fitImage).
+    /// As for Renderer::render, \a image may be any Image2D whose values
+    /// can be assigned a Color: tiles are pasted in place.
+    template <typename TImage>
+    bool render( Renderer& renderer, TImage& image, int max_depth )
+    {
+      if ( ! fitImage( image, renderer.myWidth, renderer.myHeight ) ) return false;
+      renderer.prepare();
+      std::vector< Worker > workers;
+      bool started = true;
+      for ( int k = 0; k < myWorkers; ++k )
+        {
+          int fds[ 2 ];
+          if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 ) { started = false; break; }
+          pid_t pid = fork();
+          if ( pid < 0 ) { close( fds[ 0 ] ); close( fds[ 1 ] ); started = false; break; }
+          if ( pid == 0 )
+            {
+              // The worker does not need the sockets of the other workers.
+              close( fds[ 0 ] );
+              for ( const Worker& w : workers ) close( w.fd );
+              serve( renderer, fds[ 1 ], max_depth, k == 0 ? myFailAfter : -1,
+                     k == 0 ? myHangAfter : -1 );
+              _exit( 0 );
+            }
+          close( fds[ 1 ] );
+          workers.push_back( Worker{ pid, fds[ 0 ], false, Tile(), Clock::time_point() } );
+        }
+      schedule( renderer, image, max_depth, workers );
+      return started;
+    }
+
+    /// Renders the view of \a renderer into \a image, with the (up to
+    /// myWorkers) workers connecting within myConnectTimeout to the
+    /// listening socket \a listener (see listenOn). Each one is sent the
+    /// job of rendering scene \a scene (the scene of \a renderer, as
+    /// the workers know it) with the view of \a renderer.
+    /// @return 'false' if fewer workers connected (the image is still
+    /// complete), or if \a image could not be given the size of the
+    /// render (nothing is rendered).
+    template <typename TImage>
+    bool renderRemote( Renderer& renderer, TImage& image, int max_depth, int listener, int scene = 0 )
+    {
+      if ( ! fitImage( image, renderer.myWidth, renderer.myHeight ) ) return false;
+      renderer.prepare();
+      Job job = makeJob( renderer, max_depth, scene );
+      std::vector< Worker > workers;
+      Clock::time_point end = Clock::now() + seconds( myConnectTimeout );
+      while ( (int) workers.size() < myWorkers )
+        {
+          pollfd p{ listener, POLLIN, 0 };
+          int    r = poll( &p, 1, millisecondsUntil( end ) );
+          if ( r < 0 && errno == EINTR ) continue;
+          if ( r <= 0 ) break;
+          int fd = accept( listener, 0, 0 );
+          if ( fd < 0 ) continue;
+          if ( ! sendAll( fd, &job, sizeof( job ) ) ) { close( fd ); continue; }
+          workers.push_back( Worker{ -1, fd, false, Tile(), Clock::time_point() } );
+        }
+      bool started = (int) workers.size() == myWorkers;
+      schedule( renderer, image, max_depth, workers );
+      return started;
+    }
+
+    /// The worker of renderRemote(): connects to the coordinator at \a
+    /// host:\a port, receives its job, builds the scene with \a
+    /// build( scene, job.scene ) (which returns 'false' for an unknown
+    /// scene), then renders the requested tiles until the coordinator
+    /// closes the connection.
+    /// @return 'false' if the connection or the job failed.
+    template <typename TBuild>
+    static bool work( const std::string& host, int port, TBuild build )
+    {
+      int fd = connectTo( host, port );
+      if ( fd < 0 ) return false;
+      Job   job;
+      Scene scene;
+      if ( ! receiveAll( fd, &job, sizeof( job ) ) || job.magic != JOB_MAGIC
+           || job.width <= 1 || job.height <= 1 || job.max_depth < 0
+           || ! build( scene, (int) job.scene ) )
+        {
+          close( fd );
+          return false;
+        }
+      Renderer renderer( scene );
+      renderer.setVerbose( false );
+      const float* v = job.view;
+      renderer.setViewBox( Point3( v[ 0 ], v[ 1 ], v[ 2 ] ), Vector3( v[ 3 ], v[ 4 ], v[ 5 ] ),
+                           Vector3( v[ 6 ], v[ 7 ], v[ 8 ] ), Vector3( v[ 9 ], v[ 10 ], v[ 11 ] ),
+                           Vector3( v[ 12 ], v[ 13 ], v[ 14 ] ) );
+      renderer.setResolution( job.width, job.height );
+      renderer.prepare();
+      serve( renderer, fd, job.max_depth, -1, -1 );
+      return true;
+    }
+
+    /// @return a TCP socket listening on \a port (0: any free port, see
+    /// localPort) on all interfaces, or -1.
+    static int listenOn( int port )
+    {
+      int fd = socket( AF_INET, SOCK_STREAM, 0 );
+      if ( fd < 0 ) return -1;
+      int one = 1;
+      setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+      sockaddr_in address;
+      std::memset( &address, 0, sizeof( address ) );
+      address.sin_family      = AF_INET;
+      address.sin_addr.s_addr = htonl( INADDR_ANY );
+      address.sin_port        = htons( (uint16_t) port );
+      if ( bind( fd, (sockaddr*) &address, sizeof( address ) ) != 0 || listen( fd, 16 ) != 0 )
+        {
+          close( fd );
+          return -1;
+        }
+      return fd;
+    }
+
+    /// @return the port of the listening socket \a fd, or -1.
+    static int localPort( int fd )
+    {
+      sockaddr_in address;
+      socklen_t   size = sizeof( address );
+      if ( getsockname( fd, (sockaddr*) &address, &size ) != 0 ) return -1;
+      return ntohs( address.sin_port );
+    }
+
+    /// @return a TCP socket connected to \a host:\a port, or -1.
+    static int connectTo( const std::string& host, int port )
+    {
+      addrinfo  hints;
+      addrinfo* addresses = 0;
+      std::memset( &hints, 0, sizeof( hints ) );
+      hints.ai_family   = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      if ( getaddrinfo( host.c_str(), std::to_string( port ).c_str(), &hints, &addresses ) != 0 )
+        return -1;
+      int fd = -1;
+      for ( addrinfo* a = addresses; a != 0 && fd < 0; a = a->ai_next )
+        {
+          fd = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+          if ( fd >= 0 && connect( fd, a->ai_addr, a->ai_addrlen ) != 0 )
+            {
+              close( fd );
+              fd = -1;
+            }
+        }
+      freeaddrinfo( addresses );
+      return fd;
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Tile { int x, y, w, h; };
+    struct Worker {
+      pid_t pid;  ///< the process of a forked worker, -1 for a remote one.
+      int   fd;   ///< socket to the worker, -1 once it is dead.
+      bool  busy; ///< 'true' while it renders \a tile.
+      Tile  tile;
+      Clock::time_point deadline; ///< when it must have sent \a tile.
+    };
+
+    static Clock::duration seconds( double s )
+    {
+      return std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( s ) );
+    }
+
+    /// @return the number of milliseconds (rounded up) until \a t, or 0.
+    static int millisecondsUntil( Clock::time_point t )
+    {
+      auto ms = std::chrono::duration_cast< std::chrono::milliseconds >( t - Clock::now() ).count();
+      return (int) std::max< long long >( 0, std::min< long long >( ms + 1, 1 << 30 ) );
+    }
+
+    static Job makeJob( const Renderer& renderer, int max_depth, int scene )
+    {
+      Job job;
+      job.magic     = JOB_MAGIC;
+      job.scene     = scene;
+      job.width     = renderer.myWidth;
+      job.height    = renderer.myHeight;
+      job.max_depth = max_depth;
+      const Vector3* vectors[ 5 ] = { &renderer.myOrigin, &renderer.myDirUL, &renderer.myDirUR,
+                                      &renderer.myDirLL, &renderer.myDirLR };
+      for ( int i = 0; i < 5; ++i )
+        for ( int j = 0; j < 3; ++j ) job.view[ 3 * i + j ] = ( *vectors[ i ] )[ j ];
+      return job;
+    }
+
+    /// Hands out the tiles of the image to \a workers until it is
+    /// complete, then closes their sockets (which stops them).
+    template <typename TImage>
+    void schedule( Renderer& renderer, TImage& image, int max_depth, std::vector< Worker >& workers )
+    {
+      int W = renderer.myWidth;
+      int H = renderer.myHeight;
+      myDeadWorkers = myReassignedTiles = myLocalTiles = 0;
+      std::deque< Tile > queue;
+      for ( int y = 0; y < H; y += myTileSize )
+        for ( int x = 0; x < W; x += myTileSize )
+          queue.push_back( Tile{ x, y, std::min( myTileSize, W - x ), std::min( myTileSize, H - y ) } );
+
+      std::size_t done  = 0;
+      std::size_t total = queue.size();
+      Image2D<Color> tile;
+      while ( done < total )
+        {
+          // Gives a tile to each idle worker.
+          std::vector< pollfd > fds;
+          std::vector< int >    busy;
+          Clock::time_point     first = Clock::time_point::max();
+          for ( int k = 0; k < (int) workers.size(); ++k )
+            {
+              Worker& w = workers[ k ];
+              if ( w.fd < 0 ) continue;
+              if ( ! w.busy && ! queue.empty() )
+                {
+                  w.tile = queue.front();
+                  queue.pop_front();
+                  w.busy = true;
+                  w.deadline = Clock::now() + seconds( myTileTimeout );
+                  int32_t request[ 4 ] = { w.tile.x, w.tile.y, w.tile.w, w.tile.h };
+                  if ( ! sendAll( w.fd, request, sizeof( request ) ) )
+                    { lose( w, queue ); continue; }
+                }
+              if ( w.busy )
+                {
+                  fds.push_back( pollfd{ w.fd, POLLIN, 0 } );
+                  busy.push_back( k );
+                  first = std::min( first, w.deadline );
+                }
+            }
+          if ( fds.empty() )
+            {
+              // No worker left: the coordinator finishes the job.
+              while ( ! queue.empty() )
+                {
+                  Tile t = queue.front();
+                  queue.pop_front();
+                  renderer.renderTile( tile, t.x, t.y, t.w, t.h, max_depth );
+                  paste( image, tile, t );
+                  ++myLocalTiles;
+                  ++done;
+                }
+              break;
+            }
+          int timeout = myTileTimeout > 0.0 ? millisecondsUntil( first ) : -1;
+          if ( poll( fds.data(), fds.size(), timeout ) < 0 )
+            {
+              if ( errno == EINTR ) continue;
+              for ( int k : busy ) lose( workers[ k ], queue );
+              continue;
+            }
+          Clock::time_point now = Clock::now();
+          for ( std::size_t i = 0; i < fds.size(); ++i )
+            {
+              Worker& w = workers[ busy[ i ] ];
+              if ( fds[ i ].revents == 0 )
+                {
+                  // Too late: the worker hangs, or is much too slow.
+                  if ( myTileTimeout > 0.0 && now >= w.deadline ) lose( w, queue );
+                  continue;
+                }
+              std::vector< float > pixels( 3 * w.tile.w * w.tile.h );
+              if ( ! receiveAll( w.fd, pixels.data(), pixels.size() * sizeof( float ) ) )
+                { lose( w, queue ); continue; }
+              tile = Image2D<Color>( w.tile.w, w.tile.h );
+              for ( int y = 0; y < w.tile.h; ++y )
+                for ( int x = 0; x < w.tile.w; ++x )
+                  {
+                    const float* c = &pixels[ 3 * ( x + y * w.tile.w ) ];
+                    tile.at( x, y ) = Color( c[ 0 ], c[ 1 ], c[ 2 ] );
+                  }
+              paste( image, tile, w.tile );
+              w.busy = false;
+              ++done;
+            }
+        }
+      // Closing the sockets stops the workers.
+      for ( Worker& w : workers )
+        {
+          if ( w.fd >= 0 ) close( w.fd );
+          if ( w.pid > 0 ) waitpid( w.pid, 0, 0 );
+        }
+    }
+
+    /// The worker is considered dead: its tile goes back to the queue. A
+    /// forked worker is killed, in case it hangs.
+    void lose( Worker& w, std::deque< Tile >& queue )
+    {
+      close( w.fd );
+      w.fd = -1;
+      if ( w.pid > 0 ) kill( w.pid, SIGKILL );
+      ++myDeadWorkers;
+      if ( w.busy )
+        {
+          queue.push_front( w.tile );
+          w.busy = false;
+          ++myReassignedTiles;
+        }
+    }
+
+    /// The worker loop: renders the requested tiles until the socket is
+    /// closed. For tests, it exits at its (fail_after+1)-th tile, or hangs
+    /// at its (hang_after+1)-th tile.
+    static void serve( Renderer& renderer, int fd, int max_depth, int fail_after, int hang_after )
+    {
+      Image2D<Color> tile;
+      std::vector< float > pixels;
+      int32_t request[ 4 ];
+      for ( int n = 0; receiveAll( fd, request, sizeof( request ) ); ++n )
+        {
+          if ( n == fail_after ) _exit( 1 );
+          if ( n == hang_after ) for ( ;; ) pause();
+          if ( request[ 2 ] <= 0 || request[ 3 ] <= 0
+               || request[ 0 ] < 0 || request[ 0 ] + request[ 2 ] > renderer.myWidth
+               || request[ 1 ] < 0 || request[ 1 ] + request[ 3 ] > renderer.myHeight )
+            break;
+          renderer.renderTile( tile, request[ 0 ], request[ 1 ], request[ 2 ], request[ 3 ], max_depth );
+          pixels.resize( 3 * tile.w() * tile.h() );
+          for ( int y = 0; y < tile.h(); ++y )
+            for ( int x = 0; x < tile.w(); ++x )
+              {
+                Color  c = tile.at( x, y );
+                float* p = &pixels[ 3 * ( x + y * tile.w() ) ];
+                p[ 0 ] = c.r(); p[ 1 ] = c.g(); p[ 2 ] = c.b();
+              }
+          if ( ! sendAll( fd, pixels.data(), pixels.size() * sizeof( float ) ) ) break;
+        }
+      close( fd );
+    }
+
+    template <typename TImage>
+    static void paste( TImage& image, const Image2D<Color>& tile, const Tile& t )
+    {
+      for ( int y = 0; y < t.h; ++y )
+        for ( int x = 0; x < t.w; ++x )
+          image.at( t.x + x, t.y + y ) = tile.at( x, y );
+    }
+
+    /// Sends \a size bytes (MSG_NOSIGNAL: a dead peer gives an error,
+    /// not a SIGPIPE).
+    static bool sendAll( int fd, const void* data, std::size_t size )
+    {
+      const char* p = static_cast< const char* >( data );
+      while ( size > 0 )
+        {
+          ssize_t n = send( fd, p, size, MSG_NOSIGNAL );
+          if ( n < 0 && errno == EINTR ) continue;
+          if ( n <= 0 ) return false;
+          p    += n;
+          size -= n;
+        }
+      return true;
+    }
+
+    /// Receives exactly \a size bytes.
+    /// @return 'false' on end of file or error.
+    static bool receiveAll( int fd, void* data, std::size_t size )
+    {
+      char* p = static_cast< char* >( data );
+      while ( size > 0 )
+        {
+          ssize_t n = recv( fd, p, size, 0 );
+          if ( n < 0 && errno == EINTR ) continue;
+          if ( n <= 0 ) return false;
+          p    += n;
+          size -= n;
+        }
+      return true;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _DISTRIBUTED_RENDERER_H_
@@ -0,0 +1,358 @@
+/**
+@file EnvironmentMap.h
+*/
+#pragma once
+#ifndef _ENVIRONMENT_MAP_H_
+#define _ENVIRONMENT_MAP_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "ImageLayout.h"
+#include "Background.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A background given by a high dynamic range environment map, in
+  latitude-longitude form: column x corresponds to the azimuth
+  atan2(y,x) and row y to the angle to the z axis (row 0 looks up).
+
+  - Lookups cost no trigonometry: directions are mapped to a square
+    with the octahedral mapping (one division), where a precomputed
+    table gives the texel coordinates of the map, which is then
+    filtered bilinearly. The table holds the texel coordinates of the
+    vertices of a grid, interpolated linearly over triangles that do
+    not cross the folds of the octahedron. Near the poles, where the
+    longitude is singular, the cells where this interpolation is not
+    accurate enough fall back to the exact computation.
+  - The map is stored by tiles (TiledLayout), so that the four texels
+    of a bilinear lookup, and the lookups of neighbouring rays, share
+    cache lines.
+  - For image-based lighting (see Renderer::setEnvironmentLight),
+    sample() draws directions with a probability proportional to the
+    luminance of the map (marginal and conditional cumulative
+    distributions over rows and columns), and pdf() gives their density.
+  */
+  struct EnvironmentMap : public Background {
+    /// The storage of the map.
+    typedef Image2D< Vector3, std::vector< Vector3 >, TiledLayout< 8 > > Map;
+
+    /// Builds the environment from the latitude-longitude image \a
+    /// latlong (its values are multiplied by \a scale). The lookup table
+    /// has \a resolution^2 cells (rounded up to an even number of cells
+    /// per side; 0: half the width of the image, i.e. a table a third of
+    /// the size of the map).
+    template <typename TImage>
+    EnvironmentMap( const TImage& latlong, Real scale = 1.0f, int resolution = 0 )
+      : myMap( latlong.w(), latlong.h() ), myW( latlong.w() ), myH( latlong.h() )
+    {
+      for ( int y = 0; y < myH; ++y )
+        for ( int x = 0; x < myW; ++x )
+          myMap.at( x, y ) = scale * Vector3( latlong.at( x, y ) );
+      myResolution = resolution > 0 ? resolution : myW / 2;
+      myResolution = std::max( 2, myResolution + myResolution % 2 );
+      buildTable();
+      buildDistribution();
+    }
+
+    Color backgroundColor( const Ray& ray ) override { return radiance( ray.direction ); }
+
+    /// @return lookup( d ) as a color.
+    Color radiance( const Vector3& d ) const
+    {
+      Vector3 v = lookup( d );
+      Color   c;
+      c.r() = v[ 0 ]; c.g() = v[ 1 ]; c.b() = v[ 2 ];
+      return c;
+    }
+
+    /// @return the width of the map.
+    int w() const { return myW; }
+    /// @return the height of the map.
+    int h() const { return myH; }
+
+    /// @return the bilinearly filtered value of the map in the unit
+    /// direction \a d, through the lookup table.
+    Vector3 lookup( const Vector3& d ) const
+    {
+      Real a = std::fabs( d[ 0 ] ) + std::fabs( d[ 1 ] ) + std::fabs( d[ 2 ] );
+      Real s = d[ 0 ] / a;
+      Real t = d[ 1 ] / a;
+      if ( d[ 2 ] < 0.0f )
+        {
+          Real s2 = ( 1.0f - std::fabs( t ) ) * ( s < 0.0f ? -1.0f : 1.0f );
+          t       = ( 1.0f - std::fabs( s ) ) * ( t < 0.0f ? -1.0f : 1.0f );
+          s       = s2;
+        }
+      int  R  = myResolution;
+      Real fs = ( s * 0.5f + 0.5f ) * R;
+      Real ft = ( t * 0.5f + 0.5f ) * R;
+      int  i  = std::min( R - 1, (int) fs );
+      int  j  = std::min( R - 1, (int) ft );
+      if ( myExact[ i + (std::size_t) j * R ] ) return lookupExact( d );
+      Real u, v;
+      interpolate( i, j, fs - i, ft - j, u, v );
+      return bilinear( u, v );
+    }
+
+    /// @return the same value as lookup, computed directly from the
+    /// angles of \a d (slower, but exact).
+    Vector3 lookupExact( const Vector3& d ) const
+    {
+      Real u, v;
+      texelCoordinates( d, u, v );
+      return bilinear( u, v );
+    }
+
+    /// Draws a unit direction \a d of the sphere with a probability
+    /// proportional to the luminance of the map, from \a u1 and \a u2
+    /// uniform in [0,1).
+    ///
+    /// @return the density of \a d (with respect to solid angle).
+    Real sample( Real u1, Real u2, Vector3& d ) const
+    {
+      int  j  = find( myMarginal, 0, myH, u1 );
+      Real dv = ( u1 - myMarginal[ j ] ) / std::max( myMarginal[ j + 1 ] - myMarginal[ j ], 1e-20f );
+      std::size_t row = (std::size_t) j * ( myW + 1 );
+      int  i  = find( myConditional, row, myW, u2 );
+      Real du = ( u2 - myConditional[ row + i ] )
+        / std::max( myConditional[ row + i + 1 ] - myConditional[ row + i ], 1e-20f );
+      Real theta = M_PI * ( j + dv ) / myH;
+      Real phi   = 2.0 * M_PI * ( i + du ) / myW - M_PI;
+      Real st    = std::sin( theta );
+      d = Vector3( st * std::cos( phi ), st * std::sin( phi ), std::cos( theta ) );
+      return density( i, j, st );
+    }
+
+    /// @return the density with which sample() draws the unit direction
+    /// \a d.
+    Real pdf( const Vector3& d ) const
+    {
+      Real u, v;
+      texelCoordinates( d, u, v );
+      int i = std::min( myW - 1, std::max( 0, (int) std::floor( u + 0.5f ) ) );
+      int j = std::min( myH - 1, std::max( 0, (int) std::floor( v + 0.5f ) ) );
+      return density( i, j, std::sqrt( std::max( 0.0f, 1.0f - d[ 2 ] * d[ 2 ] ) ) );
+    }
+
+    /// Gives the continuous texel coordinates (u,v) of the unit direction
+    /// \a d, texel (x,y) being centered at (x,y).
+    void texelCoordinates( const Vector3& d, Real& u, Real& v ) const
+    {
+      Real phi   = std::atan2( d[ 1 ], d[ 0 ] );
+      Real theta = std::acos( std::max( -1.0f, std::min( 1.0f, d[ 2 ] ) ) );
+      u = ( phi + M_PI ) / ( 2.0 * M_PI ) * myW - 0.5f;
+      v = theta / M_PI * myH - 0.5f;
+    }
+
+  private:
+    /// The map, by tiles.
+    Map  myMap;
+    /// Its size.
+    int  myW, myH;
+    /// The number of cells of the lookup table along each side (even, so
+    /// that the folds of the octahedron follow the edges and diagonals of
+    /// the cells).
+    int  myResolution;
+    /// The texel coordinates (u,v) of each vertex of the cells of the
+    /// octahedral square ((myResolution + 1)^2 vertices, line by line).
+    std::vector< Real > myTable;
+    /// Whether each cell is looked up exactly (see buildTable).
+    std::vector< char > myExact;
+    /// The largest error on the texel coordinates given by the table, in
+    /// texels, beyond which a cell is looked up exactly.
+    static constexpr Real MAX_TABLE_ERROR = 1.0f / 32.0f;
+    /// The cumulative distribution of the rows (myH + 1 values).
+    std::vector< Real > myMarginal;
+    /// The cumulative distribution of the texels within each row
+    /// (myW + 1 values per row, rows one after the other).
+    std::vector< Real > myConditional;
+    /// The sampling weight of each texel, divided by their mean.
+    std::vector< Real > myWeights;
+
+    /// @return the filtered value at texel coordinates (u,v), wrapping
+    /// around in longitude and clamping in latitude.
+    Vector3 bilinear( Real u, Real v ) const
+    {
+      v = std::max( 0.0f, std::min( (Real) ( myH - 1 ), v ) );
+      Real fu = std::floor( u );
+      int  y0 = std::min( myH - 2, (int) v );
+      if ( y0 < 0 ) y0 = 0;
+      Real a  = u - fu;
+      Real b  = myH > 1 ? v - y0 : 0.0f;
+      int  x0 = (int) fu % myW;
+      if ( x0 < 0 ) x0 += myW;
+      int  x1 = x0 + 1 == myW ? 0 : x0 + 1;
+      int  y1 = std::min( myH - 1, y0 + 1 );
+      return ( 1.0f - b ) * ( ( 1.0f - a ) * myMap.at( x0, y0 ) + a * myMap.at( x1, y0 ) )
+        +    b          * ( ( 1.0f - a ) * myMap.at( x0, y1 ) + a * myMap.at( x1, y1 ) );
+    }
+
+    /// Gives the texel coordinates (u,v) at the point (x,y) in [0,1]^2
+    /// of the cell (i,j) of the table. The cell is split along the fold
+    /// of its quadrant, so that each triangle lies on one face of the
+    /// octahedron: along the anti-diagonal when s and t have the same
+    /// sign, along the diagonal otherwise.
+    void interpolate( int i, int j, Real x, Real y, Real& u, Real& v ) const
+    {
+      int R = myResolution;
+      const Real* c00 = &myTable[ 2 * ( i + (std::size_t) j * ( R + 1 ) ) ];
+      const Real* c10 = c00 + 2;
+      const Real* c01 = c00 + 2 * ( R + 1 );
+      const Real* c11 = c01 + 2;
+      if ( ( 2 * i >= R ) == ( 2 * j >= R ) )
+        {
+          if ( x + y <= 1.0f ) triangle( c00, c10, c01, x, y, u, v );
+          else                 triangle( c11, c01, c10, 1.0f - x, 1.0f - y, u, v );
+        }
+      else
+        {
+          if ( x >= y ) triangle( c00, c10, c11, x - y, y, u, v );
+          else          triangle( c00, c01, c11, y - x, x, u, v );
+        }
+    }
+
+    /// Gives the texel coordinates (u,v) at the point of barycentric
+    /// coordinates (a,b) of the triangle (p0,p1,p2) of the table, i.e. at
+    /// p0 + a (p1 - p0) + b (p2 - p0). The longitudes of p1 and p2 are
+    /// first brought within half a turn of that of p0.
+    void triangle( const Real* p0, const Real* p1, const Real* p2, Real a, Real b,
+                   Real& u, Real& v ) const
+    {
+      Real du1  = p1[ 0 ] - p0[ 0 ];
+      Real du2  = p2[ 0 ] - p0[ 0 ];
+      Real half = 0.5f * myW;
+      if ( du1 > half ) du1 -= myW; else if ( du1 < -half ) du1 += myW;
+      if ( du2 > half ) du2 -= myW; else if ( du2 < -half ) du2 += myW;
+      u = p0[ 0 ] + a * du1 + b * du2;
+      v = p0[ 1 ] + a * ( p1[ 1 ] - p0[ 1 ] ) + b * ( p2[ 1 ] - p0[ 1 ] );
+    }
+
+    /// @return the unit direction at the point (s,t) of the octahedral
+    /// square (the inverse of the mapping of lookup).
+    static Vector3 octahedralDirection( Real s, Real t )
+    {
+      Real z = 1.0f - std::fabs( s ) - std::fabs( t );
+      if ( z < 0.0f )
+        {
+          Real s2 = ( 1.0f - std::fabs( t ) ) * ( s < 0.0f ? -1.0f : 1.0f );
+          t       = ( 1.0f - std::fabs( s ) ) * ( t < 0.0f ? -1.0f : 1.0f );
+          s       = s2;
+        }
+      Vector3 d( s, t, z );
+      return d / d.norm();
+    }
+
+    /// Fills the lookup table with the texel coordinates of the direction
+    /// at each vertex of the cells. The longitude varies too fast to be
+    /// interpolated near the poles, where it is singular: the cells
+    /// where the interpolation is off by more than MAX_TABLE_ERROR texels
+    /// at some of their points (the centroids of their triangles and the
+    /// middles of their edges) are marked to be looked up exactly.
+    void buildTable()
+    {
+      int R = myResolution;
+      myTable.resize( 2 * (std::size_t) ( R + 1 ) * ( R + 1 ) );
+      for ( int j = 0; j <= R; ++j )
+        for ( int i = 0; i <= R; ++i )
+          {
+            Vector3 d  = octahedralDirection( (Real) i / R * 2.0f - 1.0f,
+                                              (Real) j / R * 2.0f - 1.0f );
+            Real*   uv = &myTable[ 2 * ( i + (std::size_t) j * ( R + 1 ) ) ];
+            texelCoordinates( d, uv[ 0 ], uv[ 1 ] );
+          }
+      const Real probes[ 9 ][ 2 ] = {
+        { 1.0f / 3.0f, 1.0f / 3.0f }, { 2.0f / 3.0f, 2.0f / 3.0f },
+        { 1.0f / 3.0f, 2.0f / 3.0f }, { 2.0f / 3.0f, 1.0f / 3.0f },
+        { 0.5f, 0.5f }, { 0.5f, 0.0f }, { 0.0f, 0.5f }, { 0.5f, 1.0f }, { 1.0f, 0.5f } };
+      myExact.assign( (std::size_t) R * R, 0 );
+      for ( int j = 0; j < R; ++j )
+        for ( int i = 0; i < R; ++i )
+          for ( const auto& xy : probes )
+            {
+              Real u, v, eu, ev;
+              interpolate( i, j, xy[ 0 ], xy[ 1 ], u, v );
+              texelCoordinates( octahedralDirection( ( i + xy[ 0 ] ) / R * 2.0f - 1.0f,
+                                                     ( j + xy[ 1 ] ) / R * 2.0f - 1.0f ), eu, ev );
+              Real du = std::fabs( u - eu );
+              du = std::min( du, std::fabs( du - myW ) );
+              if ( std::max( du, std::fabs( v - ev ) ) > MAX_TABLE_ERROR )
+                {
+                  myExact[ i + (std::size_t) j * R ] = 1;
+                  break;
+                }
+            }
+    }
+
+    /// Builds the distributions of sample(): each texel weighs its
+    /// luminance times the sine of its latitude (the solid angle it
+    /// covers). A black map is sampled uniformly.
+    void buildDistribution()
+    {
+      myWeights.resize( (std::size_t) myW * myH );
+      myConditional.resize( (std::size_t) ( myW + 1 ) * myH );
+      myMarginal.resize( myH + 1 );
+      double total = 0.0;
+      for ( int pass = 0; pass < 2 && total == 0.0; ++pass )
+        for ( int y = 0; y < myH; ++y )
+          {
+            Real st = std::sin( M_PI * ( y + 0.5f ) / myH );
+            for ( int x = 0; x < myW; ++x )
+              {
+                const Vector3& c = myMap.at( x, y );
+                Real l = pass == 0 ? 0.2126f * c[ 0 ] + 0.7152f * c[ 1 ] + 0.0722f * c[ 2 ] : 1.0f;
+                myWeights[ x + (std::size_t) y * myW ] = std::max( 0.0f, l ) * st;
+                total += myWeights[ x + (std::size_t) y * myW ];
+              }
+          }
+      Real mean = total / ( (double) myW * myH );
+      myMarginal[ 0 ] = 0.0f;
+      double rows = 0.0;
+      for ( int y = 0; y < myH; ++y )
+        {
+          std::size_t row = (std::size_t) y * ( myW + 1 );
+          double sum = 0.0;
+          myConditional[ row ] = 0.0f;
+          for ( int x = 0; x < myW; ++x )
+            {
+              sum += myWeights[ x + (std::size_t) y * myW ];
+              myConditional[ row + x + 1 ] = sum;
+            }
+          for ( int x = 1; x <= myW; ++x )
+            myConditional[ row + x ] = sum > 0.0 ? myConditional[ row + x ] / sum
+                                                 : (Real) x / myW;
+          rows += sum;
+          myMarginal[ y + 1 ] = rows / total;
+        }
+      myMarginal[ myH ] = 1.0f;
+      for ( Real& w : myWeights ) w /= mean;
+    }
+
+    /// @return the index k in [0,n) of the interval [cdf[first+k],
+    /// cdf[first+k+1]) containing \a u.
+    static int find( const std::vector< Real >& cdf, std::size_t first, int n, Real u )
+    {
+      auto begin = cdf.begin() + first;
+      int  k     = (int) ( std::upper_bound( begin, begin + n + 1, u ) - begin ) - 1;
+      return std::max( 0, std::min( n - 1, k ) );
+    }
+
+    /// @return the density (per solid angle) of the directions of texel
+    /// (i,j), where the sine of the latitude is \a st.
+    Real density( int i, int j, Real st ) const
+    {
+      if ( st <= 0.0f ) return 0.0f;
+      // The density per unit of (u,v) in [0,1]^2 is the normalized
+      // weight, and d(omega) = 2 pi^2 sin(theta) du dv.
+      return myWeights[ i + (std::size_t) j * myW ] / ( 2.0 * M_PI * M_PI * st );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _ENVIRONMENT_MAP_H_
@@ -0,0 +1,124 @@
+/**
+@file Fresnel.h
+
+Refraction and Fresnel kernels: the refracted direction (Snell's law)
+and Schlick's approximation of the reflectance of a dielectric, for one
+ray or for a batch of rays stored as a structure of arrays.
+*/
+#pragma once
+#ifndef _FRESNEL_H_
+#define _FRESNEL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "PointVector.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Refracts the unit direction \a v through a surface of unit normal
+  /// \a N (pointing to the side v comes from), with relative index \a r
+  /// = n1/n2. Total internal reflection is tested first.
+  ///
+  /// @param t (returned) the unit refracted direction.
+  /// @param cos_t (returned) the cosine of the refraction angle.
+  /// @return 'false' in case of total internal reflection (t and cos_t
+  /// are then unchanged).
+  inline bool refract( const Vector3& v, const Vector3& N, Real r,
+                       Vector3& t, Real& cos_t )
+  {
+    Real cos_i = -N.dot( v );
+    Real k     = 1.0f - r * r * ( 1.0f - cos_i * cos_i );
+    if ( k < 0.0f ) return false;
+    cos_t = std::sqrt( k );
+    t     = r * v + ( r * cos_i - cos_t ) * N;
+    return true;
+  }
+
+  /// @return Schlick's approximation of the fraction of light reflected
+  /// at the interface of relative index \a r = n1/n2, for the cosines \a
+  /// cos_i and \a cos_t of the incidence and refraction angles.
+  inline Real schlick( Real r, Real cos_i, Real cos_t )
+  {
+    Real r0 = ( r - 1.0f ) / ( r + 1.0f );
+    r0 *= r0;
+    // The larger angle is on the side of the lower index.
+    Real c  = 1.0f - ( r > 1.0f ? cos_t : cos_i );
+    Real c2 = c * c;
+    return r0 + ( 1.0f - r0 ) * c2 * c2 * c;
+  }
+
+  /**
+  A batch of refractions in structure-of-arrays form. compute() has no
+  branch, so that the compiler vectorises it (with -fno-math-errno): a
+  total internal reflection gives a null direction and a reflectance
+  of 1.
+  */
+  struct RefractionBatch {
+    /// The unit incident directions.
+    std::vector< Real > vx, vy, vz;
+    /// The unit normals, pointing outside the objects.
+    std::vector< Real > nx, ny, nz;
+    /// The relative indices n1/n2 of rays entering the objects (see
+    /// Material::entering_ratio).
+    std::vector< Real > ratio;
+    /// The unit refracted directions (computed).
+    std::vector< Real > tx, ty, tz;
+    /// The Schlick reflectances (computed).
+    std::vector< Real > reflectance;
+
+    /// @return the number of rays.
+    std::size_t size() const { return vx.size(); }
+
+    /// Sets the number of rays.
+    void resize( std::size_t n )
+    {
+      for ( std::vector< Real >* a : { &vx, &vy, &vz, &nx, &ny, &nz, &ratio,
+                                       &tx, &ty, &tz, &reflectance } )
+        a->resize( n );
+    }
+
+    /// Computes the refracted directions and reflectances of all rays.
+    void compute()
+    {
+      refractBatch( size(), vx.data(), vy.data(), vz.data(), nx.data(), ny.data(), nz.data(),
+                    ratio.data(), tx.data(), ty.data(), tz.data(), reflectance.data() );
+    }
+
+    /// The kernel of compute(). The outputs are declared not to alias
+    /// anything, otherwise the loop is not vectorised.
+    static void refractBatch( std::size_t n,
+                              const Real* vx, const Real* vy, const Real* vz,
+                              const Real* nx, const Real* ny, const Real* nz,
+                              const Real* ratio,
+                              Real* __restrict tx, Real* __restrict ty, Real* __restrict tz,
+                              Real* __restrict reflectance )
+    {
+      for ( std::size_t i = 0; i < n; ++i )
+        {
+          Real d     = vx[ i ] * nx[ i ] + vy[ i ] * ny[ i ] + vz[ i ] * nz[ i ];
+          // Leaving the object: the normal and the ratio are flipped.
+          Real s     = d > 0.0f ? -1.0f : 1.0f;
+          Real inv   = 1.0f / ratio[ i ];
+          Real r     = d > 0.0f ? inv : ratio[ i ];
+          Real cos_i = -s * d;
+          Real k     = 1.0f - r * r * ( 1.0f - cos_i * cos_i );
+          Real cos_t = std::sqrt( std::max( k, 0.0f ) );
+          Real a     = k < 0.0f ? 0.0f : r;
+          Real b     = k < 0.0f ? 0.0f : s * ( r * cos_i - cos_t );
+          tx[ i ] = a * vx[ i ] + b * nx[ i ];
+          ty[ i ] = a * vy[ i ] + b * ny[ i ];
+          tz[ i ] = a * vz[ i ] + b * nz[ i ];
+          Real r0 = ( r - 1.0f ) / ( r + 1.0f );
+          r0 *= r0;
+          Real c  = 1.0f - ( r > 1.0f ? cos_t : cos_i );
+          Real c2 = c * c;
+          reflectance[ i ] = k < 0.0f ? 1.0f : r0 + ( 1.0f - r0 ) * c2 * c2 * c;
+        }
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _FRESNEL_H_
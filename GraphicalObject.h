@@ -43,6 +43,11 @@ namespace rt {
     /// @return the material associated to this part of the object
     virtual Material getMaterial( Point3 p ) = 0;
 
+    /// @return the material at point \a p, its texture (if any) being
+    /// filtered over a footprint of width \a footprint (in scene units)
+    /// around \a p. By default, the footprint is ignored.
+    virtual Material getMaterial( Point3 p, Real /* footprint */ ) { return getMaterial( p ); }
+
     /// @param[in] ray the incoming ray
     /// @param[out] returns the point of intersection with the object
     /// (if any), or the closest point to it.
@@ -50,6 +55,52 @@ namespace rt {
     /// @return either a real < 0.0 if there is an intersection, or a
     /// kind of distance to the closest point of intersection.
     virtual Real rayIntersection( const Ray& ray, Point3& p ) = 0;
+
+    /// Intersects the ray with the object, keeping only the points at
+    /// parameter t in [t_min,t_max] along the ray (the direction is
+    /// unitary, so t is the distance to the origin). Searching the
+    /// closest hit then shrinks t_max, so that farther objects are
+    /// rejected early.
+    ///
+    /// If the ray leaves this object (ray.exclude), its hit at the
+    /// origin must be ignored.
+    ///
+    /// @param[out] t the parameter of the closest such point, if any
+    /// (unchanged otherwise).
+    /// @return 'true' iff there is one.
+    ///
+    /// The default implementation goes through rayIntersection, and
+    /// considers that a ray leaving the object cannot hit it again (as
+    /// for a plane); other objects must override it.
+    virtual bool intersect( const Ray& ray, Real t_min, Real t_max, Real& t )
+    {
+      Point3 p;
+      if ( ray.exclude == this || rayIntersection( ray, p ) > 0.0f ) return false;
+      Real s = ( p - ray.origin ).dot( ray.direction );
+      if ( s < t_min || s > t_max ) return false;
+      t = s;
+      return true;
+    }
+
+    /// Gives an axis-aligned box containing the object.
+    ///
+    /// @return 'false' if the object is unbounded (default), in which
+    /// case acceleration structures test it against every ray.
+    virtual bool boundingBox( Point3& /* low */, Point3& /* high */ )
+    {
+      return false;
+    }
+
+    /// Moves the object by the vector \a t (used by animations). Objects
+    /// that cannot move ignore it (default).
+    virtual void translate( const Vector3& /* t */ ) {}
+
+    /// @return a new copy of this object (see Scene::snapshot).
+    virtual GraphicalObject* clone() const = 0;
+
+    /// The index of the object in the objects of its scene, set when it
+    /// is added (-1 before), e.g. for the object id render pass.
+    int sceneIndex = -1;
                     
 
   };
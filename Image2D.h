@@ -1,28 +1,46 @@
 // file Image2D.hpp
 #ifndef _IMAGE2D_HPP_
 #define _IMAGE2D_HPP_
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include "ImageLayout.h"
 
 namespace rt {
 
-/// Classe générique pour représenter des images 2D.
-template <typename TValue>
+/// Classe générique pour représenter des images 2D. Les pixels sont
+/// rangés dans un conteneur TContainer (un std::vector par défaut, ou
+/// par exemple un MappedStorage pour une image projetée en mémoire
+/// depuis un fichier, cf. MappedImage.h), selon la disposition TLayout
+/// (ligne par ligne par défaut, ou par tuiles, cf. ImageLayout.h).
+///
+/// Les itérateurs (begin, end, start) parcourent les pixels ligne par
+/// ligne, quelle que soit la disposition. Les itérateurs de stockage
+/// (storageBegin, storageEnd) parcourent le conteneur dans son ordre;
+/// avec une disposition par tuiles, cet ordre n'est pas celui des lignes
+/// et comprend les pixels de remplissage des tuiles du bord.
+template <typename TValue, typename TContainer = std::vector<TValue>,
+          typename TLayout = RowMajorLayout>
 class Image2D {
 public:
-  typedef Image2D<TValue>    Self;      // le type de *this
+  typedef Image2D<TValue, TContainer, TLayout> Self; // le type de *this
+  typedef TLayout            Layout;    // la disposition des pixels dans le conteneur
   typedef TValue             Value;     // le type pour la valeur des pixels
-  typedef std::vector<Value> Container; // le type pour stocker les valeurs des pixels de l'image.
+  typedef TContainer         Container; // le type pour stocker les valeurs des pixels de l'image.
   typedef typename Container::iterator ContainerIterator;
   typedef typename Container::const_iterator ContainerConstIterator;
-  /// Un itérateur (non-constant) simple sur l'image.
-  struct Iterator : public ContainerIterator {
-    Iterator( const ContainerIterator & other ) 
+  /// Un itérateur (non-constant) simple sur le conteneur de l'image.
+  struct StorageIterator : public ContainerIterator {
+    StorageIterator( const ContainerIterator & other ) 
       : ContainerIterator( other )
     {}
-    Iterator( Self & image, int x, int y ) 
+    StorageIterator( Self & image, int x, int y ) 
       : ContainerIterator( image.m_data.begin() + image.index( x, y ) )
     {}
-    Iterator& operator=( const ContainerIterator & other ) 
+    StorageIterator& operator=( const ContainerIterator & other ) 
     {
       ContainerIterator::operator=( other );
       return *this;
@@ -35,14 +53,14 @@ public:
       
   };
 
-  struct ConstIterator : public ContainerConstIterator {
-    ConstIterator( const ContainerConstIterator & other ) 
+  struct StorageConstIterator : public ContainerConstIterator {
+    StorageConstIterator( const ContainerConstIterator & other ) 
       : ContainerConstIterator( other )
     {}
-    ConstIterator( const Self & image, int x, int y ) 
+    StorageConstIterator( const Self & image, int x, int y ) 
       : ContainerConstIterator( image.m_data.begin() + image.index( x, y ) )
     {}
-    ConstIterator& operator=( const ContainerConstIterator & other ) 
+    StorageConstIterator& operator=( const ContainerConstIterator & other ) 
     {
       ContainerConstIterator::operator=( other );
       return *this;
@@ -55,39 +73,83 @@ public:
       
   };
 
+  /// Un itérateur ligne par ligne sur une image dont les pixels sont
+  /// rangés autrement (TImage est Self ou const Self).
+  template <typename TImage, typename TReference>
+  struct LineIterator {
+    typedef std::forward_iterator_tag                 iterator_category;
+    typedef TValue                                    value_type;
+    typedef std::ptrdiff_t                            difference_type;
+    typedef typename std::remove_reference<TReference>::type* pointer;
+    typedef TReference                                reference;
+
+    LineIterator( TImage & image, int x, int y )
+      : m_image( &image ), m_x( x ), m_y( y )
+    {}
+    TReference operator*() const
+    { return m_image->m_data[ m_image->index( m_x, m_y ) ]; }
+    pointer operator->() const { return &**this; }
+    LineIterator& operator++()
+    {
+      if ( ++m_x == m_image->w() ) { m_x = 0; ++m_y; }
+      return *this;
+    }
+    LineIterator operator++( int ) { LineIterator tmp = *this; ++*this; return tmp; }
+    bool operator==( const LineIterator & other ) const
+    { return m_x == other.m_x && m_y == other.m_y; }
+    bool operator!=( const LineIterator & other ) const
+    { return ! ( *this == other ); }
+
+  private:
+    TImage* m_image;
+    int m_x, m_y;
+  };
+
+  /// Un itérateur (non-constant) simple sur l'image, ligne par ligne:
+  /// celui du conteneur si les pixels y sont rangés ainsi.
+  typedef typename std::conditional< Layout::ROW_MAJOR, StorageIterator,
+                                     LineIterator< Self, Value& > >::type Iterator;
+  /// Un itérateur constant simple sur l'image, ligne par ligne.
+  typedef typename std::conditional< Layout::ROW_MAJOR, StorageConstIterator,
+                                     LineIterator< const Self, const Value& > >::type ConstIterator;
+
   template <typename TAccessor> 
-  struct GenericConstIterator : public Container::const_iterator {
+  struct GenericConstIterator : public ConstIterator {
     typedef TAccessor Accessor;
     typedef typename Accessor::Argument  ImageValue; // Color ou unsigned char
     typedef typename Accessor::Value     Value;      // unsigned char (pour ColorGreenAccessor)
     typedef typename Accessor::Reference Reference;  // ColorGreenReference (pour ColorGreenAccessor)
     
-    GenericConstIterator( const Image2D<ImageValue>& image, int x, int y )
-      : Container::const_iterator( image.m_data.begin() + image.index( x, y ) ) {}
+    GenericConstIterator( const Self& image, int x, int y )
+      : ConstIterator( image, x, y ) {}
+    GenericConstIterator( const ConstIterator& other )
+      : ConstIterator( other ) {}
     
     // Accès en lecture (rvalue)
     Value operator*() const
-    { return Accessor::access( Container::const_iterator::operator*() ); }
+    { return Accessor::access( ConstIterator::operator*() ); }
     
   };
 
   template <typename TAccessor> 
-  struct GenericIterator : public Container::iterator {
+  struct GenericIterator : public Iterator {
     typedef TAccessor Accessor;
     typedef typename Accessor::Argument  ImageValue; // Color ou unsigned char
     typedef typename Accessor::Value     Value;      // unsigned char (pour ColorGreenAccessor)
     typedef typename Accessor::Reference Reference;  // ColorGreenReference (pour ColorGreenAccessor)
     
-    GenericIterator( Image2D<ImageValue>& image, int x, int y )
-      : Container::iterator( image.m_data.begin() + image.index( x, y ) ) {}
+    GenericIterator( Self& image, int x, int y )
+      : Iterator( image, x, y ) {}
+    GenericIterator( const Iterator& other )
+      : Iterator( other ) {}
     
     // Accès en lecture (rvalue)
     Value operator*() const
-    { return Accessor::access( Container::iterator::operator*() ); }
+    { return Accessor::access( Iterator::operator*() ); }
 
     // Accès en lecture (rvalue)
     Reference operator*()
-    { return Accessor::access( Container::iterator::operator*() ); }
+    { return Accessor::access( Iterator::operator*() ); }
     
   };
 
@@ -96,6 +158,9 @@ public:
   // Constructeur avec taille w x h. Remplit tout avec la valeur g
   // (par défaut celle donnée par le constructeur par défaut).
   Image2D( int w, int h, Value g = Value() );
+  // Constructeur avec taille w x h, dont les w*h pixels sont déjà
+  // stockés dans \a data.
+  Image2D( int w, int h, Container&& data );
   
   // Remplit l'image avec la valeur \a g.
   void fill( Value g );
@@ -107,11 +172,28 @@ public:
 
   /// @return un itérateur pointant sur le début de l'image
   Iterator begin() { return start( 0, 0 ); }
-  /// @return un itérateur pointant après la fin de l'image
+  /// @return un itérateur pointant après la fin de l'image (le pixel
+  /// (0,h()), qui suit la dernière ligne).
   Iterator end()   { return start( 0, h() ); }
   /// @return un itérateur pointant sur le pixel (x,y).
   Iterator start( int x, int y ) { return Iterator( *this, x, y ); }
 
+  /// @return un itérateur constant pointant sur le début de l'image
+  ConstIterator begin() const { return start( 0, 0 ); }
+  /// @return un itérateur constant pointant après la fin de l'image
+  ConstIterator end() const   { return start( 0, h() ); }
+  /// @return un itérateur constant pointant sur le pixel (x,y).
+  ConstIterator start( int x, int y ) const { return ConstIterator( *this, x, y ); }
+
+  /// @return un itérateur sur le premier pixel rangé dans le conteneur.
+  StorageIterator storageBegin() { return StorageIterator( m_data.begin() ); }
+  /// @return un itérateur après le dernier pixel rangé (remplissage compris).
+  StorageIterator storageEnd()   { return StorageIterator( m_data.end() ); }
+  /// @return un itérateur constant sur le premier pixel rangé.
+  StorageConstIterator storageBegin() const { return StorageConstIterator( m_data.begin() ); }
+  /// @return un itérateur constant après le dernier pixel rangé.
+  StorageConstIterator storageEnd() const   { return StorageConstIterator( m_data.end() ); }
+
   template <typename Accessor>
   GenericConstIterator< Accessor > start( int x = 0, int y = 0 ) const
   { return GenericConstIterator< Accessor >( *this, x, y ); }
@@ -143,62 +225,97 @@ public:
   /// Accesseur read-write à la valeur d'un pixel.
   /// @return une référence à la valeur du pixel(i,j)
   Value& at( int i, int j );
+
+  /// @return le conteneur des pixels (par exemple pour le synchroniser
+  /// avec son fichier).
+  Container& container() { return m_data; }
+
+  /// @return une copie de l'image rangée ligne par ligne (par exemple
+  /// pour l'écrire), copiée par morceaux contigus de chaque ligne (voir
+  /// forEachRun : la ligne entière, ses morceaux dans chaque tuile, ou
+  /// pixel par pixel avec MortonLayout).
+  Image2D<Value> toRowMajor() const;
   
 private:
   Container m_data; // mes données; évitera de faire les allocations dynamiques
   int m_width; // ma largeur
   int m_height; // ma hauteur
+  Layout m_layout; // ma disposition des pixels
   
   /// @return l'index du pixel (x,y) dans le tableau \red m_data.
-  int index( int i, int j ) const;
+  std::size_t index( int i, int j ) const;
 };
 
-template <typename TValue>
-Image2D<TValue>::Image2D()
+template <typename TValue, typename TContainer, typename TLayout>
+Image2D<TValue, TContainer, TLayout>::Image2D()
   : m_data(), m_width( 0 ), m_height( 0 )
 {}
 
-template <typename TValue>
-Image2D<TValue>::Image2D( int w, int h, Value g )
-  : m_data( w*h, g ), m_width( w ), m_height( h )
-{}
+template <typename TValue, typename TContainer, typename TLayout>
+Image2D<TValue, TContainer, TLayout>::Image2D( int w, int h, Value g )
+  : m_width( w ), m_height( h )
+{
+  m_layout.resize( w, h );
+  m_data = Container( m_layout.size(), g );
+}
 
-template <typename TValue>
+template <typename TValue, typename TContainer, typename TLayout>
+Image2D<TValue, TContainer, TLayout>::Image2D( int w, int h, Container&& data )
+  : m_data( std::move( data ) ), m_width( w ), m_height( h )
+{
+  m_layout.resize( w, h );
+}
+
+template <typename TValue, typename TContainer, typename TLayout>
 void
-Image2D<TValue>::fill( Value g )
+Image2D<TValue, TContainer, TLayout>::fill( Value g )
 {
-  m_data.fill( g );
+  std::fill( m_data.begin(), m_data.end(), g );
 }
 
-template <typename TValue>
+template <typename TValue, typename TContainer, typename TLayout>
 int
-Image2D<TValue>::w() const
+Image2D<TValue, TContainer, TLayout>::w() const
 { return m_width; }
 
-template <typename TValue>
+template <typename TValue, typename TContainer, typename TLayout>
 int
-Image2D<TValue>::h() const
+Image2D<TValue, TContainer, TLayout>::h() const
 { return m_height; }
 
-template <typename TValue>
-typename Image2D<TValue>::Value
-Image2D<TValue>::at( int i, int j ) const
+template <typename TValue, typename TContainer, typename TLayout>
+typename Image2D<TValue, TContainer, TLayout>::Value
+Image2D<TValue, TContainer, TLayout>::at( int i, int j ) const
 {
   return m_data[ index( i, j ) ];
 }
 
-template <typename TValue>
-typename Image2D<TValue>::Value&
-Image2D<TValue>::at( int i, int j )
+template <typename TValue, typename TContainer, typename TLayout>
+typename Image2D<TValue, TContainer, TLayout>::Value&
+Image2D<TValue, TContainer, TLayout>::at( int i, int j )
 {
   return m_data[ index( i, j ) ];
 }
 
-template <typename TValue>
-int
-Image2D<TValue>::index( int i, int j ) const
+template <typename TValue, typename TContainer, typename TLayout>
+Image2D<TValue>
+Image2D<TValue, TContainer, TLayout>::toRowMajor() const
+{
+  Image2D<Value> result( w(), h() );
+  for ( int j = 0; j < h(); ++j )
+    m_layout.forEachRun( j, [&] ( int i, int n ) {
+        if ( i >= w() ) return;
+        n = std::min( n, w() - i );
+        std::copy_n( m_data.begin() + index( i, j ), n, result.start( i, j ) );
+      } );
+  return result;
+}
+
+template <typename TValue, typename TContainer, typename TLayout>
+std::size_t
+Image2D<TValue, TContainer, TLayout>::index( int i, int j ) const
 {
-  return i + j *w();
+  return m_layout.index( i, j );
 }
 
 } // namespace rt
@@ -0,0 +1,149 @@
+#ifndef _IMAGE2DREADER_HPP_
+#define _IMAGE2DREADER_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include "Color.h"
+#include "Image2D.h"
+
+namespace rt {
+
+/// Reads images written by Image2DWriter, or by other programs.
+template <typename TValue>
+class Image2DReader {
+public:
+  typedef TValue Value;
+  typedef Image2D<Value> Image;
+
+  static bool read( Image & img, std::istream & input );
+};
+
+template <typename TValue>
+bool
+Image2DReader<TValue>::read( Image & img, std::istream & input )
+{
+  return false;
+}
+
+/// Specialization for vector images, e.g. high dynamic range colors
+/// (environment maps): reads color PPM (P3, P6, values mapped to [0,1])
+/// and PFM images (PF, or Pf whose gray level is copied to the three
+/// channels). Values are not clamped.
+template <>
+class Image2DReader<Vector3> {
+public:
+  typedef Vector3 Value;
+  typedef Image2D<Value> Image;
+
+  static bool read( Image & img, std::istream & input );
+};
+
+/// Specialization for color images: as for vector images, values being
+/// clamped to [0,1].
+template <>
+class Image2DReader<Color> {
+public:
+  typedef Color Value;
+  typedef Image2D<Value> Image;
+
+  static bool read( Image & img, std::istream & input );
+};
+
+/// Reads the next number of a PNM header, skipping '#' comments.
+inline bool
+readPNMNumber( std::istream & input, double & value )
+{
+  input >> std::ws;
+  while ( input.peek() == '#' )
+    {
+      std::string comment;
+      std::getline( input, comment );
+      input >> std::ws;
+    }
+  return static_cast<bool>( input >> value );
+}
+
+inline bool
+Image2DReader<Vector3>::read( Image & img, std::istream & input )
+{
+  std::string magic;
+  double w, h, max_or_scale;
+  input >> magic;
+  if ( ! readPNMNumber( input, w ) || ! readPNMNumber( input, h )
+       || ! readPNMNumber( input, max_or_scale ) || w <= 0 || h <= 0 )
+    return false;
+  input.get(); // the single whitespace before the data
+  img = Image( (int) w, (int) h );
+  if ( magic == "PF" || magic == "Pf" )
+    {
+      // PFM rows go from bottom to top; a negative scale means
+      // little-endian floats.
+      const std::uint16_t one = 1;
+      unsigned char first;
+      std::memcpy( &first, &one, 1 );
+      bool swap = ( max_or_scale < 0.0 ) != ( first == 1 );
+      int  n    = magic == "PF" ? 3 : 1;
+      for ( int y = img.h() - 1; y >= 0; --y )
+        for ( int x = 0; x < img.w(); ++x )
+          {
+            float v[ 3 ];
+            input.read( reinterpret_cast<char*>( v ), n * sizeof( float ) );
+            if ( swap )
+              for ( int c = 0; c < n; ++c )
+                {
+                  char* b = reinterpret_cast<char*>( v + c );
+                  std::swap( b[ 0 ], b[ 3 ] );
+                  std::swap( b[ 1 ], b[ 2 ] );
+                }
+            img.at( x, y ) = n == 3 ? Vector3( v[ 0 ], v[ 1 ], v[ 2 ] )
+                                    : Vector3( v[ 0 ], v[ 0 ], v[ 0 ] );
+          }
+    }
+  else if ( magic == "P3" || magic == "P6" )
+    {
+      Real k = 1.0f / (Real) max_or_scale;
+      for ( int y = 0; y < img.h(); ++y )
+        for ( int x = 0; x < img.w(); ++x )
+          {
+            Vector3 v;
+            for ( int c = 0; c < 3; ++c )
+              {
+                int value;
+                if ( magic == "P3" ) input >> value;
+                else if ( max_or_scale < 256 ) value = (unsigned char) input.get();
+                else
+                  {
+                    value = (unsigned char) input.get() << 8;
+                    value |= (unsigned char) input.get();
+                  }
+                v[ c ] = value * k;
+              }
+            img.at( x, y ) = v;
+          }
+    }
+  else
+    return false;
+  return ! input.fail();
+}
+
+inline bool
+Image2DReader<Color>::read( Image & img, std::istream & input )
+{
+  Image2D<Vector3> values;
+  if ( ! Image2DReader<Vector3>::read( values, input ) ) return false;
+  img = Image( values.w(), values.h() );
+  for ( int y = 0; y < img.h(); ++y )
+    for ( int x = 0; x < img.w(); ++x )
+      {
+        Vector3 v = values.at( x, y );
+        img.at( x, y ) = Color( v[ 0 ], v[ 1 ], v[ 2 ] );
+      }
+  return true;
+}
+
+} // namespace rt
+
+#endif // _IMAGE2DREADER_HPP_
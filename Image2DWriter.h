@@ -1,6 +1,8 @@
 #ifndef _IMAGE2DWRITER_HPP_
 #define _IMAGE2DWRITER_HPP_
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include "Color.h"
@@ -14,12 +16,12 @@ public:
   typedef TValue Value;
   typedef Image2D<Value> Image;
 
-  static bool write( Image & img, std::ostream & output, bool ascii );
+  static bool write( const Image & img, std::ostream & output, bool ascii );
 };
 
 template <typename TValue>
 bool
-Image2DWriter<TValue>::write( Image & img, std::ostream & output, bool ascii )
+Image2DWriter<TValue>::write( const Image & img, std::ostream & output, bool ascii )
 {
   return false;
 }
@@ -31,7 +33,14 @@ public:
   typedef unsigned char Value;
   typedef Image2D<Value> Image;
 
-  static bool write( Image & img, std::ostream & output, bool ascii );
+  static bool write( const Image & img, std::ostream & output, bool ascii );
+  /// Images with another container or layout are written row by row.
+  template <typename TContainer, typename TLayout>
+  static bool write( const Image2D<Value, TContainer, TLayout> & img, std::ostream & output, bool ascii )
+  {
+    Image row_major = img.toRowMajor();
+    return write( row_major, output, ascii );
+  }
 };
 
 /// Specialization for color images.
@@ -41,13 +50,66 @@ public:
   typedef Color Value;
   typedef Image2D<Value> Image;
 
-  static bool write( Image & img, std::ostream & output, bool ascii );
+  static bool write( const Image & img, std::ostream & output, bool ascii );
+  /// Images with another container or layout are written row by row.
+  template <typename TContainer, typename TLayout>
+  static bool write( const Image2D<Value, TContainer, TLayout> & img, std::ostream & output, bool ascii )
+  {
+    Image row_major = img.toRowMajor();
+    return write( row_major, output, ascii );
+  }
 };
 
+/// Specialization for float images, written as grayscale PFM ("Pf").
+/// PFM is binary only: \a ascii is ignored.
+template <>
+class Image2DWriter<Real> {
+public:
+  typedef Real Value;
+  typedef Image2D<Value> Image;
 
+  static bool write( const Image & img, std::ostream & output, bool ascii );
+  /// Images with another container or layout are written row by row.
+  template <typename TContainer, typename TLayout>
+  static bool write( const Image2D<Value, TContainer, TLayout> & img, std::ostream & output, bool ascii )
+  {
+    Image row_major = img.toRowMajor();
+    return write( row_major, output, ascii );
+  }
+};
 
-bool
-Image2DWriter<unsigned char>::write( Image & img, std::ostream & output, bool ascii )
+/// Specialization for vector images, written as color PFM ("PF"), e.g.
+/// for normals or unclamped colors. PFM is binary only: \a ascii is
+/// ignored.
+template <>
+class Image2DWriter<Vector3> {
+public:
+  typedef Vector3 Value;
+  typedef Image2D<Value> Image;
+
+  static bool write( const Image & img, std::ostream & output, bool ascii );
+  /// Images with another container or layout are written row by row.
+  template <typename TContainer, typename TLayout>
+  static bool write( const Image2D<Value, TContainer, TLayout> & img, std::ostream & output, bool ascii )
+  {
+    Image row_major = img.toRowMajor();
+    return write( row_major, output, ascii );
+  }
+};
+
+/// Writes the PFM header. The scale is negative for little-endian data,
+/// which is how the floats of this machine are written.
+inline void
+writePFMHeader( std::ostream & output, const char* magic, int w, int h )
+{
+  const std::uint16_t one = 1;
+  unsigned char first;
+  std::memcpy( &first, &one, 1 );
+  output << magic << "\n" << w << " " << h << "\n" << ( first == 1 ? "-1.0" : "1.0" ) << "\n";
+}
+
+inline bool
+Image2DWriter<unsigned char>::write( const Image & img, std::ostream & output, bool ascii )
 {
   typedef unsigned char GrayLevel;
   output << ( ascii ? "P2" : "P5" ) << std::endl;
@@ -56,20 +118,20 @@ Image2DWriter<unsigned char>::write( Image & img, std::ostream & output, bool as
   output << "255" << std::endl;
   if ( ascii ) 
     {
-      for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
+      for ( Image::ConstIterator it = img.begin(), itE = img.end(); it != itE; ++it )
 	output << (int) *it << " ";
     }
   else 
     {
-      for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
+      for ( Image::ConstIterator it = img.begin(), itE = img.end(); it != itE; ++it )
 	output << (GrayLevel) *it;
     }
   return true;
 }
 
 
-bool
-Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
+inline bool
+Image2DWriter<Color>::write( const Image & img, std::ostream & output, bool ascii )
 {
   output << ( ascii ? "P3" : "P6" ) << std::endl;
   output << "# Generated by You !" << std::endl;
@@ -77,7 +139,7 @@ Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
   output << "255" << std::endl;
   if ( ascii ) 
     {
-      for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
+      for ( Image::ConstIterator it = img.begin(), itE = img.end(); it != itE; ++it )
 	{ 
 	  Color c = *it;
 	  output << (int) (c.r()*255.0f) << " " << (int) (c.g()*255.0f) << " " << (int) (c.b()*255.0f) << " ";
@@ -85,7 +147,7 @@ Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
     }
   else 
     {
-      for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
+      for ( Image::ConstIterator it = img.begin(), itE = img.end(); it != itE; ++it )
 	{ 
 	  Color c = *it;
           unsigned char red = (unsigned char) (c.r()*255.0f);
@@ -97,6 +159,34 @@ Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
   return true;
 }
 
+inline bool
+Image2DWriter<Real>::write( const Image & img, std::ostream & output, bool )
+{
+  writePFMHeader( output, "Pf", img.w(), img.h() );
+  // PFM rows go from bottom to top.
+  for ( int y = img.h() - 1; y >= 0; --y )
+    for ( int x = 0; x < img.w(); ++x )
+      {
+        float v = img.at( x, y );
+        output.write( reinterpret_cast<const char*>( &v ), sizeof( float ) );
+      }
+  return output.good();
+}
+
+inline bool
+Image2DWriter<Vector3>::write( const Image & img, std::ostream & output, bool )
+{
+  writePFMHeader( output, "PF", img.w(), img.h() );
+  // PFM rows go from bottom to top.
+  for ( int y = img.h() - 1; y >= 0; --y )
+    for ( int x = 0; x < img.w(); ++x )
+      {
+        float v[ 3 ] = { img.at( x, y )[ 0 ], img.at( x, y )[ 1 ], img.at( x, y )[ 2 ] };
+        output.write( reinterpret_cast<const char*>( v ), sizeof( v ) );
+      }
+  return output.good();
+}
+
 } // namespace rt
 
 #endif // _IMAGE2DWRITER_HPP_
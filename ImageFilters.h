@@ -0,0 +1,495 @@
+/**
+@file ImageFilters.h
+*/
+#pragma once
+#ifndef _IMAGE_FILTERS_H_
+#define _IMAGE_FILTERS_H_
+
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "Parallel.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A stage of a post-processing chain. A stage produces the lines of its
+  output image on demand, pulling the lines it needs from its input
+  stage, so that a whole chain (e.g. blur, then bloom, then resize)
+  runs in one streaming pass: no intermediate image is allocated, each
+  stage only keeps the few input lines its kernel spans.
+
+  Lines are arrays of 3*width() floats (r,g,b interleaved). Kernels are
+  written as plain loops over these arrays so that the compiler
+  vectorizes them.
+
+  Lines must be requested in increasing order for the line caches to
+  be efficient (any order is correct). A stage is used by one thread:
+  runFilter() clones the chain for each thread and gives each of them a
+  strip of lines.
+  */
+  struct ImageFilter {
+    virtual ~ImageFilter() {}
+    int width()  const { return myWidth; }
+    int height() const { return myHeight; }
+    /// Writes line \a y of the output into \a out (3*width() floats).
+    virtual void line( int y, float* out ) = 0;
+    /// @return a new copy of this stage and of its inputs.
+    virtual ImageFilter* clone() const = 0;
+    /// @return 'true' iff the chain ending with this stage reads \a image.
+    virtual bool reads( const Image2D<Color>& image ) const = 0;
+
+  protected:
+    int myWidth = 0, myHeight = 0;
+  };
+
+  /// The first stage of a chain: the lines of an image.
+  struct ImageSource : public ImageFilter {
+    ImageSource( const Image2D<Color>& image ) : ptrImage( &image )
+    {
+      myWidth  = image.w();
+      myHeight = image.h();
+    }
+    void line( int y, float* out )
+    {
+      for ( int x = 0; x < myWidth; ++x )
+        {
+          Color c = ptrImage->at( x, y );
+          out[ 3 * x ] = c.r(); out[ 3 * x + 1 ] = c.g(); out[ 3 * x + 2 ] = c.b();
+        }
+    }
+    ImageFilter* clone() const { return new ImageSource( *this ); }
+    bool reads( const Image2D<Color>& image ) const { return ptrImage == &image; }
+
+  private:
+    const Image2D<Color>* ptrImage;
+  };
+
+  /// A stage with one input. Copies made by clone() own a copy of the
+  /// input chain.
+  struct FilterNode : public ImageFilter {
+    FilterNode( ImageFilter& input ) : ptrInput( &input ) {}
+    bool reads( const Image2D<Color>& image ) const { return ptrInput->reads( image ); }
+
+  protected:
+    ImageFilter* ptrInput;
+    std::shared_ptr< ImageFilter > myOwnedInput;
+
+    /// @return a copy of \a node using a copy of its input.
+    template <typename TNode>
+    static ImageFilter* cloneNode( const TNode& node )
+    {
+      TNode* copy = new TNode( node );
+      copy->myOwnedInput.reset( node.ptrInput->clone() );
+      copy->ptrInput = copy->myOwnedInput.get();
+      return copy;
+    }
+  };
+
+  /**
+  A stage whose output line y depends on the input lines y-r..y+r
+  (clamped to the image). Each input line is pulled and preprocessed
+  (see process()) once, and kept in a ring of 2r+1 lines.
+  */
+  struct WindowFilter : public FilterNode {
+    WindowFilter( ImageFilter& input, int radius, int line_size )
+      : FilterNode( input ), myRadius( radius ), myLineSize( line_size ),
+        myLines( 2 * radius + 1, std::vector< float >( line_size ) ),
+        myRows( 2 * radius + 1, -1 )
+    {
+      myWidth  = input.width();
+      myHeight = input.height();
+      myInput.resize( 3 * myWidth );
+    }
+
+  protected:
+    int myRadius;
+    /// The number of floats kept per input line.
+    int myLineSize;
+
+    /// Computes the kept line \a out (myLineSize floats) from the input
+    /// line \a in. By default it is kept as is.
+    virtual void process( const float* in, float* out )
+    {
+      std::copy( in, in + 3 * myWidth, out );
+    }
+
+    /// @return the processed input line y (clamped to the image).
+    const float* window( int y )
+    {
+      y = std::max( 0, std::min( myHeight - 1, y ) );
+      int slot = y % (int) myRows.size();
+      if ( myRows[ slot ] != y )
+        {
+          ptrInput->line( y, myInput.data() );
+          process( myInput.data(), myLines[ slot ].data() );
+          myRows[ slot ] = y;
+        }
+      return myLines[ slot ].data();
+    }
+
+    /// Convolves the line \a in (3*n floats, plus r pixels of margin
+    /// on each side) with the 2r+1 weights \a kernel into \a out.
+    static void convolveLine( const float* in, const std::vector< Real >& kernel, int n, float* out )
+    {
+      std::fill( out, out + 3 * n, 0.0f );
+      for ( std::size_t k = 0; k < kernel.size(); ++k )
+        {
+          const float  w = kernel[ k ];
+          const float* p = in + 3 * k;
+          for ( int i = 0; i < 3 * n; ++i ) out[ i ] += w * p[ i ];
+        }
+    }
+
+    /// Copies the line \a in (3*n floats) into \a padded, with its first
+    /// and last pixels repeated r times on each side.
+    static void padLine( const float* in, int n, int r, float* padded )
+    {
+      for ( int k = 0; k < r; ++k )
+        for ( int c = 0; c < 3; ++c )
+          {
+            padded[ 3 * k + c ] = in[ c ];
+            padded[ 3 * ( n + r + k ) + c ] = in[ 3 * ( n - 1 ) + c ];
+          }
+      std::copy( in, in + 3 * n, padded + 3 * r );
+    }
+
+    /// Sums the processed lines y-r..y+r, weighted by \a kernel, taking
+    /// \a n floats at \a offset in each of them.
+    void convolveColumn( int y, const std::vector< Real >& kernel, int offset, int n, float* out )
+    {
+      std::fill( out, out + n, 0.0f );
+      for ( int k = -myRadius; k <= myRadius; ++k )
+        {
+          const float  w = kernel[ k + myRadius ];
+          const float* p = window( y + k ) + offset;
+          for ( int i = 0; i < n; ++i ) out[ i ] += w * p[ i ];
+        }
+    }
+
+  private:
+    std::vector< std::vector< float > > myLines;
+    std::vector< int >                  myRows;
+    std::vector< float >                myInput;
+  };
+
+  /// @return the normalized weights of a Gaussian of deviation \a sigma,
+  /// truncated at 3 sigma.
+  inline std::vector< Real > gaussianKernel( Real sigma )
+  {
+    int r = std::max( 1, (int) ceil( 3.0f * sigma ) );
+    std::vector< Real > kernel( 2 * r + 1 );
+    Real sum = 0.0f;
+    for ( int k = -r; k <= r; ++k )
+      sum += kernel[ k + r ] = exp( -0.5f * k * k / ( sigma * sigma ) );
+    for ( Real& w : kernel ) w /= sum;
+    return kernel;
+  }
+
+  /// @return the weights of a box of radius \a r.
+  inline std::vector< Real > boxKernel( int r )
+  {
+    return std::vector< Real >( 2 * r + 1, 1.0f / ( 2 * r + 1 ) );
+  }
+
+  /// Separable convolution by a symmetric kernel of 2r+1 weights: each
+  /// input line is convolved horizontally when it enters the window,
+  /// then output lines are vertical combinations of the window.
+  struct SeparableFilter : public WindowFilter {
+    SeparableFilter( ImageFilter& input, const std::vector< Real >& kernel )
+      : WindowFilter( input, (int) kernel.size() / 2, 3 * input.width() ),
+        myKernel( kernel ), myPadded( 3 * ( input.width() + kernel.size() ) ) {}
+    void line( int y, float* out ) { convolveColumn( y, myKernel, 0, 3 * myWidth, out ); }
+    ImageFilter* clone() const { return cloneNode( *this ); }
+
+  protected:
+    std::vector< Real >  myKernel;
+    std::vector< float > myPadded;
+
+    void process( const float* in, float* out )
+    {
+      padLine( in, myWidth, myRadius, myPadded.data() );
+      convolveLine( myPadded.data(), myKernel, myWidth, out );
+    }
+  };
+
+  /// Gaussian blur of deviation sigma (in pixels).
+  struct GaussianBlur : public SeparableFilter {
+    GaussianBlur( ImageFilter& input, Real sigma )
+      : SeparableFilter( input, gaussianKernel( sigma ) ) {}
+    ImageFilter* clone() const { return cloneNode( *this ); }
+  };
+
+  /// Box blur of radius r (in pixels).
+  struct BoxBlur : public SeparableFilter {
+    BoxBlur( ImageFilter& input, int r )
+      : SeparableFilter( input, boxKernel( r ) ) {}
+    ImageFilter* clone() const { return cloneNode( *this ); }
+  };
+
+  /// Bloom: the parts of the image brighter than a threshold are blurred
+  /// and added back, so that highlights glow.
+  struct Bloom : public WindowFilter {
+    Bloom( ImageFilter& input, Real threshold, Real sigma, Real strength )
+      : WindowFilter( input, (int) gaussianKernel( sigma ).size() / 2, 6 * input.width() ),
+        myThreshold( threshold ), myStrength( strength ), myKernel( gaussianKernel( sigma ) ),
+        myBright( 3 * input.width() ), myPadded( 3 * ( input.width() + myKernel.size() ) ) {}
+    void line( int y, float* out )
+    {
+      int n = 3 * myWidth;
+      convolveColumn( y, myKernel, n, n, out );
+      const float* in = window( y );
+      for ( int i = 0; i < n; ++i ) out[ i ] = in[ i ] + myStrength * out[ i ];
+    }
+    ImageFilter* clone() const { return cloneNode( *this ); }
+
+  protected:
+    Real myThreshold, myStrength;
+    std::vector< Real >  myKernel;
+    std::vector< float > myBright, myPadded;
+
+    /// Keeps the input line, followed by its blurred bright part.
+    void process( const float* in, float* out )
+    {
+      int n = 3 * myWidth;
+      std::copy( in, in + n, out );
+      for ( int i = 0; i < n; ++i ) myBright[ i ] = std::max( 0.0f, in[ i ] - myThreshold );
+      padLine( myBright.data(), myWidth, myRadius, myPadded.data() );
+      convolveLine( myPadded.data(), myKernel, myWidth, out + n );
+    }
+  };
+
+  /// Edge-preserving denoising (bilateral filter): each pixel becomes the
+  /// average of its neighbours within radius r, weighted by their
+  /// distance (deviation sigma_s) and their color difference (deviation
+  /// sigma_r), so that edges are not blurred. Both weights are tabulated:
+  /// the spatial ones per tap, the range ones as a function of the
+  /// squared color difference, interpolated linearly.
+  struct BilateralDenoise : public WindowFilter {
+    BilateralDenoise( ImageFilter& input, int r, Real sigma_s, Real sigma_r )
+      : WindowFilter( input, r, 3 * input.width() ),
+        mySpatial( ( 2 * r + 1 ) * ( 2 * r + 1 ) ),
+        myRangeScale( RANGE_STEPS / RANGE_CUTOFF * 0.5f / ( sigma_r * sigma_r ) ),
+        myRange( RANGE_STEPS + 2, 0.0f ), myWindow( 2 * r + 1 )
+    {
+      for ( int j = -r; j <= r; ++j )
+        for ( int i = -r; i <= r; ++i )
+          mySpatial[ ( j + r ) * ( 2 * r + 1 ) + i + r ] =
+            exp( -0.5f * ( i * i + j * j ) / ( sigma_s * sigma_s ) );
+      for ( int k = 0; k <= RANGE_STEPS; ++k )
+        myRange[ k ] = exp( -RANGE_CUTOFF * k / RANGE_STEPS );
+    }
+    void line( int y, float* out )
+    {
+      int r = myRadius;
+      for ( int k = -r; k <= r; ++k ) myWindow[ k + r ] = window( y + k );
+      const float* const* rows   = myWindow.data();
+      const float*        range  = myRange.data();
+      const float*        center = rows[ r ];
+      for ( int x = 0; x < myWidth; ++x )
+        {
+          const float* c = center + 3 * x;
+          float sum[ 3 ] = { 0.0f, 0.0f, 0.0f };
+          float total    = 0.0f;
+          for ( int j = 0; j <= 2 * r; ++j )
+            for ( int i = std::max( 0, x - r ); i <= std::min( myWidth - 1, x + r ); ++i )
+              {
+                const float* p  = rows[ j ] + 3 * i;
+                float        d0 = p[ 0 ] - c[ 0 ], d1 = p[ 1 ] - c[ 1 ], d2 = p[ 2 ] - c[ 2 ];
+                float        t  = std::min( myRangeScale * ( d0 * d0 + d1 * d1 + d2 * d2 ),
+                                                (float) RANGE_STEPS );
+                int          k  = (int) t;
+                float        w  = mySpatial[ j * ( 2 * r + 1 ) + i - x + r ]
+                  * ( range[ k ] + ( t - k ) * ( range[ k + 1 ] - range[ k ] ) );
+                sum[ 0 ] += w * p[ 0 ]; sum[ 1 ] += w * p[ 1 ]; sum[ 2 ] += w * p[ 2 ];
+                total    += w;
+              }
+          for ( int k = 0; k < 3; ++k ) out[ 3 * x + k ] = sum[ k ] / total;
+        }
+    }
+    ImageFilter* clone() const { return cloneNode( *this ); }
+
+  private:
+    /// The range weight exp(-t) is tabulated for t in [0,RANGE_CUTOFF]
+    /// (beyond, it is below 1e-7 and taken as 0) in RANGE_STEPS steps.
+    static constexpr int  RANGE_STEPS  = 1024;
+    static constexpr Real RANGE_CUTOFF = 16.0f;
+    std::vector< Real > mySpatial;
+    /// The factor giving the position in myRange of a squared difference.
+    Real myRangeScale;
+    /// exp(-t) at the RANGE_STEPS + 1 steps, then 0.
+    std::vector< Real > myRange;
+    /// The input lines of the window of the current line.
+    std::vector< const float* > myWindow;
+  };
+
+  /**
+  Resampling to another size with a reconstruction filter, e.g. to
+  downsample a supersampled render (Mitchell or Gaussian filter) or to
+  make a thumbnail. When shrinking, the filter is widened by the scale
+  factor so that every input pixel contributes.
+  */
+  struct Resample : public FilterNode {
+    enum Kernel { Box, Tent, Gaussian, Mitchell };
+
+    Resample( ImageFilter& input, int width, int height, Kernel kernel = Mitchell )
+      : FilterNode( input ), myKernel( kernel )
+    {
+      myWidth  = width;
+      myHeight = height;
+      weights( input.width(), width, myX );
+      weights( input.height(), height, myY );
+      int span = 0;
+      for ( const Taps& t : myY ) span = std::max( span, (int) t.weights.size() );
+      myLines.assign( span + 1, std::vector< float >( 3 * width ) );
+      myRows.assign( span + 1, -1 );
+      myInput.resize( 3 * input.width() );
+    }
+
+    void line( int y, float* out )
+    {
+      const Taps& t = myY[ y ];
+      std::fill( out, out + 3 * myWidth, 0.0f );
+      for ( std::size_t k = 0; k < t.weights.size(); ++k )
+        {
+          const float  w = t.weights[ k ];
+          const float* p = resampledLine( t.first + (int) k );
+          for ( int i = 0; i < 3 * myWidth; ++i ) out[ i ] += w * p[ i ];
+        }
+    }
+    ImageFilter* clone() const { return cloneNode( *this ); }
+
+  private:
+    /// The input pixels first, first+1, ... contributing to an output
+    /// pixel, and their weights.
+    struct Taps {
+      int first;
+      std::vector< Real > weights;
+    };
+    Kernel myKernel;
+    std::vector< Taps > myX, myY;
+    std::vector< std::vector< float > > myLines;
+    std::vector< int >                  myRows;
+    std::vector< float >                myInput;
+
+    /// The filter, of support [-radius(), radius()].
+    Real radius() const
+    {
+      switch ( myKernel ) {
+      case Box:      return 0.5f;
+      case Tent:     return 1.0f;
+      case Gaussian: return 1.5f;
+      default:       return 2.0f;
+      }
+    }
+    Real filter( Real t ) const
+    {
+      t = std::fabs( t );
+      switch ( myKernel ) {
+      case Box:      return t <= 0.5f ? 1.0f : 0.0f;
+      case Tent:     return std::max( 0.0f, 1.0f - t );
+      case Gaussian: return exp( -2.0f * t * t );
+      default: // Mitchell-Netravali, B = C = 1/3
+        if ( t < 1.0f ) return ( 7.0f * t * t * t - 12.0f * t * t + 16.0f / 3.0f ) / 6.0f;
+        if ( t < 2.0f ) return ( -7.0f / 3.0f * t * t * t + 12.0f * t * t - 20.0f * t + 32.0f / 3.0f ) / 6.0f;
+        return 0.0f;
+      }
+    }
+
+    /// Computes the taps of the \a n output pixels of a line of \a m input pixels.
+    void weights( int m, int n, std::vector< Taps >& taps ) const
+    {
+      Real scale = (Real) m / n;
+      Real width = std::max( 1.0f, scale );
+      taps.resize( n );
+      for ( int o = 0; o < n; ++o )
+        {
+          Real center = ( o + 0.5f ) * scale - 0.5f;
+          int  lo = std::max( 0, (int) floor( center - radius() * width ) );
+          int  hi = std::min( m - 1, (int) ceil( center + radius() * width ) );
+          Real sum = 0.0f;
+          taps[ o ].first = lo;
+          taps[ o ].weights.clear();
+          for ( int i = lo; i <= hi; ++i )
+            {
+              Real w = filter( ( i - center ) / width );
+              taps[ o ].weights.push_back( w );
+              sum += w;
+            }
+          if ( sum == 0.0f ) // may happen for the box filter
+            {
+              taps[ o ].first = std::max( 0, std::min( m - 1, (int) floor( center + 0.5f ) ) );
+              taps[ o ].weights.assign( 1, 1.0f );
+            }
+          else
+            for ( Real& w : taps[ o ].weights ) w /= sum;
+        }
+    }
+
+    /// @return the input line y, resampled horizontally.
+    const float* resampledLine( int y )
+    {
+      int slot = y % (int) myRows.size();
+      if ( myRows[ slot ] != y )
+        {
+          ptrInput->line( y, myInput.data() );
+          float* out = myLines[ slot ].data();
+          for ( int x = 0; x < myWidth; ++x )
+            {
+              const Taps& t = myX[ x ];
+              float r = 0.0f, g = 0.0f, b = 0.0f;
+              const float* p = myInput.data() + 3 * t.first;
+              for ( std::size_t k = 0; k < t.weights.size(); ++k, p += 3 )
+                {
+                  r += t.weights[ k ] * p[ 0 ];
+                  g += t.weights[ k ] * p[ 1 ];
+                  b += t.weights[ k ] * p[ 2 ];
+                }
+              out[ 3 * x ] = r; out[ 3 * x + 1 ] = g; out[ 3 * x + 2 ] = b;
+            }
+          myRows[ slot ] = y;
+        }
+      return myLines[ slot ].data();
+    }
+  };
+
+  /// Runs the chain ending with \a filter into \a image, in one pass.
+  /// The lines are split into \a nb_threads strips (defaultThreadNumber()
+  /// if <= 0), each one computed by its own copy of the chain.
+  ///
+  /// \a image may be the source of the chain: the chain then runs into a
+  /// temporary image, which replaces \a image at the end, since strips
+  /// read lines that other strips would already have overwritten.
+  inline void runFilter( const ImageFilter& filter, Image2D<Color>& image, int nb_threads = 0 )
+  {
+    if ( filter.reads( image ) )
+      {
+        Image2D<Color> result;
+        runFilter( filter, result, nb_threads );
+        image = std::move( result );
+        return;
+      }
+    int w = filter.width();
+    int h = filter.height();
+    if ( image.w() != w || image.h() != h ) image = Image2D<Color>( w, h );
+    parallelFor( 0, h, nb_threads, [&] ( long begin, long end ) {
+        std::unique_ptr< ImageFilter > chain( filter.clone() );
+        std::vector< float > out( 3 * w );
+        for ( long y = begin; y < end; ++y )
+          {
+            chain->line( (int) y, out.data() );
+            for ( int x = 0; x < w; ++x )
+              image.at( x, y ) = Color( out[ 3 * x ], out[ 3 * x + 1 ], out[ 3 * x + 2 ] );
+          }
+      } );
+  }
+
+} // namespace rt
+
+#endif // #define _IMAGE_FILTERS_H_
@@ -0,0 +1,104 @@
+/**
+@file ImageLayout.h
+
+Layout policies of Image2D: where pixel (i,j) is stored in the
+container. A layout has a default constructor, resize( w, h ), size()
+(the number of stored values, padding included) and index( i, j ).
+*/
+#pragma once
+#ifndef _IMAGE_LAYOUT_H_
+#define _IMAGE_LAYOUT_H_
+
+#include <cstddef>
+
+namespace rt {
+
+  /// Pixels stored line by line (the usual layout of image files).
+  struct RowMajorLayout {
+    static constexpr bool ROW_MAJOR = true;
+
+    void resize( int w, int h ) { myWidth = w; myHeight = h; }
+    std::size_t size() const { return (std::size_t) myWidth * myHeight; }
+    std::size_t index( int i, int j ) const { return i + (std::size_t) j * myWidth; }
+    /// The first pixel and the number of pixels of the contiguous runs
+    /// of line j: here, the whole line.
+    template <typename TFunction>
+    void forEachRun( int j, TFunction f ) const { f( 0, myWidth ); }
+
+  private:
+    int myWidth = 0, myHeight = 0;
+  };
+
+  /// Pixels stored by square tiles of N x N pixels, tiles being stored
+  /// line by line, and pixels line by line within a tile. The image is
+  /// padded to a whole number of tiles. Neighbouring pixels then share
+  /// cache lines and pages in both directions.
+  template <int N = 16>
+  struct TiledLayout {
+    static constexpr bool ROW_MAJOR = false;
+
+    void resize( int w, int h )
+    {
+      myTilesX = ( w + N - 1 ) / N;
+      myTilesY = ( h + N - 1 ) / N;
+    }
+    std::size_t size() const { return (std::size_t) myTilesX * myTilesY * N * N; }
+    std::size_t index( int i, int j ) const
+    {
+      return ( (std::size_t) ( j / N ) * myTilesX + i / N ) * ( N * N ) + ( j % N ) * N + i % N;
+    }
+    /// The contiguous runs of line j are its pieces within each tile.
+    template <typename TFunction>
+    void forEachRun( int /* j */, TFunction f ) const
+    {
+      for ( int t = 0; t < myTilesX; ++t ) f( t * N, N );
+    }
+
+  private:
+    int myTilesX = 0, myTilesY = 0;
+  };
+
+  /// Pixels stored by square tiles of 2^K x 2^K pixels, tiles being
+  /// stored line by line, and pixels in Z-order (Morton order) within a
+  /// tile, so that any aligned square block of pixels is contiguous.
+  template <int K = 5>
+  struct MortonLayout {
+    static constexpr bool ROW_MAJOR = false;
+    static constexpr int  N = 1 << K;
+
+    void resize( int w, int h )
+    {
+      myTilesX = ( w + N - 1 ) / N;
+      myTilesY = ( h + N - 1 ) / N;
+    }
+    std::size_t size() const { return (std::size_t) myTilesX * myTilesY * N * N; }
+    std::size_t index( int i, int j ) const
+    {
+      return ( (std::size_t) ( j >> K ) * myTilesX + ( i >> K ) ) * ( N * N )
+        + ( spread( j & ( N - 1 ) ) << 1 ) + spread( i & ( N - 1 ) );
+    }
+    /// The pixels of a line are not contiguous (at most by pairs): they
+    /// are given one by one.
+    template <typename TFunction>
+    void forEachRun( int /* j */, TFunction f ) const
+    {
+      for ( int i = 0; i < myTilesX * N; ++i ) f( i, 1 );
+    }
+
+  private:
+    int myTilesX = 0, myTilesY = 0;
+
+    /// Inserts a 0 bit between the (at most 16) bits of x.
+    static std::size_t spread( unsigned int x )
+    {
+      x = ( x | ( x << 8 ) ) & 0x00ff00ffu;
+      x = ( x | ( x << 4 ) ) & 0x0f0f0f0fu;
+      x = ( x | ( x << 2 ) ) & 0x33333333u;
+      x = ( x | ( x << 1 ) ) & 0x55555555u;
+      return x;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _IMAGE_LAYOUT_H_
@@ -6,9 +6,12 @@
 #ifndef _LIGHT_H_
 #define _LIGHT_H_
 
+#include <limits>
 // In order to call opengl commands in all graphical objects
 #include "Viewer.h"
 #include "PointVector.h"
+#include "Color.h"
+#include "BakedLight.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -16,6 +19,9 @@ namespace rt {
   /// Lights are used to give lights in a scene.
   struct Light {
 
+    /// Incremented at each edit of this light (see Scene::lightChanged).
+    unsigned long version = 0;
+
     /// Default constructor. Nothing to do.
     Light() {}
 
@@ -42,6 +48,46 @@ namespace rt {
     /// p.
     virtual Color color( const Vector3& /* p */ ) const = 0;
 
+    /// @return the number of sample points of this light used for its
+    /// shadows: 1 (default) for a light reduced to a point, more for an
+    /// area light, which casts soft shadows.
+    virtual int nbSamples() const { return 1; }
+
+    /// Gives the normalized direction \a L from point \a p to the sample
+    /// \a k (0 <= k < nbSamples()) of this light, and its distance \a d
+    /// (infinite by default). The sample is jittered by (u,v) in
+    /// [0,1)^2 within its stratum.
+    virtual void sample( const Vector3& p, int /* k */, Real /* u */, Real /* v */,
+                         Vector3& L, Real& d ) const
+    {
+      L = direction( p );
+      d = std::numeric_limits< Real >::infinity();
+    }
+
+    /// Gives the sphere outside which the color of this light falls
+    /// below \a threshold (on every channel).
+    ///
+    /// @return 'false' if the light has no such bound, i.e. it may light
+    /// any point of the scene (default).
+    virtual bool boundingSphere( Real /* threshold */,
+                                 Point3& /* center */, Real& /* radius */ ) const
+    {
+      return false;
+    }
+
+    /// Takes a snapshot of this light into \a baked, for the renderer.
+    ///
+    /// @return 'false' if the light cannot be described by a BakedLight
+    /// (default), in which case the renderer calls its methods.
+    virtual bool bake( BakedLight& /* baked */ ) const
+    {
+      return false;
+    }
+
+    /// @return a new copy of this light, not bound to the viewer (see
+    /// Scene::snapshot).
+    virtual Light* clone() const = 0;
+
   };
 
 } // namespace rt
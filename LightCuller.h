@@ -0,0 +1,155 @@
+/**
+@file LightCuller.h
+*/
+#pragma once
+#ifndef _LIGHT_CULLER_H_
+#define _LIGHT_CULLER_H_
+
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "PointVector.h"
+#include "Light.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Precomputed per-region light lists. The lights that may light the
+  whole scene (at infinity, or without attenuation) are in every
+  list. The attenuated lights are only in the cells of a uniform grid
+  overlapping their sphere of influence, i.e. the sphere outside which
+  their color is below the culling threshold.
+
+  Typical use: build() at render start, then lightsAt() for each
+  shading point, and optionally select() to keep only a few lights
+  chosen by importance.
+  */
+  struct LightCuller {
+    /// The maximal number of cells along each axis.
+    static constexpr int MAXRES = 32;
+
+    /// Builds the light lists for the given lights, ignoring everything
+    /// whose color is below \a threshold.
+    void build( const std::vector< Light* >& lights, Real threshold )
+    {
+      myGlobal.clear();
+      myCells.clear();
+      myRes = 0;
+      std::vector< int >    bounded;
+      std::vector< Point3 > centers;
+      std::vector< Real >   radii;
+      for ( int i = 0; i < (int) lights.size(); ++i )
+        {
+          Point3 c;
+          Real   r;
+          if ( lights[ i ]->boundingSphere( threshold, c, r ) )
+            {
+              if ( r <= 0.0f ) continue; // never visible
+              bounded.push_back( i );
+              centers.push_back( c );
+              radii.push_back( r );
+            }
+          else myGlobal.push_back( i );
+        }
+      if ( bounded.empty() ) return;
+      myLow  = centers[ 0 ];
+      myHigh = centers[ 0 ];
+      for ( std::size_t k = 0; k < bounded.size(); ++k )
+        for ( int a = 0; a < 3; ++a )
+          {
+            myLow[ a ]  = std::min( myLow[ a ],  centers[ k ][ a ] - radii[ k ] );
+            myHigh[ a ] = std::max( myHigh[ a ], centers[ k ][ a ] + radii[ k ] );
+          }
+      myRes = std::max( 1, std::min( MAXRES, (int) ceil( 2.0 * cbrt( (double) bounded.size() ) ) ) );
+      for ( int a = 0; a < 3; ++a )
+        myCellSize[ a ] = std::max( ( myHigh[ a ] - myLow[ a ] ) / myRes, 1e-6f );
+      myCells.assign( myRes * myRes * myRes, myGlobal );
+      for ( std::size_t k = 0; k < bounded.size(); ++k )
+        {
+          int lo[ 3 ], hi[ 3 ];
+          for ( int a = 0; a < 3; ++a )
+            {
+              lo[ a ] = cell( a, centers[ k ][ a ] - radii[ k ] );
+              hi[ a ] = cell( a, centers[ k ][ a ] + radii[ k ] );
+            }
+          for ( int z = lo[ 2 ]; z <= hi[ 2 ]; ++z )
+            for ( int y = lo[ 1 ]; y <= hi[ 1 ]; ++y )
+              for ( int x = lo[ 0 ]; x <= hi[ 0 ]; ++x )
+                if ( overlaps( x, y, z, centers[ k ], radii[ k ] ) )
+                  myCells[ x + myRes * ( y + myRes * z ) ].push_back( bounded[ k ] );
+        }
+    }
+
+    /// @return the indices of the lights that may light point \a p.
+    const std::vector< int >& lightsAt( const Point3& p ) const
+    {
+      if ( myRes == 0 ) return myGlobal;
+      for ( int a = 0; a < 3; ++a )
+        if ( p[ a ] < myLow[ a ] || p[ a ] > myHigh[ a ] ) return myGlobal;
+      return myCells[ cell( 0, p[ 0 ] ) + myRes * ( cell( 1, p[ 1 ] ) + myRes * cell( 2, p[ 2 ] ) ) ];
+    }
+
+    /// Chooses \a k lights among \a candidates with probabilities
+    /// proportional to their estimated contributions \a estimates (with
+    /// replacement). Each chosen light is output in \a chosen with the
+    /// weight 1/(k*pdf) that keeps the sum of contributions unbiased.
+    template <typename TRandom>
+    static void select( const std::vector< int >& candidates,
+                        const std::vector< Real >& estimates, int k, TRandom& random,
+                        std::vector< std::pair< int, Real > >& chosen )
+    {
+      chosen.clear();
+      Real total = 0.0f;
+      for ( Real e : estimates ) total += e;
+      if ( total <= 0.0f ) return;
+      std::uniform_real_distribution< Real > uniform( 0.0f, total );
+      for ( int s = 0; s < k; ++s )
+        {
+          Real u = uniform( random );
+          std::size_t i = 0;
+          // Null estimates are skipped (u may be 0), and rounding may only
+          // end past the last positive estimate, which is then taken.
+          while ( i + 1 < estimates.size()
+                  && ( estimates[ i ] <= 0.0f || ( u -= estimates[ i ] ) > 0.0f ) ) ++i;
+          while ( estimates[ i ] <= 0.0f ) --i;
+          chosen.push_back( std::make_pair( candidates[ i ], total / ( k * estimates[ i ] ) ) );
+        }
+    }
+
+  private:
+    /// The lights that are in every list.
+    std::vector< int > myGlobal;
+    /// The light list of each cell (lights of myGlobal included).
+    std::vector< std::vector< int > > myCells;
+    /// The number of cells along each axis (0 when there is no grid).
+    int myRes = 0;
+    Point3 myLow, myHigh;
+    Vector3 myCellSize;
+
+    int cell( int a, Real x ) const
+    {
+      int i = (int) floor( ( x - myLow[ a ] ) / myCellSize[ a ] );
+      return std::max( 0, std::min( myRes - 1, i ) );
+    }
+
+    /// @return 'true' iff the cell (x,y,z) overlaps the sphere (c,r).
+    bool overlaps( int x, int y, int z, const Point3& c, Real r ) const
+    {
+      int  idx[ 3 ] = { x, y, z };
+      Real d2 = 0.0f;
+      for ( int a = 0; a < 3; ++a )
+        {
+          Real lo = myLow[ a ] + idx[ a ] * myCellSize[ a ];
+          Real hi = lo + myCellSize[ a ];
+          Real v  = std::max( lo, std::min( hi, c[ a ] ) ) - c[ a ];
+          d2 += v * v;
+        }
+      return d2 <= r * r;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _LIGHT_CULLER_H_
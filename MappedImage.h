@@ -0,0 +1,157 @@
+/**
+@file MappedImage.h
+
+POSIX only (mmap).
+*/
+#pragma once
+#ifndef _MAPPED_IMAGE_H_
+#define _MAPPED_IMAGE_H_
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Color.h"
+#include "Image2D.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A pixel stored as in a binary PPM (P6) file: three bytes.
+  struct PackedRGB {
+    unsigned char r, g, b;
+
+    PackedRGB() : r( 0 ), g( 0 ), b( 0 ) {}
+    /// Conversion from a color, as done by Image2DWriter<Color>.
+    PackedRGB( const Color& c )
+      : r( (unsigned char) ( c.r() * 255.0f ) ),
+        g( (unsigned char) ( c.g() * 255.0f ) ),
+        b( (unsigned char) ( c.b() * 255.0f ) ) {}
+  };
+  static_assert( sizeof( PackedRGB ) == 3, "PackedRGB must have the layout of a P6 pixel" );
+
+  /**
+  A fixed-size array of pixels living in memory-mapped pages, to be
+  used as the container of an Image2D. Either the pages are anonymous
+  (Image2D( w, h ) constructor), or they belong to a file created by
+  create(): the file holds a header followed by the raw pixels, and
+  writing a pixel writes the file. The OS pages the data in and out, so
+  images bigger than the RAM can be rendered, and "saving" is only
+  sync().
+  */
+  template <typename TValue>
+  struct MappedStorage {
+    typedef TValue        value_type;
+    typedef TValue*       iterator;
+    typedef const TValue* const_iterator;
+
+    MappedStorage() {}
+
+    /// Anonymous storage of \a n values \a v.
+    /// @throw std::bad_alloc if the pages cannot be mapped.
+    MappedStorage( std::size_t n, const TValue& v = TValue() )
+    {
+      if ( ! map( -1, 0, n ) ) throw std::bad_alloc();
+      for ( std::size_t i = 0; i < n; ++i ) myData[ i ] = v;
+    }
+
+    /// Creates (or truncates) the file \a path, made of \a header
+    /// followed by \a n values, and maps it.
+    /// @return an empty storage if the file could not be created.
+    static MappedStorage create( const std::string& path, const std::string& header, std::size_t n )
+    {
+      static_assert( alignof( TValue ) == 1, "values follow a header of any length" );
+      MappedStorage storage;
+      int fd = open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+      if ( fd < 0 ) return storage;
+      if ( ftruncate( fd, header.size() + n * sizeof( TValue ) ) == 0
+           && storage.map( fd, header.size(), n ) )
+        std::memcpy( storage.myBase, header.data(), header.size() );
+      close( fd ); // the mapping stays valid
+      return storage;
+    }
+
+    MappedStorage( MappedStorage&& other ) { swap( other ); }
+    MappedStorage& operator=( MappedStorage&& other ) { swap( other ); return *this; }
+    MappedStorage( const MappedStorage& ) = delete;
+    MappedStorage& operator=( const MappedStorage& ) = delete;
+    ~MappedStorage() { if ( myBase != 0 ) munmap( myBase, myLength ); }
+
+    /// Writes the modified pages to the file.
+    /// @return 'true' on success (always for anonymous storage).
+    bool sync() { return myBase == 0 || msync( myBase, myLength, MS_SYNC ) == 0; }
+
+    std::size_t size() const { return mySize; }
+    bool empty() const { return mySize == 0; }
+    TValue&       operator[]( std::size_t i )       { return myData[ i ]; }
+    const TValue& operator[]( std::size_t i ) const { return myData[ i ]; }
+    iterator       begin()       { return myData; }
+    iterator       end()         { return myData + mySize; }
+    const_iterator begin() const { return myData; }
+    const_iterator end()   const { return myData + mySize; }
+
+  private:
+    char*       myBase   = 0;
+    std::size_t myLength = 0;
+    TValue*     myData   = 0;
+    std::size_t mySize   = 0;
+
+    /// Maps \a offset bytes then \a n values of file \a fd (anonymous
+    /// memory if fd < 0).
+    bool map( int fd, std::size_t offset, std::size_t n )
+    {
+      std::size_t length = offset + n * sizeof( TValue );
+      if ( length == 0 ) return true;
+      void* base = fd < 0
+        ? mmap( 0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 )
+        : mmap( 0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+      if ( base == MAP_FAILED ) return false;
+      myBase   = static_cast< char* >( base );
+      myLength = length;
+      myData   = reinterpret_cast< TValue* >( myBase + offset );
+      mySize   = n;
+      return true;
+    }
+
+    void swap( MappedStorage& other )
+    {
+      std::swap( myBase, other.myBase );
+      std::swap( myLength, other.myLength );
+      std::swap( myData, other.myData );
+      std::swap( mySize, other.mySize );
+    }
+  };
+
+  /// An RGB8 image whose pixels are those of a PPM file.
+  typedef Image2D< PackedRGB, MappedStorage< PackedRGB > > MappedImage;
+
+  /// Mapped images are never reallocated by a render, which would
+  /// silently replace their file by anonymous memory: they must already
+  /// have the size \a w x \a h of the render.
+  /// @return 'true' iff they have it.
+  template <typename TValue, typename TLayout>
+  bool fitImage( Image2D< TValue, MappedStorage< TValue >, TLayout >& image, int w, int h )
+  {
+    return image.w() == w && image.h() == h;
+  }
+
+  /// Creates the binary PPM file \a path of size \a w x \a h, and
+  /// returns the image mapping its pixels. Rendering into it writes the
+  /// file; call image.container().sync() when done.
+  /// @return an empty image if the file could not be created.
+  inline MappedImage createMappedPPM( const std::string& path, int w, int h )
+  {
+    std::string header = "P6\n" + std::to_string( w ) + " " + std::to_string( h ) + "\n255\n";
+    MappedStorage< PackedRGB > storage =
+      MappedStorage< PackedRGB >::create( path, header, (std::size_t) w * h );
+    if ( storage.empty() ) return MappedImage();
+    return MappedImage( w, h, std::move( storage ) );
+  }
+
+} // namespace rt
+
+#endif // #define _MAPPED_IMAGE_H_
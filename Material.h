@@ -13,6 +13,8 @@
 /// Namespace RayTracer
 namespace rt {
 
+  struct Texture;
+
   /// This structure stores the material associated to a graphical object.
   /// object should have.
   struct Material {
@@ -39,6 +41,22 @@ namespace rt {
     Real in_refractive_index;
     /// Outside refractive index (1.0f if object is in the air otherwise >= 1.0f)
     Real out_refractive_index;
+    /// The relative indices n1/n2 of a ray entering (out/in) and leaving
+    /// (in/out) the object, precomputed by setRefractiveIndices().
+    Real entering_ratio, leaving_ratio;
+    /// The texture modulating the diffuse color, or 0 (see Texture.h).
+    /// The texture is not owned by the material, and is ignored if it
+    /// is not valid.
+    Texture* texture = nullptr;
+
+    /// Sets the inside and outside refractive indices (and their ratios).
+    void setRefractiveIndices( Real in_ridx, Real out_ridx )
+    {
+      in_refractive_index  = in_ridx;
+      out_refractive_index = out_ridx;
+      entering_ratio       = out_ridx / in_ridx;
+      leaving_ratio        = in_ridx / out_ridx;
+    }
 
     /// Mixes two material (t=0 gives m1, t=1 gives m2, t=0.5 gives their average)
     static Material mix( Real t, const Material& m1, const Material& m2 )
@@ -52,8 +70,9 @@ namespace rt {
       m.coef_diffusion = s * m1.coef_diffusion + t * m2.coef_diffusion;
       m.coef_reflexion = s * m1.coef_reflexion + t * m2.coef_reflexion;
       m.coef_refraction = s * m1.coef_refraction + t * m2.coef_refraction;
-      m.in_refractive_index = s * m1.in_refractive_index + t * m2.in_refractive_index;
-      m.out_refractive_index = s * m1.out_refractive_index + t * m2.out_refractive_index;
+      m.setRefractiveIndices( s * m1.in_refractive_index + t * m2.in_refractive_index,
+                              s * m1.out_refractive_index + t * m2.out_refractive_index );
+      m.texture = t < 0.5f ? m1.texture : m2.texture;
       return m;
     }
     
@@ -65,9 +84,10 @@ namespace rt {
               Real cdiff = 1.0f, Real crefl = 0.0f, Real crefr = 0.0f,
               Real in_ridx = 1.0f, Real out_ridx = 1.0f )
       : ambient( amb ), diffuse( diff ), specular( spec ), shinyness( shiny ),
-        coef_diffusion( cdiff ), coef_reflexion( crefl ), coef_refraction( crefr ),
-        in_refractive_index( in_ridx ), out_refractive_index( out_ridx )
-    {}
+        coef_diffusion( cdiff ), coef_reflexion( crefl ), coef_refraction( crefr )
+    {
+      setRefractiveIndices( in_ridx, out_ridx );
+    }
     
     static Material whitePlastic() 
     {
@@ -79,8 +99,7 @@ namespace rt {
       m.coef_diffusion  = 0.9f;
       m.coef_reflexion  = 0.1f;
       m.coef_refraction = 0.0f;
-      m.in_refractive_index  = 1.0f;
-      m.out_refractive_index = 1.0f;
+      m.setRefractiveIndices( 1.0f, 1.0f );
       return m;
     }
     static Material redPlastic() 
@@ -93,8 +112,7 @@ namespace rt {
       m.coef_diffusion  = 1.0f;
       m.coef_reflexion  = 0.05f;
       m.coef_refraction = 0.0f;
-      m.in_refractive_index  = 1.0f;
-      m.out_refractive_index = 1.0f;
+      m.setRefractiveIndices( 1.0f, 1.0f );
       return m;
     }
     static Material bronze() 
@@ -108,8 +126,7 @@ namespace rt {
       m.coef_diffusion  = 0.5f;
       m.coef_reflexion  = 0.75f;
       m.coef_refraction = 0.0f;
-      m.in_refractive_index  = 1.0f;
-      m.out_refractive_index = 1.0f;
+      m.setRefractiveIndices( 1.0f, 1.0f );
       return m;
     }
     static Material emerald() 
@@ -122,8 +139,7 @@ namespace rt {
       m.coef_diffusion  = 0.15f;
       m.coef_reflexion  = 0.5f;
       m.coef_refraction = 0.65f;
-      m.in_refractive_index  = 1.5f;
-      m.out_refractive_index = 1.0f;
+      m.setRefractiveIndices( 1.5f, 1.0f );
       return m;
     }
     static Material glass() 
@@ -136,8 +152,7 @@ namespace rt {
       m.coef_diffusion  = 0.01f;
       m.coef_reflexion  = 0.05f;
       m.coef_refraction = 0.98f;
-      m.in_refractive_index  = 1.5f;
-      m.out_refractive_index = 1.0f;
+      m.setRefractiveIndices( 1.5f, 1.0f );
       return m;
     }
   };
@@ -0,0 +1,45 @@
+/**
+@file Parallel.h
+*/
+#pragma once
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// @return the number of threads used by default, i.e. the number of
+  /// hardware threads (at least 1).
+  inline int defaultThreadNumber()
+  {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : (int) n;
+  }
+
+  /// Splits [begin,end) into at most \a nb_threads contiguous chunks
+  /// and calls \a f( chunk_begin, chunk_end ) on each of them in
+  /// parallel. The calling thread processes the first chunk. If \a
+  /// nb_threads <= 0, defaultThreadNumber() is used.
+  template <typename TFunction>
+  void parallelFor( long begin, long end, int nb_threads, TFunction f )
+  {
+    if ( nb_threads <= 0 ) nb_threads = defaultThreadNumber();
+    long n = end - begin;
+    if ( n <= 0 ) return;
+    nb_threads = (int) std::min( (long) nb_threads, n );
+    if ( nb_threads == 1 ) { f( begin, end ); return; }
+    std::vector< std::thread > threads;
+    long chunk = ( n + nb_threads - 1 ) / nb_threads;
+    for ( long b = begin + chunk; b < end; b += chunk )
+      threads.emplace_back( f, b, std::min( end, b + chunk ) );
+    f( begin, std::min( end, begin + chunk ) );
+    for ( auto& t : threads ) t.join();
+  }
+
+} // namespace rt
+
+#endif // #define _PARALLEL_H_
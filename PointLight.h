@@ -6,8 +6,14 @@
 #ifndef _POINT_LIGHT_H_
 #define _POINT_LIGHT_H_
 
+#include <iostream>
+#ifndef RT_HEADLESS
 #include <QGLViewer/manipulatedFrame.h>
+#else
+namespace qglviewer { class ManipulatedFrame; }
+#endif
 #include "Light.h"
+#include "Material.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -23,6 +29,10 @@ namespace rt {
     Point4 position;
     /// The emission color of the light.
     Color emission;
+    /// The constant, linear and quadratic attenuation factors, as in
+    /// OpenGL. The emission is divided by (c + l*d + q*d^2) at distance
+    /// d. Default is (1,0,0), i.e. no attenuation.
+    Vector3 attenuation;
     /// The material (global to the light).
     Material material;
     /// Used to store a manipulator to move the light in space.
@@ -37,6 +47,7 @@ namespace rt {
                 Color diffuse_color  = Color( 1.0, 1.0, 1.0 ),
                 Color specular_color = Color( 1.0, 1.0, 1.0 ) )
       : number( light_number ), position( pos ), emission( emission_color ),
+        attenuation( 1.0f, 0.0f, 0.0f ),
         material( ambient_color, diffuse_color, specular_color ),
         manipulator( 0 )
     {}
@@ -44,19 +55,25 @@ namespace rt {
     /// Destructor.
     ~PointLight()
     {
+#ifndef RT_HEADLESS
       if ( manipulator != 0 ) delete manipulator;
+#endif
     }
 
     /// This method is called by Scene::init() at the beginning of the
     /// display in the OpenGL window.
     void init( Viewer& viewer ) 
     {
+#ifndef RT_HEADLESS
       glMatrixMode(GL_MODELVIEW);
       glLoadIdentity();
       glEnable( number );
       glLightfv( number, GL_AMBIENT,  material.ambient );
       glLightfv( number, GL_DIFFUSE,  material.diffuse );
       glLightfv( number, GL_SPECULAR, material.specular );
+      glLightf( number, GL_CONSTANT_ATTENUATION,  attenuation[ 0 ] );
+      glLightf( number, GL_LINEAR_ATTENUATION,    attenuation[ 1 ] );
+      glLightf( number, GL_QUADRATIC_ATTENUATION, attenuation[ 2 ] );
       std::cout << "Init  light at " << position << std::endl;
       if ( position[ 3 ] != 0.0 ) // the point light is not at infinity
         {
@@ -67,12 +84,16 @@ namespace rt {
                                     position[ 1 ] / position[ 3 ], 
                                     position[ 2 ] / position[ 3 ] );
         }
+#else
+      (void) viewer;
+#endif
     }
 
     /// This method is called by Scene::light() at each frame to
     /// set the lights in the OpenGL window.
     void light( Viewer& /* viewer */ ) 
     {
+#ifndef RT_HEADLESS
       Point4 pos = position;
       if ( manipulator != 0 )
         {
@@ -81,19 +102,25 @@ namespace rt {
           pos[1] = float(pos2.y);
           pos[2] = float(pos2.z);
           pos[3] = 1.0f;
+          if ( pos != position ) ++version;
           position = pos;
         }
       glLightfv( number, GL_POSITION, pos);
+#endif
     }
 
     /// This method is called by Scene::draw() at each frame to
     /// redisplay objects in the OpenGL window.
     void draw( Viewer& viewer )
     {
+#ifndef RT_HEADLESS
       if ( manipulator != 0 && manipulator->grabsMouse() )
         viewer.drawSomeLight( number, 1.2f );
       else
 	viewer.drawSomeLight( number );
+#else
+      (void) viewer;
+#endif
     }
 
     /// Given the point \a p, returns the normalized direction to this light.
@@ -107,9 +134,75 @@ namespace rt {
     }
 
     /// @return the color of this light viewed from the given point \a p.
-    Color color( const Vector3& /* p */ ) const
+    Color color( const Vector3& p ) const
     {
-      return emission;
+      if ( ! isAttenuated() ) return emission;
+      Real d = distance( p, Vector3( position.data() ) / position[ 3 ] );
+      return emission * ( 1.0f / ( attenuation[ 0 ]
+                                   + d * ( attenuation[ 1 ] + d * attenuation[ 2 ] ) ) );
+    }
+
+    /// Sets the constant, linear and quadratic attenuation factors.
+    void setAttenuation( Real constant, Real linear, Real quadratic )
+    {
+      attenuation = Vector3( constant, linear, quadratic );
+    }
+
+    /// @return 'true' iff the light is at finite distance and its
+    /// emission decreases with the distance.
+    bool isAttenuated() const
+    {
+      return position[ 3 ] != 0.0
+        && ( attenuation[ 1 ] > 0.0f || attenuation[ 2 ] > 0.0f );
+    }
+
+    /// The light is bounded only when attenuated: its color falls below
+    /// \a threshold at the distance d solving c + l*d + q*d^2 = e / threshold.
+    bool boundingSphere( Real threshold, Point3& center, Real& radius ) const
+    {
+      if ( ! isAttenuated() || threshold <= 0.0f ) return false;
+      center = Vector3( position.data() ) / position[ 3 ];
+      Real k = emission.max() / threshold - attenuation[ 0 ];
+      Real q = attenuation[ 2 ];
+      Real l = attenuation[ 1 ];
+      if ( k <= 0.0f )   radius = 0.0f;
+      else if ( q > 0 )  radius = ( -l + sqrt( l*l + 4.0f*q*k ) ) / ( 2.0f*q );
+      else               radius = k / l;
+      return true;
+    }
+
+    Light* clone() const { return cloneLight( *this ); }
+
+    /// @return a copy of \a light, without its manipulator (which stays
+    /// owned by \a light).
+    template <typename TLight>
+    static Light* cloneLight( const TLight& light )
+    {
+      TLight* copy = new TLight( light );
+      copy->manipulator = 0;
+      return copy;
+    }
+
+    /// A point light is baked with its current position (the manipulator
+    /// is read by light()).
+    bool bake( BakedLight& baked ) const
+    {
+      Vector3 pos( position.data() );
+      if ( position[ 3 ] == 0.0 )
+        {
+          baked.type     = BakedLight::Directional;
+          baked.position = pos / pos.norm();
+        }
+      else
+        {
+          baked.type     = isAttenuated() ? BakedLight::Attenuated : BakedLight::Point;
+          baked.position = pos / position[ 3 ];
+        }
+      baked.emission    = emission;
+      baked.attenuation = attenuation;
+      baked.samples     = nbSamples();
+      baked.shape       = BakedLight::NoShape;
+      return true;
     }
     
   };
@@ -9,6 +9,7 @@
 #include <cassert>
 #include <cmath>
 #include <array>
+#include <iostream>
 
 /// Namespace RayTracer
 namespace rt {
@@ -6,6 +6,9 @@
 #ifndef _RAY_H_
 #define _RAY_H_
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "PointVector.h"
 
 // @see http://devernay.free.fr/cours/opengl/materials.html
@@ -13,26 +16,93 @@
 /// Namespace RayTracer
 namespace rt {
 
+  struct GraphicalObject;
+
   /// This structure stores a ray having an origin and a direction. It
-  /// also stores its depth.
+  /// also stores its depth, and what is known of its path from the eye.
+  /// The inverse of the direction and its signs are precomputed for
+  /// slab tests (ray/box intersections).
+  ///
+  /// A secondary ray starts from a computed hit point, which is only
+  /// known up to rounding errors: see leaveFrom.
   struct Ray {
+    /// Tag of the constructor taking a direction known to be unitary.
+    struct Normalized {};
+
     /// origin of the ray.
     Point3 origin;
     /// unit direction of the ray.
     Vector3 direction;
+    /// the inverse of each coordinate of the direction (possibly infinite).
+    Vector3 inv_direction;
+    /// sign[a] is 1 iff the direction is negative along axis a, else 0.
+    int sign[ 3 ];
     /// depth of the ray, i.e. the number of times it can bounce on an object.
     int depth;
+    /// weight of the color of the ray in the pixel color, i.e. the product
+    /// of the coefficients of the surfaces it bounced on (1 for an eye ray).
+    Real weight;
+    /// number of bounces from the eye ray (0 for an eye ray).
+    int bounces;
+    /// hits closer than t_min to the origin are ignored (0 by default).
+    Real t_min;
+    /// the object whose surface the ray starts from, if any: its hit at
+    /// the origin is ignored (see GraphicalObject::intersect).
+    GraphicalObject* exclude;
     
     /// Default constructor
     Ray() {}
     
     /// Constructor from origin and vector. The vector may not be unitary.
     Ray( const Point3& o, const Vector3& dir, int d = 1 )
-      : origin( o ), direction( dir ), depth( d )
+      : origin( o ), direction( dir ), depth( d ), weight( 1.0f ), bounces( 0 ),
+        t_min( 0.0f ), exclude( nullptr )
     {
       Real l = direction.norm();
       if ( l != 1.0f ) direction /= l;
+      precompute();
+    }
+
+    /// Constructor from origin and unit vector (e.g. reflected or
+    /// refracted directions), which is not normalized again.
+    Ray( const Point3& o, const Vector3& unit_dir, int d, Normalized )
+      : origin( o ), direction( unit_dir ), depth( d ), weight( 1.0f ), bounces( 0 ),
+        t_min( 0.0f ), exclude( nullptr )
+    {
+      precompute();
+    }
+
+    /// Computes inv_direction and sign from direction.
+    void precompute()
+    {
+      for ( int a = 0; a < 3; ++a )
+        {
+          inv_direction[ a ] = 1.0f / direction[ a ];
+          sign[ a ]          = inv_direction[ a ] < 0.0f ? 1 : 0;
+        }
     }
+
+    /// Makes the ray start from the surface of \a object, its origin
+    /// being a hit point on it: the hit of \a object at the origin is
+    /// ignored, as well as any hit within the error on the origin.
+    void leaveFrom( GraphicalObject* object )
+    {
+      exclude = object;
+      t_min   = originError( origin );
+    }
+
+    /// @return a bound on the distance between a computed hit point \a p
+    /// and the exact one: a few ulps of its largest coordinate.
+    static Real originError( const Point3& p )
+    {
+      Real m = std::max( std::fabs( p[ 0 ] ),
+                         std::max( std::fabs( p[ 1 ] ), std::fabs( p[ 2 ] ) ) );
+      return ERROR_ULPS * std::numeric_limits< Real >::epsilon() * ( 1.0f + m );
+    }
+
+    /// The number of ulps of originError (the hit point o + t d and the
+    /// intersection itself accumulate a few roundings each).
+    static constexpr Real ERROR_ULPS = 4.0f;
   };
 
   
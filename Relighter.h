@@ -0,0 +1,265 @@
+/**
+@file Relighter.h
+*/
+#pragma once
+#ifndef _RELIGHTER_H_
+#define _RELIGHTER_H_
+
+#include <algorithm>
+#include <vector>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "Ray.h"
+#include "Material.h"
+#include "Scene.h"
+#include "Renderer.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Relighting mode for look development: one render() records the ray
+  tree of every pixel (primary, reflected and refracted hits) with the
+  contribution of each light at each hit (and of the environment light,
+  if any: see Renderer::setEnvironmentLight). Afterwards:
+
+  - relight() re-evaluates only the contributions of the lights that
+    changed (one shadow ray per hit and per changed light, no other
+    intersection);
+  - updateMaterials() reshades only the hits on the objects whose
+    material changed. If the change alters the ray tree (reflection or
+    refraction switched on or off, other refractive indices), the image
+    is recorded again; if it alters the light going through a
+    transparent object, all shadow terms are recomputed.
+
+  The geometry, the camera and the number of lights must not change in
+  between (call render() again otherwise). Hit objects are kept by their
+  index in the scene, so that the renderer may be given a snapshot of
+  the scene (Scene::snapshot) at each call. Every light is evaluated at
+  every hit: the stochastic light selection of Renderer::setMaxLights
+  is not used here. The tree is pruned like Renderer::shade does
+  (Renderer::spawn), once at record time: updateMaterials() keeps this
+  pruning even if the new coefficients would change it.
+  */
+  struct Relighter {
+    /// A hit (or a miss) of the recorded ray trees.
+    struct Node {
+      Ray              ray;       ///< the ray arriving at this node.
+      int              object;    ///< the index of the hit object in the scene, or -1 for a miss.
+      Point3           point;     ///< the hit point.
+      Vector3          normal;    ///< the normal at the hit point.
+      Vector3          reflected; ///< the reflected direction of the ray.
+      Material         material;  ///< the material used for shading.
+      int              reflection, refraction; ///< children (or -1).
+      Real             scale;     ///< the factor of its color (cf. Renderer::spawn).
+      Real             fresnel;   ///< the reflected part of the transmitted light.
+      Color            color;     ///< the color seen by the ray.
+    };
+
+    /// Number of light contributions computed by the last call.
+    long myEvaluations = 0;
+
+    /// @return the node of the eye ray of pixel (x,y) of the last render.
+    const Node& root( int x, int y ) const { return myNodes[ myRoots[ x + y * myWidth ] ]; }
+
+    /// Renders the view of \a renderer into \a image and records
+    /// everything needed to relight it.
+    void render( Renderer& renderer, Image2D<Color>& image, int max_depth )
+    {
+      renderer.prepare();
+      myWidth  = renderer.myWidth;
+      myHeight = renderer.myHeight;
+      myMaxDepth   = max_depth;
+      myNbLights   = (int) renderer.ptrScene->myLights.size();
+      myNbTerms    = myNbLights + ( renderer.ptrEnvironment != 0 ? 1 : 0 );
+      myEvaluations = 0;
+      myNodes.clear();
+      myTerms.clear();
+      myRoots.resize( myWidth * myHeight );
+      for ( int y = 0; y < myHeight; ++y )
+        for ( int x = 0; x < myWidth; ++x )
+          myRoots[ x + y * myWidth ] = record( renderer, renderer.eyeRay( x, y, max_depth ) );
+      for ( std::size_t n = 0; n < myNodes.size(); ++n )
+        for ( int i = 0; i < myNbTerms; ++i ) evaluate( renderer, n, i );
+      compose( renderer, image, true );
+    }
+
+    /// Updates \a image after the lights of indices \a lights changed.
+    void relight( Renderer& renderer, Image2D<Color>& image, const std::vector< int >& lights )
+    {
+      renderer.prepare();
+      myEvaluations = 0;
+      for ( std::size_t n = 0; n < myNodes.size(); ++n )
+        for ( int i : lights ) evaluate( renderer, n, i );
+      compose( renderer, image, true );
+    }
+
+    /// Updates \a image after the materials of \a objects changed.
+    void updateMaterials( Renderer& renderer, Image2D<Color>& image,
+                          const std::vector< GraphicalObject* >& objects )
+    {
+      bool all_shadows = false;
+      std::vector< char > changed( myNodes.size(), 0 );
+      renderer.prepare();
+      for ( std::size_t n = 0; n < myNodes.size(); ++n )
+        {
+          Node& node = myNodes[ n ];
+          if ( node.object < 0
+               || std::find( objects.begin(), objects.end(), object( renderer, node ) )
+                  == objects.end() )
+            continue;
+          Material m = renderer.material( object( renderer, node ), node.point );
+          if ( changesTree( node, m ) )
+            return render( renderer, image, myMaxDepth );
+          all_shadows = all_shadows || changesShadows( node.material, m );
+          node.material = m;
+          changed[ n ] = 1;
+        }
+      myEvaluations = 0;
+      for ( std::size_t n = 0; n < myNodes.size(); ++n )
+        if ( all_shadows || changed[ n ] )
+          for ( int i = 0; i < myNbTerms; ++i ) evaluate( renderer, n, i );
+      compose( renderer, image, false );
+    }
+
+  private:
+    std::vector< Node >  myNodes;
+    /// The contribution of light i at node n is myTerms[ n * myNbTerms + i ],
+    /// the one of the environment light (if any) coming last.
+    std::vector< Color > myTerms;
+    /// The root node of each pixel.
+    std::vector< int >   myRoots;
+    int myWidth = 0, myHeight = 0, myMaxDepth = 0, myNbLights = 0, myNbTerms = 0;
+
+    /// Records the tree of \a ray, as Renderer::trace would trace it.
+    /// @return the index of its root node.
+    int record( Renderer& renderer, const Ray& ray )
+    {
+      int  n = (int) myNodes.size();
+      Node node;
+      node.ray        = ray;
+      node.reflection = node.refraction = -1;
+      node.scale      = 1.0f;
+      node.fresnel    = 0.0f;
+      node.object     = -1;
+      myNodes.push_back( node );
+      myTerms.resize( myTerms.size() + myNbTerms );
+      GraphicalObject* obj;
+      if ( renderer.ptrScene->rayIntersection( ray, obj, node.point ) > 0.0f ) return n;
+      node.object    = obj->sceneIndex;
+      node.material  = renderer.material( obj, node.point );
+      node.normal    = obj->getNormal( node.point );
+      node.reflected = renderer.reflect( ray.direction, node.normal );
+      const Material& m = node.material;
+      bool refracts = ray.depth > 0 && m.coef_refraction != 0;
+      Ray  refracted;
+      if ( refracts )
+        refracted = renderer.refractionRay( ray, obj, node.point, node.normal, m,
+                                            renderer.myFresnel ? &node.fresnel : 0 );
+      if ( ray.depth > 0 && m.coef_reflexion + node.fresnel != 0 )
+        {
+          Ray reflected( node.point, node.reflected, ray.depth - 1, Ray::Normalized() );
+          reflected.leaveFrom( obj );
+          node.reflection = recordChild( renderer, ray, renderer.reflectionCoef( m, node.fresnel ),
+                                         reflected );
+        }
+      if ( refracts && node.fresnel < 1.0f )
+        node.refraction = recordChild( renderer, ray, renderer.refractionCoef( m, node.fresnel ),
+                                       refracted );
+      myNodes[ n ] = node;
+      return n;
+    }
+
+    /// Records the tree of the secondary ray \a child of \a parent,
+    /// weighted by \a coef, if it is traced.
+    /// @return the index of its root node, or -1.
+    int recordChild( Renderer& renderer, const Ray& parent, const Color& coef, Ray child )
+    {
+      Real k = renderer.spawn( parent, coef, child );
+      if ( k == 0.0f ) return -1;
+      int n = record( renderer, child );
+      myNodes[ n ].scale = k;
+      return n;
+    }
+
+    /// @return the object hit at \a node, in the scene of \a renderer.
+    static GraphicalObject* object( const Renderer& renderer, const Node& node )
+    {
+      return renderer.ptrScene->myObjects[ node.object ];
+    }
+
+    /// Computes the contribution of light \a i (the environment light if
+    /// i is myNbLights) at node \a n.
+    void evaluate( Renderer& renderer, std::size_t n, int i )
+    {
+      const Node& node = myNodes[ n ];
+      if ( node.object < 0 ) return;
+      GraphicalObject* obj = object( renderer, node );
+      myTerms[ n * myNbTerms + i ] = i == myNbLights
+        ? renderer.environmentLight( node.material, node.normal, node.reflected,
+                                     obj, node.point )
+        : renderer.lightContribution( i, 1.0f, node.material, node.normal, node.reflected,
+                                      obj, node.point );
+      ++myEvaluations;
+    }
+
+    /// Combines the nodes as Renderer::shade does, children first (they
+    /// are recorded after their parent), then fills \a image.
+    void compose( Renderer& renderer, Image2D<Color>& image, bool lights_changed )
+    {
+      for ( std::size_t k = myNodes.size(); k-- > 0; )
+        {
+          Node& node = myNodes[ k ];
+          if ( node.object < 0 )
+            {
+              // The background shows the lights.
+              if ( lights_changed ) node.color = renderer.background( node.ray );
+              continue;
+            }
+          const Material& m = node.material;
+          Color result( 0.0, 0.0, 0.0 );
+          if ( node.reflection >= 0 )
+            result += myNodes[ node.reflection ].color
+              * renderer.reflectionCoef( m, node.fresnel ) * myNodes[ node.reflection ].scale;
+          if ( node.refraction >= 0 )
+            result += myNodes[ node.refraction ].color
+              * renderer.refractionCoef( m, node.fresnel ) * myNodes[ node.refraction ].scale;
+          Color illumination( 0.0, 0.0, 0.0 );
+          for ( int i = 0; i < myNbTerms; ++i ) illumination += myTerms[ k * myNbTerms + i ];
+          illumination += m.ambient;
+          result += node.ray.depth != 0 ? illumination * m.coef_diffusion : illumination;
+          node.color = result;
+        }
+      image = Image2D<Color>( myWidth, myHeight );
+      for ( int y = 0; y < myHeight; ++y )
+        for ( int x = 0; x < myWidth; ++x )
+          {
+            Color c = myNodes[ myRoots[ x + y * myWidth ] ].color;
+            image.at( x, y ) = c.clamp();
+          }
+    }
+
+    /// @return 'true' iff shading \a node with \a m needs other rays.
+    static bool changesTree( const Node& node, const Material& m )
+    {
+      const Material& old = node.material;
+      if ( node.ray.depth <= 0 ) return false;
+      return ( old.coef_reflexion != 0 ) != ( m.coef_reflexion != 0 )
+        || ( old.coef_refraction != 0 ) != ( m.coef_refraction != 0 )
+        || ( m.coef_refraction != 0
+             && ( old.in_refractive_index != m.in_refractive_index
+                  || old.out_refractive_index != m.out_refractive_index ) );
+    }
+
+    /// @return 'true' iff going from \a old to \a m changes the light
+    /// going through the object, i.e. the shadows it casts.
+    static bool changesShadows( const Material& old, const Material& m )
+    {
+      return distance( old.diffuse * old.coef_refraction, m.diffuse * m.coef_refraction ) != 0.0f;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _RELIGHTER_H_
@@ -0,0 +1,288 @@
+/**
+@file RenderCache.h
+*/
+#pragma once
+#ifndef _RENDER_CACHE_H_
+#define _RENDER_CACHE_H_
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "Ray.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "Relighter.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Keeps the previous frame to speed up interactive re-renders. What
+  changed since the previous render is known from the versions of the
+  scene (Scene::myObjectsVersion, Scene::myLightsVersion and
+  Light::version), that its edits increment:
+
+  - nothing changed: the previous image is given back;
+  - only lights changed: a frame rendered from scratch was recorded by a
+    Relighter, which re-evaluates only the per-hit terms of the changed
+    lights (one shadow ray per hit and per changed light, no other
+    intersection);
+  - only the camera moved: the previous hits are reprojected into the
+    new view (with a depth test). A reprojected color is reused if the
+    direction from which its point is seen changed by less than
+    myMaxAngle, otherwise the point is shaded again. Pixels receiving no
+    sample (disocclusions, borders) are traced from scratch;
+  - otherwise (objects edited, lights added, other resolution or depth,
+    lights changed after a reprojection), everything is traced again.
+
+  Frames rendered from scratch are shaded as by Relighter: every light
+  is evaluated at every hit (Renderer::setMaxLights is not used).
+  Reprojection is approximate by nature: a surface that was outside the
+  previous view may appear late. Call invalidate() to force a full render.
+
+  Hit objects are kept by their index in the scene, so that each render
+  may be given a new snapshot of the same scene (Scene::snapshot).
+  */
+  struct RenderCache {
+    /// A cached pixel.
+    struct Sample {
+      Point3 point;  ///< the hit point (if object >= 0).
+      int    object; ///< the index of the hit object in the scene, or -1 for background.
+      Color  color;  ///< the color of the pixel.
+    };
+
+    /// A reprojected color is reused when its point is seen from
+    /// directions differing by less than this angle (in radians).
+    Real myMaxAngle = 0.005f;
+    /// Counters for the last render: pixels traced from scratch, pixels
+    /// shaded again from a known hit, and pixels reused as is.
+    long myTraced = 0, myShaded = 0, myReused = 0;
+
+    /// Forgets the previous frame.
+    void invalidate() { mySamples.clear(); }
+
+    /// Renders the view of \a renderer into \a image, reusing the
+    /// previous frame as much as possible.
+    void render( Renderer& renderer, Image2D<Color>& image, int max_depth )
+    {
+      renderer.prepare();
+      const Scene& scene = *renderer.ptrScene;
+      int w = renderer.myWidth;
+      int h = renderer.myHeight;
+      image = Image2D<Color>( w, h );
+      myTraced = myShaded = myReused = 0;
+      bool retrace = mySamples.empty() || w != myWidth || h != myHeight
+        || max_depth != myMaxDepth
+        || scene.myObjectsVersion != myObjectsVersion || scene.myLightsVersion != myLightsVersion
+        || scene.myLights.size() != myLightVersions.size();
+      std::vector< int > lights;
+      for ( std::size_t i = 0; ! retrace && i < myLightVersions.size(); ++i )
+        if ( scene.myLights[ i ]->version != myLightVersions[ i ] ) lights.push_back( (int) i );
+      bool same_view = sameView( renderer );
+      if ( retrace || ( ! lights.empty() && ! ( same_view && myRecorded ) ) )
+        renderAll( renderer, max_depth );
+      else if ( ! lights.empty() ) relight( renderer, lights );
+      else if ( same_view ) myReused = (long) w * h;
+      else reproject( renderer );
+      myWidth    = w;
+      myHeight   = h;
+      myMaxDepth = max_depth;
+      myObjectsVersion = scene.myObjectsVersion;
+      myLightsVersion  = scene.myLightsVersion;
+      myLightVersions.resize( scene.myLights.size() );
+      for ( std::size_t i = 0; i < myLightVersions.size(); ++i )
+        myLightVersions[ i ] = scene.myLights[ i ]->version;
+      myOrigin = renderer.myOrigin;
+      myDirs[ 0 ] = renderer.myDirUL; myDirs[ 1 ] = renderer.myDirUR;
+      myDirs[ 2 ] = renderer.myDirLL; myDirs[ 3 ] = renderer.myDirLR;
+      for ( int y = 0; y < h; ++y )
+        for ( int x = 0; x < w; ++x )
+          {
+            Color c = mySamples[ x + y * w ].color;
+            image.at( x, y ) = c.clamp();
+          }
+    }
+
+  private:
+    std::vector< Sample > mySamples;
+    /// The ray trees of the last frame rendered from scratch.
+    Relighter myRelighter;
+    /// 'true' iff myRelighter holds the current view (no reprojection since).
+    bool    myRecorded = false;
+    /// The versions of the scene at the previous render.
+    unsigned long myObjectsVersion = 0, myLightsVersion = 0;
+    std::vector< unsigned long > myLightVersions;
+    int     myWidth = 0, myHeight = 0, myMaxDepth = 0;
+    Point3  myOrigin;
+    Vector3 myDirs[ 4 ];
+
+    bool sameView( const Renderer& renderer ) const
+    {
+      return renderer.myOrigin == myOrigin
+        && renderer.myDirUL == myDirs[ 0 ] && renderer.myDirUR == myDirs[ 1 ]
+        && renderer.myDirLL == myDirs[ 2 ] && renderer.myDirLR == myDirs[ 3 ];
+    }
+
+    /// Traces pixel (x,y) from scratch.
+    Sample traceSample( Renderer& renderer, int x, int y, int max_depth )
+    {
+      Ray              ray = renderer.eyeRay( x, y, max_depth );
+      GraphicalObject* obj;
+      Sample           s;
+      if ( renderer.ptrScene->rayIntersection( ray, obj, s.point ) > 0.0f )
+        {
+          s.object = -1;
+          s.color  = renderer.background( ray );
+        }
+      else
+        {
+          s.object = obj->sceneIndex;
+          s.color  = renderer.shade( ray, obj, s.point );
+        }
+      ++myTraced;
+      return s;
+    }
+
+    /// Renders every pixel from scratch, recording the ray trees.
+    void renderAll( Renderer& renderer, int max_depth )
+    {
+      Image2D<Color> image;
+      myRelighter.render( renderer, image, max_depth );
+      myRecorded = true;
+      getSamples( renderer );
+      myTraced = (long) renderer.myWidth * renderer.myHeight;
+    }
+
+    /// Same view, only the lights of indices \a lights changed.
+    void relight( Renderer& renderer, const std::vector< int >& lights )
+    {
+      Image2D<Color> image;
+      myRelighter.relight( renderer, image, lights );
+      getSamples( renderer );
+      myShaded = (long) renderer.myWidth * renderer.myHeight;
+    }
+
+    /// Takes the samples from the primary hits of myRelighter.
+    void getSamples( const Renderer& renderer )
+    {
+      int w = renderer.myWidth;
+      int h = renderer.myHeight;
+      mySamples.resize( w * h );
+      for ( int y = 0; y < h; ++y )
+        for ( int x = 0; x < w; ++x )
+          {
+            const Relighter::Node& node = myRelighter.root( x, y );
+            mySamples[ x + y * w ] = Sample{ node.point, node.object, node.color };
+          }
+    }
+
+    /// Planar pinhole model of a view box: the corner directions are put
+    /// on the plane at distance 1 along the view axis.
+    struct Pinhole {
+      Vector3 f, ul, a, b;
+      Real    a2, b2;
+      Pinhole( const Vector3& dirUL, const Vector3& dirUR, const Vector3& dirLL, const Vector3& dirLR )
+      {
+        f  = dirUL + dirUR + dirLL + dirLR;
+        f /= f.norm();
+        ul = dirUL / dirUL.dot( f );
+        a  = dirUR / dirUR.dot( f ) - ul;
+        b  = dirLL / dirLL.dot( f ) - ul;
+        a2 = a.dot( a );
+        b2 = b.dot( b );
+      }
+      /// Projects direction \a v to pixel (x,y) of a w x h image.
+      /// @return 'false' if it falls outside the image.
+      bool project( const Vector3& v, int w, int h, int& x, int& y ) const
+      {
+        Real z = v.dot( f );
+        if ( z <= 0.0f ) return false;
+        Vector3 q = v / z - ul;
+        x = (int) floor( q.dot( a ) / a2 * ( w - 1 ) + 0.5f );
+        y = (int) floor( q.dot( b ) / b2 * ( h - 1 ) + 0.5f );
+        return 0 <= x && x < w && 0 <= y && y < h;
+      }
+    };
+
+    /// @return 'true' iff the old pixel (x,y) and its neighbours were background.
+    bool backgroundAround( int x, int y ) const
+    {
+      for ( int j = std::max( 0, y - 1 ); j <= std::min( myHeight - 1, y + 1 ); ++j )
+        for ( int i = std::max( 0, x - 1 ); i <= std::min( myWidth - 1, x + 1 ); ++i )
+          if ( mySamples[ i + j * myWidth ].object >= 0 ) return false;
+      return true;
+    }
+
+    /// New view: previous hits are splatted into the new view with a
+    /// depth test. Remaining pixels whose direction was background in
+    /// the previous view (with its neighbours) stay background, the
+    /// others are traced. The ray trees of myRelighter no longer match.
+    void reproject( Renderer& renderer )
+    {
+      const std::vector< GraphicalObject* >& objects = renderer.ptrScene->myObjects;
+      myRecorded = false;
+      int     w = myWidth, h = myHeight;
+      Point3  o = renderer.myOrigin;
+      Pinhole view( renderer.myDirUL, renderer.myDirUR, renderer.myDirLL, renderer.myDirLR );
+      Pinhole old_view( myDirs[ 0 ], myDirs[ 1 ], myDirs[ 2 ], myDirs[ 3 ] );
+      // A bit more than the angle covered by a pixel, to validate reprojections.
+      Real pixel_cos = cos( 1.5f * acos( std::min( 1.0f, renderer.eyeRay( 0, 0, 0 ).direction
+                                                   .dot( renderer.eyeRay( 1, 1, 0 ).direction ) ) ) );
+      Real max_cos   = cos( myMaxAngle );
+
+      std::vector< Sample > samples( w * h, Sample{ Point3(), -1, Color() } );
+      std::vector< Real >   depth( w * h, std::numeric_limits< Real >::max() );
+      std::vector< char >   reuse( w * h, 0 );
+      for ( const Sample& s : mySamples )
+        {
+          if ( s.object < 0 ) continue;
+          Vector3 v = s.point - o;
+          int     x, y;
+          if ( ! view.project( v, w, h, x, y ) ) continue;
+          int     i = x + y * w;
+          Real    d = v.norm();
+          if ( d >= depth[ i ] ) continue;
+          Vector3 dir_new = v / d;
+          if ( renderer.eyeRay( x, y, 0 ).direction.dot( dir_new ) < pixel_cos ) continue;
+          Vector3 dir_old = s.point - myOrigin;
+          dir_old /= dir_old.norm();
+          depth[ i ]   = d;
+          samples[ i ] = s;
+          reuse[ i ]   = dir_old.dot( dir_new ) >= max_cos;
+        }
+      for ( int y = 0; y < h; ++y )
+        for ( int x = 0; x < w; ++x )
+          {
+            int i = x + y * w;
+            if ( samples[ i ].object < 0 )
+              {
+                Ray ray = renderer.eyeRay( x, y, myMaxDepth );
+                int ox, oy;
+                if ( old_view.project( ray.direction, w, h, ox, oy ) && backgroundAround( ox, oy ) )
+                  {
+                    samples[ i ].color = renderer.background( ray );
+                    ++myShaded;
+                  }
+                else samples[ i ] = traceSample( renderer, x, y, myMaxDepth );
+              }
+            else if ( reuse[ i ] )
+              ++myReused;
+            else
+              {
+                Ray ray( o, samples[ i ].point - o, myMaxDepth );
+                samples[ i ].color = renderer.shade( ray, objects[ samples[ i ].object ],
+                                                     samples[ i ].point );
+                ++myShaded;
+              }
+          }
+      mySamples.swap( samples );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _RENDER_CACHE_H_
@@ -0,0 +1,93 @@
+/**
+@file RenderPasses.h
+*/
+#pragma once
+#ifndef _RENDER_PASSES_H_
+#define _RENDER_PASSES_H_
+
+#include <fstream>
+#include <limits>
+#include <string>
+#include "PointVector.h"
+#include "Color.h"
+#include "Image2D.h"
+#include "Image2DWriter.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  The auxiliary output variables (AOVs) of a render, i.e. what the eye
+  ray of each pixel hits first. They are filled by
+  Renderer::render( image, max_depth, &passes ) along with the image,
+  at the cost of a few stores per pixel.
+
+  For background pixels, depth is +infinity, normal is 0, objectId is
+  -1 and albedo is black.
+  */
+  struct RenderPasses {
+    /// Distance from the eye to the first hit.
+    Image2D<Real>    depth;
+    /// Unit normal (world coordinates) at the first hit.
+    Image2D<Vector3> normal;
+    /// Index of the first hit object in Scene::myObjects.
+    Image2D<int>     objectId;
+    /// Diffuse color of the material at the first hit.
+    Image2D<Color>   albedo;
+
+    /// Allocates all passes for a \a width x \a height render.
+    void resize( int width, int height )
+    {
+      depth    = Image2D<Real>( width, height );
+      normal   = Image2D<Vector3>( width, height );
+      objectId = Image2D<int>( width, height );
+      albedo   = Image2D<Color>( width, height );
+    }
+
+    /// Records a background pixel.
+    void setBackground( int x, int y )
+    {
+      depth.at( x, y )    = std::numeric_limits<Real>::infinity();
+      normal.at( x, y )   = Vector3( 0.0f, 0.0f, 0.0f );
+      objectId.at( x, y ) = -1;
+      albedo.at( x, y )   = Color( 0.0f, 0.0f, 0.0f );
+    }
+
+    /// Writes the passes as four separate PFM images (a PFM file holds
+    /// one or three channels), named \a basename followed by
+    /// "_depth.pfm", "_normal.pfm", "_id.pfm" and "_albedo.pfm" (object
+    /// ids are written as floats).
+    /// @return 'true' iff every file was written.
+    bool write( const std::string& basename ) const
+    {
+      Image2D<Real> ids( objectId.w(), objectId.h() );
+      for ( int y = 0; y < ids.h(); ++y )
+        for ( int x = 0; x < ids.w(); ++x )
+          ids.at( x, y ) = (Real) objectId.at( x, y );
+      Image2D<Vector3> colors( albedo.w(), albedo.h() );
+      for ( int y = 0; y < colors.h(); ++y )
+        for ( int x = 0; x < colors.w(); ++x )
+          {
+            Color c = albedo.at( x, y );
+            colors.at( x, y ) = Vector3( c.r(), c.g(), c.b() );
+          }
+      return writePFM( depth, basename + "_depth.pfm" )
+        && writePFM( normal, basename + "_normal.pfm" )
+        && writePFM( ids, basename + "_id.pfm" )
+        && writePFM( colors, basename + "_albedo.pfm" );
+    }
+
+  private:
+    template <typename TValue>
+    static bool writePFM( const Image2D<TValue>& image, const std::string& name )
+    {
+      std::ofstream output( name.c_str(), std::ios::binary );
+      return output.good()
+        && Image2DWriter<TValue>::write( image, output, false )
+        && output.good();
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _RENDER_PASSES_H_
@@ -6,11 +6,16 @@
 #ifndef _RENDERER_H_
 #define _RENDERER_H_
 
+#include <limits>
 #include "Color.h"
 #include "Image2D.h"
 #include "Ray.h"
 #include "Background.h"
+#include "EnvironmentMap.h"
 #include "Scene.h"
+#include "LightCuller.h"
+#include "RenderPasses.h"
+#include "Fresnel.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -47,11 +52,29 @@ namespace rt {
     output.flush();
   }
 
-  /// This structure takes care of rendering a scene.
-  struct Renderer {
+  /// Gives \a image the size \a w x \a h, reallocating it if needed,
+  /// before a render.
+  /// @return 'false' if it cannot be done (see the overload for mapped
+  /// images in MappedImage.h).
+  template <typename TImage>
+  bool fitImage( TImage& image, int w, int h )
+  {
+    if ( image.w() != w || image.h() != h ) image = TImage( w, h );
+    return true;
+  }
+
+  /// This structure takes care of rendering a scene of type \a TScene:
+  /// a Scene, whose objects are only known through GraphicalObject, or
+  /// a StaticScene, whose intersections are resolved at compile time.
+  /// The usual renderer is rt::Renderer.
+  template < typename TScene >
+  struct BasicRenderer {
+
+    /// The type of the rendered scene.
+    typedef TScene SceneType;
 
     /// The scene to render
-    Scene* ptrScene;
+    TScene* ptrScene;
     /// The origin of the camera in space.
     Point3 myOrigin;
     /// (myOrigin, myOrigin+myDirUL) forms a ray going through the upper-left
@@ -70,11 +93,144 @@ namespace rt {
     int myWidth;
     int myHeight;
 
+    /// The background seen by rays escaping the scene.
     Background* ptrBackground;
+    /// The environment map lighting the scene (image-based lighting), or
+    /// 0. It is usually also the background.
+    const EnvironmentMap* ptrEnvironment = 0;
+    /// The number of directions of the environment sampled per point.
+    int myEnvironmentSamples = 0;
+    /// When false, render() does not print its progress.
+    bool myVerbose;
+
+    /// Lights whose color is below this threshold at a point are culled.
+    Real myLightThreshold;
+    /// When > 0, at most this number of lights are shaded at each point,
+    /// chosen stochastically according to their estimated contribution.
+    int myMaxLights;
+    /// The per-region light lists, built by prepare().
+    LightCuller myLightCuller;
+    /// The lights of the scene baked by prepare(), in the same order.
+    std::vector< BakedLight > myBakedLights;
+    /// Random generator for stochastic choices.
+    std::mt19937 myRandom;
+    /// Scratch buffers of illumination() when lights are sampled (the
+    /// estimated contribution of each candidate, and the chosen lights).
+    std::vector< Real > myLightEstimates;
+    std::vector< std::pair< int, Real > > myChosenLights;
+    /// The angle between the rays of two neighbouring pixels (computed
+    /// by prepare()), giving the footprint of textures (see material()).
+    Real myPixelAngle = 0.0f;
+
+    /// When true, shadow() first tests the last opaque occluder found for
+    /// the same light. A renderer is used by a single thread, so this
+    /// cache is per thread.
+    bool myShadowCache;
+    /// The last opaque occluder found for each light (or 0).
+    std::vector< GraphicalObject* > myLastOccluders;
+    /// Number of shadow queries that could use the cache, and number of
+    /// them answered by the cached occluder.
+    long myShadowCacheQueries, myShadowCacheHits;
+
+    /// When true, the shadows of area lights are first estimated with
+    /// their first SHADOW_PROBES samples, and the other samples are only
+    /// cast when these probes disagree (penumbra). Otherwise all samples
+    /// are cast.
+    bool myAdaptiveShadows;
+    /// Number of probe samples of the adaptive shadows.
+    static constexpr int SHADOW_PROBES = 4;
+    /// The probes agree when their colors are within this distance.
+    Real myShadowTolerance;
+    /// Number of shadow rays cast (to compare sampling modes).
+    long myShadowRays;
+
+    /// Reflected and refracted rays whose weight is below this value are
+    /// not traced (0 disables this cutoff).
+    Real myMinWeight;
+    /// When >= 0, rays having bounced more than this number of times are
+    /// traced with a probability given by their weight (russian
+    /// roulette), and their color is scaled to stay unbiased.
+    int myRouletteDepth;
+    /// Number of rays not traced because of the weight cutoff, and
+    /// because of the russian roulette.
+    long myCutoffRays, myRouletteRays;
+    /// When true, the light going through a transparent material is split
+    /// between its reflected and refracted rays with Fresnel's law
+    /// (Schlick's approximation). Otherwise it is all refracted.
+    bool myFresnel;
+
+    BasicRenderer() : ptrScene( 0 ), ptrBackground( defaultBackground() ), myVerbose( true ),
+        myLightThreshold( 0.003f ), myMaxLights( 0 ), myShadowCache( true ),
+        myShadowCacheQueries( 0 ), myShadowCacheHits( 0 ),
+        myAdaptiveShadows( true ), myShadowTolerance( 0.02f ), myShadowRays( 0 ),
+        myMinWeight( 1.0f / 512.0f ), myRouletteDepth( -1 ),
+        myCutoffRays( 0 ), myRouletteRays( 0 ), myFresnel( false ) {}
+    BasicRenderer( TScene& scene )
+      : ptrScene( &scene ), ptrBackground( defaultBackground() ), myVerbose( true ),
+        myLightThreshold( 0.003f ), myMaxLights( 0 ), myShadowCache( true ),
+        myShadowCacheQueries( 0 ), myShadowCacheHits( 0 ),
+        myAdaptiveShadows( true ), myShadowTolerance( 0.02f ), myShadowRays( 0 ),
+        myMinWeight( 1.0f / 512.0f ), myRouletteDepth( -1 ),
+        myCutoffRays( 0 ), myRouletteRays( 0 ), myFresnel( false ) {}
+    void setScene( TScene& aScene ) { ptrScene = &aScene; }
+    void setBackground( Background& aBackground ) { ptrBackground = &aBackground; }
+    /// Lights the scene with \a environment (0 for none), sampled in \a
+    /// samples directions at each point (see environmentLight).
+    void setEnvironmentLight( const EnvironmentMap* environment, int samples = 16 )
+    {
+      ptrEnvironment       = environment;
+      myEnvironmentSamples = samples;
+    }
+    void setVerbose( bool verbose ) { myVerbose = verbose; }
+    /// Sets the light culling threshold (0 disables culling).
+    void setLightThreshold( Real threshold ) { myLightThreshold = threshold; }
+    /// Sets the maximal number of lights shaded per point (0 means all).
+    void setMaxLights( int nb ) { myMaxLights = nb; }
+    /// Enables or disables the shadow occluder cache.
+    void setShadowCache( bool enabled ) { myShadowCache = enabled; }
+    /// Enables or disables the adaptive sampling of soft shadows.
+    void setAdaptiveShadows( bool enabled ) { myAdaptiveShadows = enabled; }
+    /// Sets the distance below which the shadow probes agree.
+    void setShadowTolerance( Real tolerance ) { myShadowTolerance = tolerance; }
+    /// Sets the weight below which secondary rays are not traced.
+    void setMinWeight( Real weight ) { myMinWeight = weight; }
+    /// Sets the number of bounces beyond which the russian roulette is
+    /// played (-1 disables it).
+    void setRouletteDepth( int depth ) { myRouletteDepth = depth; }
+    /// Enables or disables the Fresnel weighting of transparent materials.
+    void setFresnel( bool enabled ) { myFresnel = enabled; }
+
+    /// Precomputations done once per render. It must be called before
+    /// tracing any ray (the render methods do it).
+    void prepare()
+    {
+      assert( ptrScene != 0 );
+      ptrScene->prepare();
+      myLightCuller.build( ptrScene->myLights, myLightThreshold );
+      myBakedLights.resize( ptrScene->myLights.size() );
+      for ( std::size_t i = 0; i < myBakedLights.size(); ++i )
+        if ( ! ptrScene->myLights[ i ]->bake( myBakedLights[ i ] ) )
+          {
+            myBakedLights[ i ].type    = BakedLight::Unbaked;
+            myBakedLights[ i ].samples = ptrScene->myLights[ i ]->nbSamples();
+            myBakedLights[ i ].shape   = BakedLight::NoShape;
+          }
+      myLastOccluders.assign( ptrScene->myLights.size(), 0 );
+      Vector3 ul = myDirUL / myDirUL.norm();
+      Vector3 ur = myDirUR / myDirUR.norm();
+      myPixelAngle = ( ur - ul ).norm() / std::max( myWidth - 1, 1 );
+      myShadowCacheQueries = myShadowCacheHits = 0;
+      myShadowRays = 0;
+      myCutoffRays = myRouletteRays = 0;
+    }
 
-    Renderer() : ptrScene( 0 ) {}
-    Renderer( Scene& scene ) : ptrScene( &scene ) {}
-    void setScene( rt::Scene& aScene ) { ptrScene = &aScene; }
+    /// The background used when none is given: the sky and checkerboard
+    /// of MyBackground. It is shared by all renderers.
+    static Background* defaultBackground()
+    {
+      static MyBackground background;
+      return &background;
+    }
 
     void setViewBox( Point3 origin,
                      Vector3 dirUL, Vector3 dirUR, Vector3 dirLL, Vector3 dirLR )
@@ -92,30 +248,69 @@ namespace rt {
       myHeight = height;
     }
 
+    /// Sets the view box from a pinhole camera placed at \a eye and
+    /// looking at \a target, with vertical field of view \a fovy (in
+    /// degrees) and the given width/height \a aspect ratio. Used when
+    /// there is no QGLViewer camera to ask for the view box.
+    void setLookAt( Point3 eye, Point3 target, Vector3 up, Real fovy, Real aspect )
+    {
+      Vector3 front = target - eye;
+      front        /= front.norm();
+      Vector3 right = front.cross( up );
+      right        /= right.norm();
+      Vector3 top   = right.cross( front );
+      Real    th    = tan( 0.5f * fovy * M_PI / 180.0f );
+      Vector3 dy    = th * top;
+      Vector3 dx    = ( th * aspect ) * right;
+      setViewBox( eye, front + dy - dx, front + dy + dx,
+                  front - dy - dx, front - dy + dx );
+    }
+
 
     /// The main rendering routine
-    void render( Image2D<Color>& image, int max_depth )
+    /// If \a passes is given, its auxiliary outputs (depth, normal, ...)
+    /// are filled in the same pass. \a image may be any Image2D whose
+    /// values can be assigned a Color (e.g. a MappedImage); it is only
+    /// reallocated if it does not have the size of the render (see
+    /// fitImage).
+    /// @return 'false' if \a image could not be given the size of the
+    /// render (a mapped image of another size): nothing is rendered.
+    template <typename TImage>
+    bool render( TImage& image, int max_depth, RenderPasses* passes = 0 )
     {
-      std::cout << "Rendering into image ... might take a while." << std::endl;
-      image = Image2D<Color>( myWidth, myHeight );
+      if ( ! fitImage( image, myWidth, myHeight ) ) return false;
+      if ( myVerbose )
+        std::cout << "Rendering into image ... might take a while." << std::endl;
+      prepare();
+      if ( passes != 0 ) passes->resize( myWidth, myHeight );
       for ( int y = 0; y < myHeight; ++y )
         {
-          Real    ty   = (Real) y / (Real)(myHeight-1);
-          progressBar( std::cout, ty, 1.0 );
-          Vector3 dirL = (1.0f - ty) * myDirUL + ty * myDirLL;
-          Vector3 dirR = (1.0f - ty) * myDirUR + ty * myDirLR;
-          dirL        /= dirL.norm();
-          dirR        /= dirR.norm();
+          if ( myVerbose ) progressBar( std::cout, (Real) y / (Real)(myHeight-1), 1.0 );
           for ( int x = 0; x < myWidth; ++x )
             {
-              Real    tx   = (Real) x / (Real)(myWidth-1);
-              Vector3 dir  = (1.0f - tx) * dirL + tx * dirR;
-              Ray eye_ray  = Ray( myOrigin, dir, max_depth );
-              Color result = trace( eye_ray );
+              Ray eye_ray  = eyeRay( x, y, max_depth );
+              Color result = trace( eye_ray, passes, x, y );
               image.at( x, y ) = result.clamp();
             }
         }
-      std::cout << "Done." << std::endl;
+      if ( myVerbose ) std::cout << "Done." << std::endl;
+      return true;
+    }
+
+    /// Renders the pixels [x0,x0+w) x [y0,y0+h) of the image into \a
+    /// tile (of size w x h), with the same rays as render(). prepare()
+    /// must have been called before. The random generator is reseeded
+    /// from the position of the tile, so that the stochastic choices
+    /// (sampled lights, soft shadows, roulette) of different tiles are
+    /// not correlated, and do not depend on the process rendering them.
+    void renderTile( Image2D<Color>& tile, int x0, int y0, int w, int h, int max_depth )
+    {
+      std::seed_seq seed{ x0, y0 };
+      myRandom.seed( seed );
+      tile = Image2D<Color>( w, h );
+      for ( int y = y0; y < y0 + h; ++y )
+        for ( int x = x0; x < x0 + w; ++x )
+          tile.at( x - x0, y - y0 ) = trace( eyeRay( x, y, max_depth ) ).clamp();
     }
 
     // Affiche les sources de lumières avant d'appeler la fonction qui
@@ -123,14 +318,14 @@ namespace rt {
     Color background( const Ray& ray )
     {
       Color result = Color( 0.0, 0.0, 0.0 );
-      for ( auto* light : ptrScene->myLights )
+      for ( int i : myLightCuller.lightsAt( ray.origin ) )
         {
-          Real cos_a = light->direction( ray.origin ).dot( ray.direction );
+          Real cos_a = lightDirection( i, ray.origin ).dot( ray.direction );
           if ( cos_a > 0.99f )
             {
               Real a = acos( cos_a ) * 360.0 / M_PI / 8.0;
               a = std::max( 1.0f - a, 0.0f );
-              result += light->color( ray.origin ) * a * a;
+              result += lightColor( i, ray.origin ) * a * a;
             }
         }
       if ( ptrBackground != 0 ) result += ptrBackground->backgroundColor( ray );
@@ -138,70 +333,280 @@ namespace rt {
     }
 
 
-    /// The rendering routine for one ray.
+    /// @return the eye ray going through pixel (x,y), traced by render()
+    /// and renderTile().
+    Ray eyeRay( int x, int y, int max_depth ) const
+    {
+      Real    ty   = (Real) y / (Real)(myHeight-1);
+      Vector3 dirL = (1.0f - ty) * myDirUL + ty * myDirLL;
+      Vector3 dirR = (1.0f - ty) * myDirUR + ty * myDirLR;
+      dirL        /= dirL.norm();
+      dirR        /= dirR.norm();
+      Real    tx   = (Real) x / (Real)(myWidth-1);
+      return Ray( myOrigin, (1.0f - tx) * dirL + tx * dirR, max_depth );
+    }
+
+    /// The rendering routine for one ray. If \a passes is given (eye
+    /// ray of pixel (x,y)), what the ray hits first is recorded into it.
     /// @return the color for the given ray.
-    Color trace( const Ray& ray )
+    Color trace( const Ray& ray, RenderPasses* passes = 0, int x = 0, int y = 0 )
     {
         assert( ptrScene != 0 );
-        ptrBackground = new MyBackground();
-        Color result = Color(0,0,0);
         GraphicalObject* obj_i = 0;
-        Point3 p_i;
-        Real ri = ptrScene->rayIntersection(ray, obj_i, p_i);
+        Real t;
         // if no intersection
-        if (ri > 0.0f){
+        if ( ! ptrScene->intersect( ray, ray.t_min, std::numeric_limits< Real >::max(), obj_i, t ) ){
+            if ( passes != 0 ) passes->setBackground( x, y );
             return background(ray);
         }
         // else
-        Material m = obj_i->getMaterial(p_i);
+        Point3   p_i = ray.origin + t * ray.direction;
+        Material m   = material( obj_i, p_i );
+        if ( passes != 0 ){
+            Vector3 n = obj_i->getNormal( p_i );
+            passes->depth.at( x, y )    = t;
+            passes->normal.at( x, y )   = n / n.norm();
+            passes->objectId.at( x, y ) = obj_i->sceneIndex;
+            passes->albedo.at( x, y )   = m.diffuse;
+        }
+        return shade( ray, obj_i, p_i, m );
+    }
+
+    /// @return the material of \a obj at \a p, its texture being
+    /// filtered over the width of a pixel seen at the distance of \a p
+    /// from the camera. Without ray differentials, this footprint ignores
+    /// the magnification of curved mirrors and lenses.
+    Material material( GraphicalObject* obj, const Point3& p ) const
+    {
+      return obj->getMaterial( p, myPixelAngle * distance( myOrigin, p ) );
+    }
+
+    /// Computes the color seen by \a ray, knowing that it hits object
+    /// \a obj_i at point \a p_i first (reflections, refractions and
+    /// lighting).
+    Color shade( const Ray& ray, GraphicalObject* obj_i, Point3 p_i )
+    {
+        return shade( ray, obj_i, p_i, material( obj_i, p_i ) );
+    }
+
+    /// Same as above, \a m being the material of \a obj_i at \a p_i.
+    Color shade( const Ray& ray, GraphicalObject* obj_i, Point3 p_i, const Material& m )
+    {
+        Color result = Color(0,0,0);
+        // Le rayon refracte est calcule d'abord, pour connaitre la part
+        // de lumiere reflechie (coefficient de Fresnel) si besoin.
+        Real fresnel = 0.0f;
+        Ray  ray_refr;
+        bool refracts = ray.depth > 0 && m.coef_refraction != 0;
+        if(refracts)
+            ray_refr = refractionRay(ray, obj_i, p_i, obj_i->getNormal(p_i), m,
+                                     myFresnel ? &fresnel : 0);
         // Reflexion
-        if(ray.depth > 0 && m.coef_reflexion != 0){
+        if(ray.depth > 0 && m.coef_reflexion + fresnel != 0){
             Vector3 vector_refl = reflect(ray.direction,obj_i->getNormal(p_i));
-            Ray ray_refl = Ray(p_i + vector_refl * 0.01f,vector_refl,ray.depth-1);
-            Color c_refl = trace(ray_refl);
-            result += c_refl * m.specular * m.coef_reflexion;
+            Ray ray_refl = Ray(p_i,vector_refl,ray.depth-1,Ray::Normalized());
+            ray_refl.leaveFrom(obj_i);
+            Color coef = reflectionCoef( m, fresnel );
+            Real  k    = spawn( ray, coef, ray_refl );
+            if ( k > 0.0f ) result += trace(ray_refl) * coef * k;
         }
         //Refraction :
-        if(ray.depth > 0 && m.coef_refraction != 0){
-            Ray ray_refr = refractionRay(ray, p_i, obj_i->getNormal(p_i),m);
-            Color c_refr = trace(ray_refr);
-            result += c_refr * m.diffuse * m.coef_refraction;
+        if(refracts && fresnel < 1.0f){
+            Color coef = refractionCoef( m, fresnel );
+            Real  k    = spawn( ray, coef, ray_refr );
+            if ( k > 0.0f ) result += trace(ray_refr) * coef * k;
         }
 
         if(ray.depth != 0)
-            result += illumination(ray, obj_i, p_i) * m.coef_diffusion;
+            result += illumination(ray, obj_i, p_i, m) * m.coef_diffusion;
         else
-            result += illumination(ray, obj_i, p_i);
+            result += illumination(ray, obj_i, p_i, m);
 
         return result;
     }
 
 
-    /// Calcule l'illumination de l'objet obj au point p, sachant que l'observateur est le rayon ray.
-    Color illumination( const Ray& ray, GraphicalObject* obj, Point3 p ){
-        Color result = Color( 0.0, 0.0, 0.0 );
+    /// @return the factor of the color of the reflected ray on material
+    /// \a m, where \a fresnel is the part of the transmitted light that
+    /// is reflected instead (0 without Fresnel weighting).
+    Color reflectionCoef( const Material& m, Real fresnel ) const
+    {
+      return m.specular * ( m.coef_reflexion + fresnel * m.coef_refraction );
+    }
 
-        for(auto& l : ptrScene->myLights){    // Pour chaque source de lumiere
+    /// @return the factor of the color of the refracted ray on material
+    /// \a m (see reflectionCoef).
+    Color refractionCoef( const Material& m, Real fresnel ) const
+    {
+      return m.diffuse * ( m.coef_refraction * ( 1.0f - fresnel ) );
+    }
 
-            // On calcule le coefficient de diffusion associé
-            Real coeffDiff = l->direction(p).dot(obj->getNormal(p));
-            if (coeffDiff < 0)
-                coeffDiff = 0;
-            result += coeffDiff*obj->getMaterial(p).diffuse*l->color(p);
+    /// Prepares the secondary ray \a child of \a parent, whose color is
+    /// weighted by \a coef, and decides whether it is traced: not when
+    /// its weight falls below myMinWeight, nor when it loses the russian
+    /// roulette.
+    ///
+    /// @return 0 if the ray is not traced, otherwise the factor by which
+    /// its color must be multiplied (1, or more after the roulette).
+    Real spawn( const Ray& parent, const Color& coef, Ray& child )
+    {
+      child.weight  = parent.weight * coef.max();
+      child.bounces = parent.bounces + 1;
+      if ( child.weight < myMinWeight ) { ++myCutoffRays; return 0.0f; }
+      if ( myRouletteDepth < 0 || child.bounces <= myRouletteDepth ) return 1.0f;
+      Real q = std::min( 1.0f, child.weight );
+      std::uniform_real_distribution< Real > uniform( 0.0f, 1.0f );
+      if ( uniform( myRandom ) >= q ) { ++myRouletteRays; return 0.0f; }
+      child.weight /= q;
+      return 1.0f / q;
+    }
 
-            // ainsi que la couleur spéculaire associée
-            Vector3 W = reflect(ray.direction, obj->getNormal(p));
-            Real cosBeta = l->direction(p).dot(W);
-            if(cosBeta >= 0){
-                Real coeffSpec = powf(cosBeta, obj->getMaterial(p).shinyness);
-                result += coeffSpec*obj->getMaterial(p).specular*l->color(p);
-            }
+    /// Calcule l'illumination de l'objet obj au point p, de materiau m, sachant que l'observateur est le rayon ray.
+    Color illumination( const Ray& ray, GraphicalObject* obj, Point3 p, const Material& m ){
+        Color    result = Color( 0.0, 0.0, 0.0 );
+        Vector3  N      = obj->getNormal( p );
+        Vector3  W      = reflect( ray.direction, N );
+
+        // Seules les lumieres de la region de p sont considerees, et
+        // eventuellement seulement quelques-unes choisies au hasard.
+        const std::vector< int >& candidates = myLightCuller.lightsAt( p );
+        if ( myMaxLights > 0 && (int) candidates.size() > myMaxLights )
+          {
+            myLightEstimates.clear();
+            for ( int i : candidates )
+              {
+                Real cos_n = std::max( 0.0f, lightDirection( i, p ).dot( N ) );
+                myLightEstimates.push_back( lightColor( i, p ).max() * ( 0.1f + cos_n ) );
+              }
+            LightCuller::select( candidates, myLightEstimates, myMaxLights, myRandom,
+                                 myChosenLights );
+            for ( auto& li : myChosenLights )
+                result += lightContribution( li.first, li.second, m, N, W, obj, p );
+          }
+        else
+          for ( int i : candidates )    // Pour chaque source de lumiere
+              result += lightContribution( i, 1.0f, m, N, W, obj, p );
+        if ( ptrEnvironment != 0 )
+            result += environmentLight( m, N, W, obj, p );
+        result += m.ambient;    // on ajoute la couleur ambiante
 
-            // et enfin les ombres
-            result = result * shadow(Ray(p,l->direction(p)), l->color(p));
+        return result;
+    }
+
+    /// Calcule la contribution de la lumiere \a light (ponderee par \a
+    /// weight) au point p de l'objet obj, de materiau m, de normale N et
+    /// de direction reflechie W, ombres comprises.
+    Color lightContribution( int light, Real weight, const Material& m,
+                             const Vector3& N, const Vector3& W,
+                             GraphicalObject* obj, const Point3& p ){
+        Color light_color = lightColor( light, p ) * weight;
+        if ( light_color.max() < myLightThreshold ) return Color( 0.0, 0.0, 0.0 );
+
+        // Contribution sans ombre: si elle est negligeable (lumiere
+        // derriere l'objet par exemple), on ne lance pas de rayon d'ombre.
+        Vector3 L    = lightDirection( light, p );
+        Color   refl = reflectance( m, N, W, L );
+        if ( ( refl * light_color ).max() <= myLightThreshold ) return Color( 0.0, 0.0, 0.0 );
+
+        // Sinon la lumiere est attenuee par les objets qui la cachent.
+        if ( myBakedLights[ light ].samples > 1 )
+            return refl * softShadow( light, p, light_color, obj );
+        Ray ray( p, L, 1, Ray::Normalized() );
+        ray.leaveFrom( obj );
+        return refl * shadow( ray, light_color, light );
+    }
+
+    /// Estime la lumiere recue de la carte d'environnement au point p de
+    /// l'objet obj (voir lightContribution). Les myEnvironmentSamples
+    /// directions sont tirees proportionnellement a la luminance de la
+    /// carte (EnvironmentMap::sample), stratifiees selon la latitude, et
+    /// chacune est ponderee par la reflectance sur sa densite puis
+    /// testee par un rayon d'ombre. La reflectance est divisee par pi:
+    /// une carte uniforme de couleur c eclaire une surface diffuse comme
+    /// une lumiere de couleur c dans la direction de sa normale.
+    Color environmentLight( const Material& m, const Vector3& N, const Vector3& W,
+                            GraphicalObject* obj, const Point3& p ){
+        std::uniform_real_distribution< Real > uniform( 0.0f, 1.0f );
+        int   n      = myEnvironmentSamples;
+        Color result( 0.0, 0.0, 0.0 );
+        for ( int k = 0; k < n; ++k ) {
+            Vector3 L;
+            Real    u   = ( k + uniform( myRandom ) ) / n;
+            Real    pdf = ptrEnvironment->sample( u, uniform( myRandom ), L );
+            if ( pdf <= 0.0f ) continue;
+            Color refl = reflectance( m, N, W, L ) * ( 1.0f / ( M_PI * pdf * n ) );
+            if ( refl.max() == 0.0f ) continue;
+            Ray ray( p, L, 1, Ray::Normalized() );
+            ray.leaveFrom( obj );
+            result += refl * shadow( ray, ptrEnvironment->radiance( L ) );
         }
-        result += obj->getMaterial(p).ambient;    // on ajoute la couleur ambiante
+        return result;
+    }
 
+    /// @return la direction unitaire de p vers la lumiere d'indice i,
+    /// lue dans myBakedLights si elle a pu etre figee.
+    Vector3 lightDirection( int i, const Point3& p ) const {
+        const BakedLight& b = myBakedLights[ i ];
+        return b.type != BakedLight::Unbaked ? b.direction( p )
+                                             : ptrScene->myLights[ i ]->direction( p );
+    }
+
+    /// @return la couleur de la lumiere d'indice i vue de p (voir
+    /// lightDirection).
+    Color lightColor( int i, const Point3& p ) const {
+        const BakedLight& b = myBakedLights[ i ];
+        return b.type != BakedLight::Unbaked ? b.color( p )
+                                             : ptrScene->myLights[ i ]->color( p );
+    }
+
+    /// Calcule la couleur de la lumiere etendue d'indice light recue au
+    /// point p: c'est la moyenne des ombres vers ses echantillons
+    /// stratifies (tires de sa forme figee si elle en a une, voir
+    /// BakedLight::sample). En mode adaptatif, les premiers echantillons
+    /// servent de sondes: s'ils concordent (a myShadowTolerance pres, par
+    /// exemple tous eclaires ou tous dans l'ombre), p n'est pas dans la
+    /// penombre et leur moyenne est retournee. Si p est sur l'objet obj,
+    /// les rayons d'ombre partent de sa surface.
+    Color softShadow( int light, const Point3& p, Color light_color,
+                      GraphicalObject* obj = 0 ){
+        std::uniform_real_distribution< Real > uniform( 0.0f, 1.0f );
+        const BakedLight& b = myBakedLights[ light ];
+        int   n      = b.samples;
+        int   probes = myAdaptiveShadows ? std::min( SHADOW_PROBES, n ) : n;
+        Color result( 0.0, 0.0, 0.0 );
+        Color first;
+        bool  agree  = true;
+        for ( int k = 0; k < n; ++k ) {
+            if ( k == probes && agree )
+                return result * ( 1.0f / probes );
+            Vector3 L;
+            Real    d;
+            Real    u = uniform( myRandom );
+            Real    v = uniform( myRandom );
+            if ( b.shape != BakedLight::NoShape ) b.sample( p, k, u, v, L, d );
+            else ptrScene->myLights[ light ]->sample( p, k, u, v, L, d );
+            Ray ray( p, L, 1, Ray::Normalized() );
+            if ( obj != 0 ) ray.leaveFrom( obj );
+            Color c = shadow( ray, light_color, light, d );
+            if ( k == 0 ) first = c;
+            else if ( k < probes && distance( c, first ) > myShadowTolerance ) agree = false;
+            result += c;
+        }
+        return result * ( 1.0f / n );
+    }
+
+    /// Calcule la fraction de la lumiere venant de la direction L qui est
+    /// renvoyee vers l'observateur (composantes diffuse et speculaire),
+    /// pour la normale N et la direction reflechie W du rayon incident.
+    Color reflectance( const Material& m, const Vector3& N, const Vector3& W,
+                       const Vector3& L ) const {
+        // On calcule le coefficient de diffusion associé
+        Real  coeffDiff = std::max( 0.0f, L.dot( N ) );
+        Color result    = coeffDiff * m.diffuse;
+        // ainsi que la couleur spéculaire associée
+        Real cosBeta = L.dot( W );
+        if ( cosBeta >= 0 )
+            result += powf( cosBeta, m.shinyness ) * m.specular;
         return result;
     }
 
@@ -214,22 +619,48 @@ namespace rt {
     /// direction donnée par le rayon. Si aucun objet n'est traversé,
     /// retourne light_color, sinon si un des objets traversés est opaque,
     /// retourne du noir, et enfin si les objets traversés sont
-    /// transparents, attenue la couleur.
-    Color shadow( const Ray& ray, Color light_color ){
-        Point3 p = ray.origin;
+    /// transparents, attenue la couleur. Si \a light est l'indice de la
+    /// lumiere, le dernier objet opaque l'ayant cachee est teste en premier.
+    /// Seuls les objets a une distance inferieure a \a max_distance (celle
+    /// de la lumiere) sont pris en compte. Le rayon repart de chaque
+    /// objet transparent traverse en l'excluant (voir Ray::leaveFrom).
+    Color shadow( const Ray& ray, Color light_color, int light = -1,
+                  Real max_distance = std::numeric_limits< Real >::infinity() ){
+        ++myShadowRays;
         GraphicalObject* object = 0; // pointer to the intersected object
-        Point3           p2;         // point of intersection
-
+        Real             t;          // distance to the intersection
+
+        bool cached = myShadowCache && light >= 0
+          && light < (int) myLastOccluders.size();
+        if ( cached && myLastOccluders[ light ] != 0 ) {
+            ++myShadowCacheQueries;
+            GraphicalObject* occluder = myLastOccluders[ light ];
+            if ( occluder->intersect( ray, ray.t_min, max_distance, t ) ) {
+                Material m = occluder->getMaterial( ray.origin + t * ray.direction );
+                if ( ( m.diffuse * m.coef_refraction ).max() == 0.0f ) {
+                    ++myShadowCacheHits;
+                    return Color( 0.0, 0.0, 0.0 );
+                }
+            }
+        }
+        // Le cache est mis a jour par la recherche complete
+        if ( cached ) myLastOccluders[ light ] = 0;
 
+        Ray  newRay    = ray; // meme direction, inverse comprise
+        Real travelled = 0.0f;
         while(light_color.max() > 0.003f){
-            //on déplace légèrement p vers la source de lumière
-            p += 0.01f * ray.direction;
-            Ray newRay = Ray(p, ray.direction);
-            //Si intersection
-            if (ptrScene->rayIntersection(newRay, object, p2) <= 0){
-                Material m = object->getMaterial(p2);
+            //Si intersection avant la lumiere
+            if (ptrScene->intersect(newRay, newRay.t_min, max_distance - travelled,
+                                    object, t)){
+                newRay.origin = newRay.origin + t * ray.direction;
+                travelled    += t;
+                Material m = object->getMaterial(newRay.origin);
                 light_color = light_color * m.diffuse * m.coef_refraction;
-                p = p2;
+                // on repart de l'objet traverse
+                newRay.leaveFrom(object);
+                // Seuls les objets opaques sont memorises
+                if ( cached && light_color.max() == 0.0f )
+                    myLastOccluders[ light ] = object;
             }
             else{
                 break;
@@ -238,55 +669,46 @@ namespace rt {
         return light_color;
     }
 
-    /// Calcule le rayon réfracté a aRay sur le materiau au point p
-    Ray refractionRay( const Ray& aRay, const Point3& p, Vector3 N, const Material& m ){
-
-        Real tmp;
+    /// Calcule le rayon réfracté a aRay sur le materiau au point p. Si
+    /// \a reflectance est donne, il recoit la part de lumiere reflechie
+    /// (approximation de Schlick), 1 en cas de reflexion totale. Le rayon
+    /// part de la surface de l'objet obj, sur lequel est p.
+    Ray refractionRay( const Ray& aRay, GraphicalObject* obj, const Point3& p,
+                       Vector3 N, const Material& m,
+                       Real* reflectance = 0 ){
         Vector3 v = aRay.direction;
-        Real c = -1 * N.dot(v);
-        Real r;
-        //Si le rayon vient de l'exterieur de l'objet
-        if(v.dot(N) <= 0){
-            r = m.out_refractive_index/m.in_refractive_index;
-        }
-        //Sinon
-        else{
-            r = m.in_refractive_index/m.out_refractive_index;
-        }
-
-        if(c>0)
-            tmp = r*c - sqrt(1 - ((r*r) * (1 - (c*c))) );
-        else {
-            tmp = r*c + sqrt(1 - ((r*r) * (1 - (c*c))) );
-        }
-
-        Vector3 vRefract = Vector3(r*v + tmp * N);
-
-        // Cas de la reflexion totale
-        if( 1 - ( (r*r) * (1 - (c*c) )) < 0) {
+        //Si le rayon vient de l'exterieur de l'objet, sinon on se place
+        //de l'autre cote de la surface
+        bool    entering = v.dot(N) <= 0;
+        Vector3 n        = entering ? N : -1.0f * N;
+        Real    r        = entering ? m.entering_ratio : m.leaving_ratio;
+
+        // Cas de la reflexion totale, teste d'abord
+        Vector3 vRefract;
+        Real    cos_t;
+        if( ! refract( v, n, r, vRefract, cos_t ) ) {
             vRefract = reflect(v,N);
+            if ( reflectance != 0 ) *reflectance = 1.0f;
         }
+        else if ( reflectance != 0 )
+            *reflectance = schlick( r, -n.dot( v ), cos_t );
 
-        return Ray(p + vRefract * 0.01f, vRefract,aRay.depth-1);
+        Ray ray_refr(p, vRefract,aRay.depth-1,Ray::Normalized());
+        ray_refr.leaveFrom(obj);
+        return ray_refr;
     }
 
     void randomRender( Image2D<Color>& image, int max_depth )
         {
           std::cout << "Rendering into image ... might take a while." << std::endl;
+          prepare();
           image = Image2D<Color>( myWidth, myHeight );
           for ( int y = 0; y < myHeight; ++y )
           {
-              Real    ty   = (Real) y / (Real)(myHeight-1);
-              progressBar( std::cout, ty, 1.0 );
-              Vector3 dirL = (1.0f - ty) * myDirUL + ty * myDirLL;
-              Vector3 dirR = (1.0f - ty) * myDirUR + ty * myDirLR;
-              dirL        /= dirL.norm();
-              dirR        /= dirR.norm();
+              progressBar( std::cout, (Real) y / (Real)(myHeight-1), 1.0 );
               for ( int x = 0; x < myWidth; ++x )
               {
-                  Real    tx   = (Real) x / (Real)(myWidth-1);
-                  Vector3 dir  = (1.0f - tx) * dirL + tx * dirR;
-                  Ray eye_ray  = Ray( myOrigin, dir, max_depth );
+                  Ray eye_ray  = eyeRay( x, y, max_depth );
 
                   Color moyenne = Color( 0, 0, 0 );
                   Real ecart = 1.0;
@@ -303,7 +725,8 @@ namespace rt {
 
   };
 
-
+  /// The renderer of scenes of arbitrary objects.
+  typedef BasicRenderer< Scene > Renderer;
 
 } // namespace rt
 
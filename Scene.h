@@ -7,9 +7,11 @@
 #define _SCENE_H_
 
 #include <cassert>
+#include <limits>
 #include <vector>
 #include "GraphicalObject.h"
 #include "Light.h"
+#include "UniformGrid.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -24,10 +26,27 @@ namespace rt {
   */
 
   struct Scene {
+    /// The ways of finding the object intersected by a ray.
+    enum Acceleration {
+      Linear, ///< every object is tested (default).
+      Grid    ///< a uniform grid traversed by 3D-DDA, see rt::UniformGrid.
+    };
+
     /// The list of lights modelled as a vector.
     std::vector< Light* > myLights;
     /// The list of objects modelled as a vector.
     std::vector< GraphicalObject* > myObjects;
+    /// The acceleration used by rayIntersection.
+    Acceleration myAcceleration = Linear;
+    /// The grid (used if myAcceleration == Grid).
+    UniformGrid myGrid;
+    /// 'true' when the acceleration structure must be rebuilt by prepare().
+    bool myDirty = true;
+    /// Incremented at each edit of the objects (see objectsChanged).
+    unsigned long myObjectsVersion = 0;
+    /// Incremented when lights are added. The edits of a light are counted
+    /// by its own Light::version (see lightChanged).
+    unsigned long myLightsVersion = 0;
 
     /// Default constructor. Nothing to do.
     Scene() = default;
@@ -68,36 +87,131 @@ namespace rt {
     /// Adds a new object to the scene.
     void addObject( GraphicalObject* anObject )
     {
+      anObject->sceneIndex = (int) myObjects.size();
       myObjects.push_back( anObject );
+      myDirty = true;
+      ++myObjectsVersion;
+    }
+
+    /// Tells the scene that some of its objects were edited (geometry or
+    /// material), so that the renders kept by a RenderCache are traced
+    /// again. addObject() and refit() do it.
+    void objectsChanged() { ++myObjectsVersion; }
+
+    /// Tells the scene that the light of index \a i (in myLights) was
+    /// edited, so that the renders kept by a RenderCache are relit.
+    /// PointLight does it when it is moved by its manipulator.
+    void lightChanged( int i ) { ++myLights[ i ]->version; }
+
+    /// Chooses how rayIntersection finds the closest object.
+    void setAcceleration( Acceleration acceleration )
+    {
+      if ( acceleration != myAcceleration ) myDirty = true;
+      myAcceleration = acceleration;
+    }
+
+    /// Builds the acceleration structure if needed, with \a nb_threads
+    /// threads (0: all hardware threads). Must be called after the
+    /// objects have been added or moved, and before rayIntersection (the
+    /// renderer does it at the beginning of each render).
+    void prepare( int nb_threads = 0 )
+    {
+      if ( ! myDirty ) return;
+      if ( myAcceleration == Grid ) myGrid.build( myObjects, nb_threads );
+      myDirty = false;
+    }
+
+    /// Tells the scene that the objects of indices \a moved (in
+    /// myObjects) have moved. The acceleration structure is refitted
+    /// rather than rebuilt, see UniformGrid::refit.
+    void refit( const std::vector< int >& moved, int nb_threads = 0 )
+    {
+      objectsChanged();
+      if ( myDirty || myAcceleration != Grid ) return;
+      myGrid.refit( myObjects, moved, nb_threads );
     }
 
     /// Adds a new light to the scene.
     void addLight( Light* aLight )
     {
       myLights.push_back( aLight );
+      ++myLightsVersion;
+    }
+
+    /// @return a new copy of the scene, whose objects and lights are
+    /// cloned, with the same acceleration. It is rendered while this
+    /// scene keeps being drawn and edited (e.g. by the viewer, whose
+    /// manipulators move the lights), so that the render sees the scene
+    /// as it was when it started. The caller owns it. It has the same
+    /// versions as this scene, so that a RenderCache may go on from a
+    /// render of a previous snapshot.
+    Scene* snapshot() const
+    {
+      Scene* copy = new Scene;
+      for ( const GraphicalObject* obj : myObjects )
+        copy->addObject( obj->clone() );
+      for ( const Light* light : myLights )
+        copy->addLight( light->clone() );
+      copy->setAcceleration( myAcceleration );
+      copy->myObjectsVersion = myObjectsVersion;
+      copy->myLightsVersion  = myLightsVersion;
+      return copy;
     }
     
     /// returns the closest object intersected by the given ray.
+    ///
+    /// @return -d^2 if it hits object at point p, at distance d, or a
+    /// positive value if it hits nothing. Hits closer than ray.t_min
+    /// are ignored.
     Real rayIntersection( const Ray& ray, GraphicalObject*& object, Point3& p ) {
+        Real t;
+        if ( ! intersect( ray, ray.t_min, std::numeric_limits<Real>::max(), object, t ) )
+          return std::numeric_limits<Real>::max();
+        p = ray.origin + t * ray.direction;
+        return -t * t;
+    }
+
+    /// Finds the closest object hit by the ray at a parameter t in
+    /// [t_min,t_max] (see GraphicalObject::intersect): each hit shrinks
+    /// the interval, so that the next objects only need to be tested
+    /// against closer hits.
+    ///
+    /// @return 'true' iff there is one, then given by \a object and \a t.
+    bool intersect( const Ray& ray, Real t_min, Real t_max,
+                    GraphicalObject*& object, Real& t ) {
+        if ( myAcceleration == Grid )
+          return gridIntersect( ray, t_min, t_max, object, t );
+        object = nullptr;
+        // On fait une boucle sur tout les objets de scène, l'intervalle
+        // se reduisant a chaque intersection trouvee
+        for ( auto& o : this->myObjects )
+            if ( o->intersect( ray, t_min, t_max, t_max ) )
+                object = o;
+        t = t_max;
+        return object != nullptr;
+    }
+
+    /// Same as intersect, but only the objects of the grid cells
+    /// crossed by the ray (and the unbounded objects) are tested.
+    bool gridIntersect( const Ray& ray, Real t_min, Real t_max,
+                        GraphicalObject*& object, Real& t ) {
+        assert( ! myDirty );
         object = nullptr;
-        Point3 pointTemp;
-        Real distance = std::numeric_limits<Real>::max();
-
-        // On fait une boucle sur tout les objets de scène
-        for (auto& o : this->myObjects ) {
-            if (o->rayIntersection(ray, pointTemp) <= 0){
-                // On calcule la distance entre l'origine du rayon et le point d'intersection avec l'objet (au carré bien sur)
-                Real distanceTemp = (pointTemp - ray.origin).dot(pointTemp - ray.origin);
-                // si cette distance est plus courte que la précédente, l'objet courant devient l'objet intersecté
-                if (distanceTemp < distance){
-                    distance = distanceTemp;
-                    object = o;
-                    p = pointTemp;
-                }
-            }
-        }
-
-        return distance != std::numeric_limits<Real>::max() ? -distance : distance;
+        auto test = [&] ( GraphicalObject* o ) {
+            if ( o->intersect( ray, t_min, t_max, t_max ) ) object = o;
+        };
+        for ( int i : myGrid.unbounded() ) test( myObjects[ i ] );
+        for ( int i : myGrid.loose() )     test( myObjects[ i ] );
+        // Cells are visited front to back: stop once the closest hit is
+        // inside the current cell, or the cells are beyond t_max.
+        myGrid.traverse( ray, [&] ( unsigned int first, unsigned int last, Real t_exit ) {
+            for ( unsigned int k = first; k < last; ++k )
+              if ( ! myGrid.isLoose( myGrid.object( k ) ) )
+                test( myObjects[ myGrid.object( k ) ] );
+            return t_max <= t_exit;
+          } );
+        t = t_max;
+        return object != nullptr;
     }
 
   private:
@@ -1,12 +1,15 @@
 /**
 @file Sphere.cpp
 */
+#include <algorithm>
 #include <cmath>
 #include "Sphere.h"
+#include "Texture.h"
 
 void
 rt::Sphere::draw( Viewer& /* viewer */ )
 {
+#ifndef RT_HEADLESS
   Material m = material;
   // Taking care of south pole
   glBegin( GL_TRIANGLE_FAN );
@@ -59,6 +62,7 @@ rt::Sphere::draw( Viewer& /* viewer */ )
       glVertex3fv( p );
     }
   glEnd();
+#endif // #ifndef RT_HEADLESS
 }
 
 rt::Point3
@@ -82,12 +86,33 @@ rt::Sphere::getNormal( Point3 p )
   return u;
 }
 
+void
+rt::Sphere::textureCoordinates( Point3 p, Real& u, Real& v ) const
+{
+  Vector3 d = ( p - center ) / radius;
+  u = atan2( d[ 1 ], d[ 0 ] ) / ( 2.0 * M_PI );
+  if ( u < 0.0f ) u += 1.0f;
+  v = 0.5f - asin( std::max( -1.0f, std::min( 1.0f, d[ 2 ] ) ) ) / M_PI;
+}
+
 rt::Material
 rt::Sphere::getMaterial( Point3 /* p */ )
 {
   return material; // the material is constant along the sphere.
 }
 
+rt::Material
+rt::Sphere::getMaterial( Point3 p, Real footprint )
+{
+  if ( material.texture == nullptr || ! material.texture->isValid() ) return material;
+  Real u, v;
+  textureCoordinates( p, u, v );
+  // The footprint, as a fraction of the equator.
+  Material m = material;
+  m.diffuse  = m.diffuse * material.texture->lookup( u, v, footprint / ( 2.0f * M_PI * radius ) );
+  return m;
+}
+
 rt::Real
 rt::Sphere::rayIntersection( const Ray& ray, Point3& p )
 {
@@ -124,3 +149,43 @@ rt::Sphere::rayIntersection( const Ray& ray, Point3& p )
 
   return distanceBoule;
 }
+
+bool
+rt::Sphere::intersect( const Ray& ray, Real t_min, Real t_max, Real& t )
+{
+  Vector3 oc = ray.origin - center;
+  Real    h  = oc.dot( ray.direction );
+  // Leaving the sphere: the origin is one root, the other is -2h, and
+  // is ahead only when the ray goes inside.
+  if ( ray.exclude == this )
+    {
+      Real far = -2.0f * h;
+      if ( far < t_min || far > t_max ) return false;
+      t = far;
+      return true;
+    }
+  Real    c  = oc.dot( oc ) - radius2;
+  // Origin outside and sphere behind: no hit, without any sqrt.
+  if ( c > 0.0f && h > 0.0f ) return false;
+  Real disc = h * h - c;
+  if ( disc < 0.0f ) return false;
+  Real s    = std::sqrt( disc );
+  Real near = -h - s;
+  if ( near > t_max ) return false;
+  if ( near < t_min )
+    {
+      near = -h + s;
+      if ( near < t_min || near > t_max ) return false;
+    }
+  t = near;
+  return true;
+}
+
+bool
+rt::Sphere::boundingBox( Point3& low, Point3& high )
+{
+  Vector3 r( radius, radius, radius );
+  low  = center - r;
+  high = center + r;
+  return true;
+}
@@ -22,13 +22,18 @@ namespace rt {
 
     /// Creates a sphere of center \a xc and radius \a r.
     Sphere( Point3 xc, Real r, const Material& m  )
-      : GraphicalObject(), center( xc ), radius( r ), material( m )
+      : GraphicalObject(), center( xc ), radius( r ), radius2( r * r ), material( m )
     {}
 
     /// Given latitude and longitude in degrees, returns the point on
     /// the sphere at these coordinates.
     Point3 localize( Real latitude, Real longitude ) const;
 
+    /// Inverse of localize: gives the texture coordinates (u,v) in
+    /// [0,1)^2 of point \a p, u growing with the longitude (0 at the x
+    /// axis) and v going from the north pole (0) to the south pole (1).
+    void textureCoordinates( Point3 p, Real& u, Real& v ) const;
+
     // ---------------- GraphicalObject services ----------------------------
   public:
 
@@ -49,6 +54,10 @@ namespace rt {
     /// @return the material associated to this part of the object
     Material getMaterial( Point3 p );
 
+    /// @return the material at \a p, whose diffuse color is modulated
+    /// by the texture of the material, if any.
+    Material getMaterial( Point3 p, Real footprint );
+
     /// @param[in] ray the incoming ray
     /// @param[out] returns the point of intersection with the object
     /// (if any), or the closest point to it.
@@ -57,11 +66,29 @@ namespace rt {
     /// kind of distance to the closest point of intersection.
     Real rayIntersection( const Ray& ray, Point3& p );
 
+    GraphicalObject* clone() const { return new Sphere( *this ); }
+
+    /// Geometric ("half-b") intersection: with a unitary direction d and
+    /// oc = origin - center, the hits are at t = -h -/+ sqrt(h^2 - c)
+    /// with h = oc.d and c = oc.oc - radius^2.
+    bool intersect( const Ray& ray, Real t_min, Real t_max, Real& t );
+
+    /// The box [center-radius,center+radius].
+    bool boundingBox( Point3& low, Point3& high );
+
+    /// Moves the center by \a t.
+    void translate( const Vector3& t ) { center += t; }
+
+    /// Changes the radius.
+    void setRadius( Real r ) { radius = r; radius2 = r * r; }
+
   public:
     /// The center of the sphere
     Point3 center;
-    /// The radius of the sphere
+    /// The radius of the sphere (see setRadius).
     Real radius;
+    /// The squared radius.
+    Real radius2;
     /// The material (global to the sphere).
     Material material;
   };
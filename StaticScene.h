@@ -0,0 +1,144 @@
+/**
+@file StaticScene.h
+*/
+#pragma once
+#ifndef _STATIC_SCENE_H_
+#define _STATIC_SCENE_H_
+
+#include <cassert>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "GraphicalObject.h"
+#include "Light.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A scene whose objects belong to a closed set of types known at
+  compile time, e.g. StaticScene< Sphere >. The objects of each type are
+  stored by value in their own contiguous vector, and the intersection
+  loops call TObject::intersect directly instead of through the
+  GraphicalObject interface, so that the compiler can inline them. It
+  offers the part of Scene used by the renderer: render it with a
+  BasicRenderer< StaticScene< ... > >.
+
+  Shading (normals and materials) still goes through GraphicalObject,
+  once per hit. Objects are tested linearly: this suits scenes of few,
+  large objects, Scene::Grid being better for many small ones.
+  */
+  template < typename... TObjects >
+  struct StaticScene {
+
+    /// The list of lights modelled as a vector.
+    std::vector< Light* > myLights;
+    /// The objects, type by type (updated by prepare()). They point into
+    /// myPrimitives, so no object may be added after prepare().
+    std::vector< GraphicalObject* > myObjects;
+    /// The objects of each type.
+    std::tuple< std::vector< TObjects >... > myPrimitives;
+    /// 'true' when myObjects must be updated by prepare().
+    bool myDirty = true;
+
+    /// Default constructor. Nothing to do.
+    StaticScene() = default;
+
+    /// Destructor. Frees lights (objects are stored by value).
+    ~StaticScene()
+    {
+      for ( Light* light : myLights )
+        delete light;
+    }
+
+    /// @return the objects of type \a T.
+    template < typename T >
+    std::vector< T >& objects()
+    {
+      return std::get< std::vector< T > >( myPrimitives );
+    }
+
+    /// Adds a copy of \a anObject, whose type must be one of TObjects.
+    template < typename T >
+    void addObject( const T& anObject )
+    {
+      objects< T >().push_back( anObject );
+      myDirty = true;
+    }
+
+    /// Adds a copy of \a anObject and deletes it, so that the scene can
+    /// be built as a Scene (e.g. with buildDemoScene).
+    template < typename T >
+    void addObject( T* anObject )
+    {
+      addObject( *anObject );
+      delete anObject;
+    }
+
+    /// Adds a new light to the scene.
+    void addLight( Light* aLight )
+    {
+      myLights.push_back( aLight );
+    }
+
+    /// Updates myObjects. Must be called after the objects have been
+    /// added, and before rayIntersection (the renderer does it at the
+    /// beginning of each render).
+    void prepare( int /* nb_threads */ = 0 )
+    {
+      if ( ! myDirty ) return;
+      myObjects.clear();
+      forEachType( [&] ( auto& objects ) {
+          for ( auto& o : objects )
+            {
+              o.sceneIndex = (int) myObjects.size();
+              myObjects.push_back( &o );
+            }
+        } );
+      myDirty = false;
+    }
+
+    /// Same as Scene::rayIntersection.
+    Real rayIntersection( const Ray& ray, GraphicalObject*& object, Point3& p ) {
+        Real t;
+        if ( ! intersect( ray, ray.t_min, std::numeric_limits<Real>::max(), object, t ) )
+          return std::numeric_limits<Real>::max();
+        p = ray.origin + t * ray.direction;
+        return -t * t;
+    }
+
+    /// Same as Scene::intersect: the objects of each type are tested in
+    /// a loop of its own, without virtual call.
+    bool intersect( const Ray& ray, Real t_min, Real t_max,
+                    GraphicalObject*& object, Real& t ) {
+        assert( ! myDirty );
+        object = nullptr;
+        forEachType( [&] ( auto& objects ) {
+            typedef typename std::decay< decltype( objects ) >::type::value_type T;
+            for ( T& o : objects )
+              if ( o.T::intersect( ray, t_min, t_max, t_max ) )
+                object = &o;
+          } );
+        t = t_max;
+        return object != nullptr;
+    }
+
+    /// Calls \a f on the vector of objects of each type, in the order of
+    /// TObjects.
+    template < typename F >
+    void forEachType( F f )
+    {
+      std::apply( [&] ( auto&... objects ) { ( f( objects ), ... ); }, myPrimitives );
+    }
+
+  private:
+    /// Copy constructor is forbidden.
+    StaticScene( const StaticScene& ) = delete;
+    /// Assigment is forbidden.
+    StaticScene& operator=( const StaticScene& ) = delete;
+  };
+
+} // namespace rt
+
+#endif // #define _STATIC_SCENE_H_
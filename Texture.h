@@ -0,0 +1,411 @@
+/**
+@file Texture.h
+
+POSIX only (pread).
+*/
+#pragma once
+#ifndef _TEXTURE_H_
+#define _TEXTURE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Color.h"
+#include "Image2D.h"
+#include "MappedImage.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A cache of texture tiles with a memory budget, shared by all the
+  textures and all the render threads. Tiles are loaded on demand, and
+  the least recently used ones are dropped when the budget is exceeded,
+  so that textures much bigger than the memory can be rendered.
+
+  Tiles are handed out as shared pointers: a tile dropped from the cache
+  while a thread reads it stays valid until that thread releases it.
+  Loading is done outside the lock, so threads missing different tiles
+  read them in parallel. Each thread also keeps the last tile it got
+  aside: consecutive lookups mostly fall in the same tile, which is then
+  handed out without taking the lock.
+  */
+  struct TextureCache {
+    /// The texels of a tile, line by line.
+    typedef std::vector< PackedRGB > Tile;
+
+    /// Constructor. The cache holds at most \a budget bytes of texels
+    /// (and at least one tile).
+    TextureCache( std::size_t budget = 64 << 20 )
+      : myBudget( budget ), myUid( nextUid()++ ) {}
+
+    /// @return a new texture identifier, used in the tile keys.
+    int newTexture()
+    {
+      std::lock_guard< std::mutex > lock( myMutex );
+      return myNbTextures++;
+    }
+
+    /// @return the tile \a index of level \a level of texture \a
+    /// texture, calling \a load( Tile& ) to read it if it is not cached.
+    template <typename TLoad>
+    std::shared_ptr< const Tile > tile( int texture, int level, std::uint32_t index, TLoad load )
+    {
+      std::uint64_t key = ( (std::uint64_t) texture << 40 ) | ( (std::uint64_t) level << 32 ) | index;
+      LastTile& last = lastTile();
+      if ( last.cache != myUid || last.key != key )
+        {
+          last.tile  = cachedTile( key, load );
+          last.cache = myUid;
+          last.key   = key;
+        }
+      return last.tile;
+    }
+
+    /// @return the number of bytes of texels currently cached.
+    std::size_t bytes() const
+    {
+      std::lock_guard< std::mutex > lock( myMutex );
+      return myBytes;
+    }
+
+    /// The number of tiles found in the cache, loaded, and dropped. The
+    /// lookups of the last tile of a thread are not counted.
+    long myHits = 0, myMisses = 0, myEvictions = 0;
+
+  private:
+    typedef std::list< std::pair< std::uint64_t, std::shared_ptr< const Tile > > > LRU;
+
+    /// The last tile got by a thread, with the identifier of its cache
+    /// (identifiers are never reused, unlike addresses).
+    struct LastTile {
+      std::uint64_t cache = 0, key = 0;
+      std::shared_ptr< const Tile > tile;
+    };
+
+    /// @return the last tile of the calling thread.
+    static LastTile& lastTile()
+    {
+      thread_local LastTile last;
+      return last;
+    }
+
+    /// @return the next cache identifier (0 is for no cache).
+    static std::atomic< std::uint64_t >& nextUid()
+    {
+      static std::atomic< std::uint64_t > uid( 1 );
+      return uid;
+    }
+
+    /// @return the tile of key \a key, from the cache or read by \a load.
+    template <typename TLoad>
+    std::shared_ptr< const Tile > cachedTile( std::uint64_t key, TLoad& load )
+    {
+      {
+        std::lock_guard< std::mutex > lock( myMutex );
+        auto it = myIndex.find( key );
+        if ( it != myIndex.end() )
+          {
+            ++myHits;
+            myLRU.splice( myLRU.begin(), myLRU, it->second );
+            return it->second->second;
+          }
+        ++myMisses;
+      }
+      std::shared_ptr< Tile > loaded = std::make_shared< Tile >();
+      load( *loaded );
+      std::lock_guard< std::mutex > lock( myMutex );
+      auto it = myIndex.find( key );
+      if ( it != myIndex.end() ) return it->second->second; // loaded meanwhile
+      myLRU.emplace_front( key, loaded );
+      myIndex[ key ] = myLRU.begin();
+      myBytes += loaded->size() * sizeof( PackedRGB );
+      while ( myBytes > myBudget && myLRU.size() > 1 )
+        {
+          myBytes -= myLRU.back().second->size() * sizeof( PackedRGB );
+          myIndex.erase( myLRU.back().first );
+          myLRU.pop_back();
+          ++myEvictions;
+        }
+      return loaded;
+    }
+
+    /// The memory budget, in bytes.
+    std::size_t myBudget;
+    /// The identifier of this cache, for the last tiles of the threads.
+    std::uint64_t myUid;
+    /// The bytes of the cached tiles.
+    std::size_t myBytes = 0;
+    /// The number of textures using the cache.
+    int myNbTextures = 0;
+    /// The tiles, most recently used first.
+    LRU myLRU;
+    /// The position of each cached tile in myLRU.
+    std::unordered_map< std::uint64_t, LRU::iterator > myIndex;
+    /// Protects everything above.
+    mutable std::mutex myMutex;
+  };
+
+  /**
+  A mip-mapped texture read through a TextureCache from a tiled file,
+  written beforehand by build(). The file holds the mip pyramid (each
+  level half the size of the previous one, down to 1x1), each level
+  being cut into square tiles of 8-bit RGB texels. Only the tiles that
+  are looked up are read.
+
+  Texture coordinates (u,v) are in [0,1)^2 and repeat, v = 0 being the
+  top line of the image. Lookups are thread-safe.
+  */
+  struct Texture {
+
+    /// Opens the tiled texture file \a path (see isValid), whose tiles
+    /// are cached in \a cache. A file whose header is not the one written
+    /// by build(), or which is too short for the levels it announces, is
+    /// rejected.
+    Texture( TextureCache& cache, const std::string& path )
+      : myCache( cache ), myId( cache.newTexture() )
+    {
+      myFd = ::open( path.c_str(), O_RDONLY );
+      std::int32_t header[ 5 ];
+      struct stat  status;
+      if ( myFd < 0
+           || ::pread( myFd, header, sizeof( header ), 0 ) != (ssize_t) sizeof( header )
+           || ::fstat( myFd, &status ) != 0
+           || header[ 0 ] != MAGIC
+           || header[ 1 ] < 1 || header[ 1 ] > MAX_SIZE
+           || header[ 2 ] < 1 || header[ 2 ] > MAX_SIZE
+           || header[ 3 ] < 1 || header[ 3 ] > MAX_TILE
+           || header[ 4 ] != nbLevels( header[ 1 ], header[ 2 ] ) )
+        {
+          reject();
+          return;
+        }
+      myW      = header[ 1 ];
+      myH      = header[ 2 ];
+      myTile   = header[ 3 ];
+      myLevels = header[ 4 ];
+      std::size_t offset = sizeof( header );
+      for ( int l = 0; l < myLevels; ++l )
+        {
+          Level level = { levelSize( myW, l ), levelSize( myH, l ), 0, offset };
+          level.tiles_x = ( level.w + myTile - 1 ) / myTile;
+          offset += (std::size_t) level.tiles_x * ( ( level.h + myTile - 1 ) / myTile )
+            * myTile * myTile * sizeof( PackedRGB );
+          myPyramid.push_back( level );
+        }
+      if ( (std::size_t) status.st_size < offset ) reject();
+    }
+
+    /// Destructor. Closes the file.
+    ~Texture()
+    {
+      if ( myFd >= 0 ) ::close( myFd );
+    }
+
+    /// @return 'true' iff the file could be opened and its header is
+    /// valid. An invalid texture must not be looked up.
+    bool isValid() const { return myFd >= 0; }
+    /// @return the width of the texture.
+    int w() const { return myW; }
+    /// @return the height of the texture.
+    int h() const { return myH; }
+    /// @return the number of mip levels.
+    int levels() const { return myLevels; }
+
+    /// @return the texel (x,y) of level \a level.
+    Color texel( int level, int x, int y ) const
+    {
+      assert( isValid() && level >= 0 && level < myLevels );
+      std::shared_ptr< const TextureCache::Tile > tile = tileOf( level, x, y );
+      return toColor( ( *tile )[ ( y % myTile ) * myTile + x % myTile ] );
+    }
+
+    /// @return the color at (u,v), filtered over a footprint of width
+    /// \a width (in texture coordinates): bilinear interpolation in the
+    /// two mip levels around the footprint, and linear interpolation
+    /// between them.
+    Color lookup( Real u, Real v, Real width ) const
+    {
+      assert( isValid() );
+      Real level = std::log2( std::max( width * std::max( myW, myH ), 1.0f ) );
+      level      = std::min( level, (Real) ( myLevels - 1 ) );
+      int  l0    = (int) level;
+      Real t     = level - l0;
+      Color c    = bilinear( l0, u, v );
+      if ( t > 0.0f && l0 + 1 < myLevels )
+        c = c * ( 1.0f - t ) + bilinear( l0 + 1, u, v ) * t;
+      return c;
+    }
+
+    /// @return the bilinearly interpolated color of level \a level at
+    /// (u,v).
+    Color bilinear( int level, Real u, Real v ) const
+    {
+      const Level& l = myPyramid[ level ];
+      Real x  = ( u - std::floor( u ) ) * l.w - 0.5f;
+      Real y  = ( v - std::floor( v ) ) * l.h - 0.5f;
+      Real fx = std::floor( x );
+      Real fy = std::floor( y );
+      Real a  = x - fx;
+      Real b  = y - fy;
+      int  x0 = ( (int) fx + l.w ) % l.w, x1 = ( x0 + 1 ) % l.w;
+      int  y0 = ( (int) fy + l.h ) % l.h, y1 = ( y0 + 1 ) % l.h;
+      // The four texels are usually in the same tile: it is fetched once.
+      std::shared_ptr< const TextureCache::Tile > tile;
+      int tile_x = -1, tile_y = -1;
+      auto fetch = [&] ( int tx, int ty ) {
+        if ( tx / myTile != tile_x || ty / myTile != tile_y )
+          {
+            tile   = tileOf( level, tx, ty );
+            tile_x = tx / myTile;
+            tile_y = ty / myTile;
+          }
+        return toColor( ( *tile )[ ( ty % myTile ) * myTile + tx % myTile ] );
+      };
+      Color c00 = fetch( x0, y0 ), c10 = fetch( x1, y0 );
+      Color c01 = fetch( x0, y1 ), c11 = fetch( x1, y1 );
+      return ( c00 * ( 1.0f - a ) + c10 * a ) * ( 1.0f - b )
+        +    ( c01 * ( 1.0f - a ) + c11 * a ) * b;
+    }
+
+    /// Writes the tiled mip pyramid of \a image into the file \a path,
+    /// with tiles of \a tile x \a tile texels. Each texel of a level is
+    /// the average of 2x2 texels of the previous one.
+    ///
+    /// @return 'true' if the file could be written (the image must not be
+    /// empty, nor bigger than MAX_SIZE, and the tile size is at most
+    /// MAX_TILE).
+    static bool build( const Image2D<Color>& image, const std::string& path, int tile = 32 )
+    {
+      if ( image.w() < 1 || image.w() > MAX_SIZE || image.h() < 1 || image.h() > MAX_SIZE
+           || tile < 1 || tile > MAX_TILE )
+        return false;
+      int levels = nbLevels( image.w(), image.h() );
+      std::ofstream output( path.c_str(), std::ios::binary );
+      std::int32_t header[ 5 ] = { MAGIC, image.w(), image.h(), tile, levels };
+      if ( ! output.write( reinterpret_cast<const char*>( header ), sizeof( header ) ) )
+        return false;
+      Image2D<Color> level = image;
+      std::vector< PackedRGB > texels( tile * tile );
+      for ( int l = 0; l < levels; ++l )
+        {
+          if ( l > 0 )
+            {
+              Image2D<Color> next( levelSize( image.w(), l ), levelSize( image.h(), l ) );
+              for ( int y = 0; y < next.h(); ++y )
+                for ( int x = 0; x < next.w(); ++x )
+                  {
+                    int x1 = std::min( 2 * x + 1, level.w() - 1 );
+                    int y1 = std::min( 2 * y + 1, level.h() - 1 );
+                    next.at( x, y ) = ( level.at( 2 * x, 2 * y ) + level.at( x1, 2 * y )
+                                        + level.at( 2 * x, y1 ) + level.at( x1, y1 ) ) * 0.25f;
+                  }
+              level = next;
+            }
+          // Tiles line by line; the last ones are padded with the border.
+          for ( int ty = 0; ty < level.h(); ty += tile )
+            for ( int tx = 0; tx < level.w(); tx += tile )
+              {
+                for ( int j = 0; j < tile; ++j )
+                  for ( int i = 0; i < tile; ++i )
+                    texels[ j * tile + i ] =
+                      PackedRGB( level.at( std::min( tx + i, level.w() - 1 ),
+                                           std::min( ty + j, level.h() - 1 ) ) );
+                if ( ! output.write( reinterpret_cast<const char*>( texels.data() ),
+                                     texels.size() * sizeof( PackedRGB ) ) )
+                  return false;
+              }
+        }
+      output.close();
+      return ! output.fail();
+    }
+
+  private:
+    /// The first four bytes of a texture file ("RTTX").
+    static constexpr std::int32_t MAGIC = 0x58545452;
+    /// The largest width and height of a texture.
+    static constexpr std::int32_t MAX_SIZE = 1 << 16;
+    /// The largest side of a tile.
+    static constexpr std::int32_t MAX_TILE = 1 << 10;
+
+    /// The size and position in the file of a mip level.
+    struct Level {
+      int w, h;
+      int tiles_x;
+      std::size_t offset;
+    };
+
+    /// The cache of the tiles.
+    TextureCache& myCache;
+    /// The identifier of the texture in the cache.
+    int myId;
+    /// The texture file.
+    int myFd;
+    /// The size of the texture, of its tiles, and its number of levels.
+    int myW = 0, myH = 0, myTile = 1, myLevels = 0;
+    /// The mip levels.
+    std::vector< Level > myPyramid;
+
+    /// @return the size of level \a l along a dimension of size \a n.
+    static int levelSize( int n, int l ) { return std::max( 1, n >> l ); }
+
+    /// @return the number of levels of a texture of size \a w x \a h,
+    /// down to 1x1.
+    static int nbLevels( int w, int h )
+    {
+      int levels = 1;
+      while ( levelSize( w, levels - 1 ) > 1 || levelSize( h, levels - 1 ) > 1 ) ++levels;
+      return levels;
+    }
+
+    /// Closes the file of an invalid texture.
+    void reject()
+    {
+      if ( myFd >= 0 ) ::close( myFd );
+      myFd = -1;
+      myW  = myH = myLevels = 0;
+      myPyramid.clear();
+    }
+
+    /// @return the 8-bit color \a p as a color.
+    static Color toColor( const PackedRGB& p )
+    {
+      return Color( p.r / 255.0f, p.g / 255.0f, p.b / 255.0f );
+    }
+
+    /// @return the tile containing texel (x,y) of level \a level.
+    std::shared_ptr< const TextureCache::Tile > tileOf( int level, int x, int y ) const
+    {
+      const Level& l     = myPyramid[ level ];
+      std::uint32_t index = ( y / myTile ) * l.tiles_x + x / myTile;
+      int tile = myTile;
+      int fd   = myFd;
+      return myCache.tile( myId, level, index, [&] ( TextureCache::Tile& texels ) {
+          texels.resize( tile * tile );
+          std::size_t bytes = texels.size() * sizeof( PackedRGB );
+          if ( ::pread( fd, texels.data(), bytes, l.offset + index * bytes ) != (ssize_t) bytes )
+            std::fill( texels.begin(), texels.end(), PackedRGB() );
+        } );
+    }
+
+    /// Copy constructor is forbidden.
+    Texture( const Texture& ) = delete;
+    /// Assigment is forbidden.
+    Texture& operator=( const Texture& ) = delete;
+  };
+
+} // namespace rt
+
+#endif // #define _TEXTURE_H_
@@ -0,0 +1,289 @@
+/**
+@file UniformGrid.h
+*/
+#pragma once
+#ifndef _UNIFORM_GRID_H_
+#define _UNIFORM_GRID_H_
+
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "PointVector.h"
+#include "Ray.h"
+#include "GraphicalObject.h"
+#include "Parallel.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A uniform grid over the bounded objects of a scene, traversed with a
+  3D-DDA. Each cell lists (by index) the objects whose bounding box
+  overlaps it. Cells are stored contiguously (compressed rows), and the
+  grid is built in linear time by a parallel counting sort, so that it
+  can be rebuilt at each frame of an animation. The objects of each cell
+  are listed by increasing index, whatever the number of threads.
+
+  Unbounded objects are not in the grid: they are given back by
+  unbounded() and must be tested against every ray.
+  */
+  struct UniformGrid {
+    /// Maximal number of cells along one axis.
+    static constexpr int MAXRES = 512;
+
+    /// The number of cells per object aimed at by build().
+    Real myDensity = 2.0f;
+    /// refit() rebuilds the grid when more than this fraction of the
+    /// objects no longer fit their cells.
+    Real myMaxLooseRatio = 0.05f;
+
+    /// Builds the grid for the given objects, using \a nb_threads
+    /// threads (0: all hardware threads).
+    void build( const std::vector< GraphicalObject* >& objects, int nb_threads = 0 )
+    {
+      int n = (int) objects.size();
+      myUnbounded.clear();
+      myCellStart.clear();
+      myCellObjects.clear();
+      myLoose.clear();
+      myLooseFlags.assign( n, 0 );
+      myRanges.assign( n, CellRange() );
+      myNbCells = 0;
+      // Boxes of objects.
+      std::vector< Point3 > lows( n ), highs( n );
+      std::vector< char >   bounded( n );
+      parallelFor( 0, n, nb_threads, [&] ( long b, long e ) {
+          for ( long i = b; i < e; ++i )
+            bounded[ i ] = objects[ i ]->boundingBox( lows[ i ], highs[ i ] );
+        } );
+      bool any = false;
+      for ( int i = 0; i < n; ++i )
+        {
+          if ( ! bounded[ i ] ) { myUnbounded.push_back( i ); continue; }
+          if ( ! any ) { myLow = lows[ i ]; myHigh = highs[ i ]; any = true; }
+          for ( int a = 0; a < 3; ++a )
+            {
+              myLow[ a ]  = std::min( myLow[ a ],  lows[ i ][ a ] );
+              myHigh[ a ] = std::max( myHigh[ a ], highs[ i ][ a ] );
+            }
+        }
+      if ( ! any ) return;
+      // Resolution: about myDensity cells per object, cubic cells.
+      int nb_bounded = n - (int) myUnbounded.size();
+      Vector3 extent = myHigh - myLow;
+      for ( int a = 0; a < 3; ++a ) extent[ a ] = std::max( extent[ a ], 1e-4f );
+      Real volume = extent[ 0 ] * extent[ 1 ] * extent[ 2 ];
+      Real k = cbrt( myDensity * nb_bounded / volume );
+      for ( int a = 0; a < 3; ++a )
+        {
+          myRes[ a ]      = std::max( 1, std::min( MAXRES, (int) ceil( extent[ a ] * k ) ) );
+          myCellSize[ a ] = extent[ a ] / myRes[ a ];
+        }
+      myNbCells = myRes[ 0 ] * myRes[ 1 ] * myRes[ 2 ];
+      parallelFor( 0, n, nb_threads, [&] ( long b, long e ) {
+          for ( long i = b; i < e; ++i )
+            if ( bounded[ i ] ) myRanges[ i ] = cellRange( lows[ i ], highs[ i ] );
+        } );
+      // Counting sort of (cell, object) pairs.
+      std::unique_ptr< std::atomic< unsigned int >[] >
+        counts( new std::atomic< unsigned int >[ myNbCells ] );
+      for ( long c = 0; c < myNbCells; ++c ) counts[ c ] = 0;
+      parallelFor( 0, n, nb_threads, [&] ( long b, long e ) {
+          for ( long i = b; i < e; ++i )
+            if ( bounded[ i ] )
+              forEachCell( myRanges[ i ], [&] ( long c ) { ++counts[ c ]; } );
+        } );
+      myCellStart.resize( myNbCells + 1 );
+      myCellStart[ 0 ] = 0;
+      for ( long c = 0; c < myNbCells; ++c )
+        {
+          myCellStart[ c + 1 ] = myCellStart[ c ] + counts[ c ];
+          counts[ c ] = myCellStart[ c ];
+        }
+      myCellObjects.resize( myCellStart[ myNbCells ] );
+      parallelFor( 0, n, nb_threads, [&] ( long b, long e ) {
+          for ( long i = b; i < e; ++i )
+            if ( bounded[ i ] )
+              forEachCell( myRanges[ i ], [&] ( long c ) {
+                  myCellObjects[ counts[ c ]++ ] = (unsigned int) i;
+                } );
+        } );
+      // The threads fill the cells in any order: each cell is sorted by
+      // object index, so that hits at equal distances are resolved the
+      // same way at each run.
+      parallelFor( 0, myNbCells, nb_threads, [&] ( long b, long e ) {
+          for ( long c = b; c < e; ++c )
+            std::sort( myCellObjects.begin() + myCellStart[ c ],
+                       myCellObjects.begin() + myCellStart[ c + 1 ] );
+        } );
+    }
+
+    /// Takes into account that the objects of indices \a moved have
+    /// moved, without rebuilding the grid: an object still overlapping
+    /// the same cells needs nothing, the others become "loose", i.e.
+    /// they are ignored in the cells and tested against every ray. The
+    /// grid is only rebuilt when there are too many loose objects.
+    void refit( const std::vector< GraphicalObject* >& objects,
+                const std::vector< int >& moved, int nb_threads = 0 )
+    {
+      if ( myNbCells == 0 ) { build( objects, nb_threads ); return; }
+      bool changed = false;
+      for ( int i : moved )
+        {
+          Point3 low, high;
+          if ( ! objects[ i ]->boundingBox( low, high ) ) continue;
+          bool fits = myRanges[ i ] == cellRange( low, high );
+          for ( int a = 0; a < 3 && fits; ++a )
+            fits = low[ a ] >= myLow[ a ] && high[ a ] <= myHigh[ a ];
+          if ( fits == ! myLooseFlags[ i ] ) continue;
+          myLooseFlags[ i ] = ! fits;
+          changed = true;
+        }
+      if ( ! changed ) return;
+      myLoose.clear();
+      for ( int i = 0; i < (int) myLooseFlags.size(); ++i )
+        if ( myLooseFlags[ i ] ) myLoose.push_back( i );
+      if ( myLoose.size() > 16 + myMaxLooseRatio * objects.size() )
+        build( objects, nb_threads );
+    }
+
+    /// @return the indices of the objects that are not in the grid.
+    const std::vector< int >& unbounded() const { return myUnbounded; }
+
+    /// @return the indices of the objects that have left their cells.
+    const std::vector< int >& loose() const { return myLoose; }
+
+    /// @return 'true' iff the object of index \a i has left its cells,
+    /// and must thus be ignored when met in a cell.
+    bool isLoose( unsigned int i ) const { return myLooseFlags[ i ]; }
+
+    /// Visits the cells pierced by \a ray in front-to-back order. For
+    /// each non-empty cell, calls \a visit( first, last, t_exit ), where
+    /// [first,last) are the indices of its objects and t_exit is the
+    /// distance along the ray where it leaves the cell. The traversal
+    /// stops as soon as \a visit returns 'true'.
+    template <typename TVisitor>
+    void traverse( const Ray& ray, TVisitor visit ) const
+    {
+      if ( myNbCells == 0 ) return;
+      const Point3&  o   = ray.origin;
+      const Vector3& d   = ray.direction;
+      const Vector3& inv = ray.inv_direction;
+      // Clipping against the grid box (slab test: the near plane of each
+      // slab is given by the sign of the direction).
+      Real t_enter = 0.0f;
+      Real t_exit  = std::numeric_limits< Real >::max();
+      for ( int a = 0; a < 3; ++a )
+        {
+          if ( d[ a ] == 0.0f )
+            {
+              if ( o[ a ] < myLow[ a ] || o[ a ] > myHigh[ a ] ) return;
+              continue;
+            }
+          Real t0 = ( ( ray.sign[ a ] ? myHigh[ a ] : myLow[ a ] ) - o[ a ] ) * inv[ a ];
+          Real t1 = ( ( ray.sign[ a ] ? myLow[ a ] : myHigh[ a ] ) - o[ a ] ) * inv[ a ];
+          t_enter = std::max( t_enter, t0 );
+          t_exit  = std::min( t_exit, t1 );
+        }
+      if ( t_enter > t_exit ) return;
+      // 3D-DDA setup.
+      int  cell[ 3 ], step[ 3 ], stop[ 3 ];
+      Real t_next[ 3 ], t_delta[ 3 ];
+      for ( int a = 0; a < 3; ++a )
+        {
+          Real x  = o[ a ] + t_enter * d[ a ];
+          cell[ a ] = std::max( 0, std::min( myRes[ a ] - 1,
+                                             (int) floor( ( x - myLow[ a ] ) / myCellSize[ a ] ) ) );
+          if ( d[ a ] == 0.0f )
+            {
+              step[ a ]    = 0;
+              stop[ a ]    = -1;
+              t_delta[ a ] = 0.0f;
+              t_next[ a ]  = std::numeric_limits< Real >::max();
+            }
+          else
+            {
+              int next     = ray.sign[ a ] ? cell[ a ] : cell[ a ] + 1;
+              step[ a ]    = ray.sign[ a ] ? -1 : 1;
+              stop[ a ]    = ray.sign[ a ] ? -1 : myRes[ a ];
+              t_delta[ a ] = myCellSize[ a ] * std::fabs( inv[ a ] );
+              t_next[ a ]  = ( myLow[ a ] + next * myCellSize[ a ] - o[ a ] ) * inv[ a ];
+            }
+        }
+      while ( true )
+        {
+          int  a      = t_next[ 0 ] < t_next[ 1 ]
+            ? ( t_next[ 0 ] < t_next[ 2 ] ? 0 : 2 )
+            : ( t_next[ 1 ] < t_next[ 2 ] ? 1 : 2 );
+          long c      = cell[ 0 ] + myRes[ 0 ] * ( cell[ 1 ] + (long) myRes[ 1 ] * cell[ 2 ] );
+          unsigned int first = myCellStart[ c ];
+          unsigned int last  = myCellStart[ c + 1 ];
+          if ( first != last && visit( first, last, t_next[ a ] ) ) return;
+          cell[ a ] += step[ a ];
+          if ( cell[ a ] == stop[ a ] || t_next[ a ] > t_exit ) return;
+          t_next[ a ] += t_delta[ a ];
+        }
+    }
+
+    /// @return the index of the object whose list starts at \a k.
+    unsigned int object( unsigned int k ) const { return myCellObjects[ k ]; }
+
+  private:
+    Point3  myLow, myHigh;
+    Vector3 myCellSize;
+    int     myRes[ 3 ] = { 0, 0, 0 };
+    long    myNbCells = 0;
+    /// myCellStart[c]..myCellStart[c+1] are the positions of the objects
+    /// of cell c in myCellObjects.
+    std::vector< unsigned int > myCellStart;
+    std::vector< unsigned int > myCellObjects;
+    std::vector< int >          myUnbounded;
+
+    /// The cells [lo[0],hi[0]]x[lo[1],hi[1]]x[lo[2],hi[2]].
+    struct CellRange {
+      int lo[ 3 ] = { 0, 0, 0 };
+      int hi[ 3 ] = { -1, -1, -1 };
+      bool operator==( const CellRange& other ) const
+      {
+        return std::equal( lo, lo + 3, other.lo ) && std::equal( hi, hi + 3, other.hi );
+      }
+    };
+    /// The cells of each object when the grid was built.
+    std::vector< CellRange > myRanges;
+    /// The objects that have left their cells since the grid was built.
+    std::vector< int >  myLoose;
+    std::vector< char > myLooseFlags;
+
+    int cellCoord( int a, Real x ) const
+    {
+      int i = (int) floor( ( x - myLow[ a ] ) / myCellSize[ a ] );
+      return std::max( 0, std::min( myRes[ a ] - 1, i ) );
+    }
+
+    CellRange cellRange( const Point3& low, const Point3& high ) const
+    {
+      CellRange r;
+      for ( int a = 0; a < 3; ++a )
+        {
+          r.lo[ a ] = cellCoord( a, low[ a ] );
+          r.hi[ a ] = cellCoord( a, high[ a ] );
+        }
+      return r;
+    }
+
+    template <typename TFunction>
+    void forEachCell( const CellRange& r, TFunction f ) const
+    {
+      for ( int z = r.lo[ 2 ]; z <= r.hi[ 2 ]; ++z )
+        for ( int y = r.lo[ 1 ]; y <= r.hi[ 1 ]; ++y )
+          for ( int x = r.lo[ 0 ]; x <= r.hi[ 0 ]; ++x )
+            f( x + myRes[ 0 ] * ( y + (long) myRes[ 1 ] * z ) );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _UNIFORM_GRID_H_
@@ -3,14 +3,62 @@
 @author JOL
 */
 #include <fstream>
+#include <memory>
+#include <sstream>
 #include "Viewer.h"
 #include "Scene.h"
 #include "Renderer.h"
 #include "Image2D.h"
 #include "Image2DWriter.h"
+#include "Animation.h"
+#include "RenderCache.h"
 
 using namespace std;
 
+rt::Viewer::~Viewer()
+{
+  joinBackgroundRenders();
+  delete ptrRenderCache;
+}
+
+void
+rt::Viewer::setScene( rt::Scene& aScene )
+{
+  joinBackgroundRenders();
+  ptrScene = &aScene;
+  if ( ptrRenderCache != 0 ) ptrRenderCache->invalidate();
+}
+
+void
+rt::Viewer::startBackgroundRender( std::function< void() > render )
+{
+  for ( auto it = myBackgroundRenders.begin(); it != myBackgroundRenders.end(); )
+    if ( *it->done )
+      {
+        it->thread.join();
+        it = myBackgroundRenders.erase( it );
+      }
+    else ++it;
+  auto done = std::make_shared< std::atomic< bool > >( false );
+  myBackgroundRenders.push_back( BackgroundRender{
+      std::thread( [render, done] () { render(); *done = true; } ), done } );
+}
+
+void
+rt::Viewer::joinBackgroundRenders()
+{
+  for ( BackgroundRender& r : myBackgroundRenders )
+    r.thread.join();
+  myBackgroundRenders.clear();
+}
+
+void
+rt::Viewer::print( const std::string& message )
+{
+  std::lock_guard< std::mutex > lock( myOutputMutex );
+  std::cout << message << std::endl;
+}
+
 // Draws a tetrahedron with 4 colors.
 void 
 rt::Viewer::draw()
@@ -33,7 +81,13 @@ rt::Viewer::init()
   // Add custom key description (see keyPressEvent).
   setKeyDescription(Qt::Key_R, "Renders the scene with a ray-tracer (low resolution)");
   setKeyDescription(Qt::SHIFT+Qt::Key_R, "Renders the scene with a ray-tracer (medium resolution)");
-  setKeyDescription(Qt::CTRL+Qt::Key_R, "Renders the scene with a ray-tracer (high resolution)");
+  setKeyDescription(Qt::CTRL+Qt::Key_R, "Renders the scene with a ray-tracer (high resolution, without reusing the previous render)");
+  setKeyDescription(Qt::Key_B, "Renders the scene into a new file, without reusing the previous render (low resolution)");
+  setKeyDescription(Qt::SHIFT+Qt::Key_B, "Renders the scene into a new file (medium resolution)");
+  setKeyDescription(Qt::CTRL+Qt::Key_B, "Renders the scene into a new file (high resolution)");
+  setKeyDescription(Qt::Key_P, "Renders the camera path of F1 as an image sequence (low resolution)");
+  setKeyDescription(Qt::SHIFT+Qt::Key_P, "Renders the camera path of F1 as an image sequence (medium resolution)");
+  setKeyDescription(Qt::CTRL+Qt::Key_P, "Renders the camera path of F1 as an image sequence (high resolution)");
   setKeyDescription(Qt::Key_D, "Augments the max depth of ray-tracing algorithm");
   setKeyDescription(Qt::SHIFT+Qt::Key_D, "Decreases the max depth of ray-tracing algorithm");
   
@@ -58,31 +112,127 @@ rt::Viewer::keyPressEvent(QKeyEvent *e)
   // Get event modifiers key
   const Qt::KeyboardModifiers modifiers = e->modifiers();
   bool handled = false;
+  // Les rendus portent sur une copie de la scene prise au moment de la
+  // touche, et tournent en arriere-plan : la fenetre peut continuer a
+  // dessiner et a deplacer les lumieres.
   if ((e->key()==Qt::Key_R) && ptrScene != 0 )
+    {
+      if ( myCachedRender )
+        print( "The previous render is still running." );
+      else
+        {
+          int w = camera()->screenWidth();
+          int h = camera()->screenHeight();
+          if ( modifiers == Qt::ShiftModifier ) { w /= 2; h /= 2; }
+          else if ( modifiers == Qt::NoModifier ) { w /= 8; h /= 8; }
+          Point3 origin;
+          Vector3 dirUL, dirUR, dirLL, dirLR;
+          getViewBox( origin, dirUL, dirUR, dirLL, dirLR );
+          // Réutilise le rendu précédent autant que possible, sauf en haute
+          // resolution : la reprojection n'est qu'approchee.
+          if ( ptrRenderCache == 0 ) ptrRenderCache = new RenderCache;
+          bool exact = modifiers == Qt::ControlModifier;
+          std::shared_ptr< Scene > snapshot( ptrScene->snapshot() );
+          RenderCache* cache = ptrRenderCache;
+          int depth = maxDepth;
+          myCachedRender = true;
+          startBackgroundRender( [=] () {
+              Renderer renderer( *snapshot );
+              renderer.setVerbose( false );
+              renderer.setViewBox( origin, dirUL, dirUR, dirLL, dirLR );
+              renderer.setResolution( w, h );
+              Image2D<Color> image( w, h );
+              if ( exact ) cache->invalidate();
+              cache->render( renderer, image, depth );
+              ofstream output( "output.ppm" );
+              Image2DWriter<Color>::write( image, output, true );
+              output.close();
+              std::ostringstream message;
+              message << "Rendered: " << cache->myReused << " pixels reused, "
+                      << cache->myShaded << " shaded, "
+                      << cache->myTraced << " traced.";
+              myCachedRender = false;
+              print( message.str() );
+            } );
+        }
+      handled = true;
+    }
+  if ((e->key()==Qt::Key_B) && ptrScene != 0 )
     {
       int w = camera()->screenWidth();
       int h = camera()->screenHeight();
-      Renderer renderer( *ptrScene );
-      qglviewer::Vec orig, dir;
-      camera()->convertClickToLine( QPoint( 0,0 ), orig, dir );
-      Vector3 origin( orig );
-      Vector3 dirUL( dir );
-      camera()->convertClickToLine( QPoint( w,0 ), orig, dir );
-      Vector3 dirUR( dir );
-      camera()->convertClickToLine( QPoint( 0, h ), orig, dir );
-      Vector3 dirLL( dir );
-      camera()->convertClickToLine( QPoint( w, h ), orig, dir );
-      Vector3 dirLR( dir );
-      // Paramètre le renderer, puis le lance, et sauvegarde l'image.
-      renderer.setViewBox( origin, dirUL, dirUR, dirLL, dirLR );
       if ( modifiers == Qt::ShiftModifier ) { w /= 2; h /= 2; }
       else if ( modifiers == Qt::NoModifier ) { w /= 8; h /= 8; }
-      Image2D<Color> image( w, h );
-      renderer.setResolution( image.w(), image.h() );
-      renderer.render( image, maxDepth );
-      ofstream output( "output.ppm" );
-      Image2DWriter<Color>::write( image, output, true );
-      output.close();
+      Point3 origin;
+      Vector3 dirUL, dirUR, dirLL, dirLR;
+      getViewBox( origin, dirUL, dirUR, dirLL, dirLR );
+      std::shared_ptr< Scene > snapshot( ptrScene->snapshot() );
+      int depth = maxDepth;
+      int k     = myNbBackgroundRenders++;
+      startBackgroundRender( [=] () {
+          Renderer renderer( *snapshot );
+          renderer.setVerbose( false );
+          renderer.setViewBox( origin, dirUL, dirUR, dirLL, dirLR );
+          renderer.setResolution( w, h );
+          Image2D<Color> image( w, h );
+          renderer.render( image, depth );
+          std::ostringstream name;
+          name << "background" << k << ".ppm";
+          ofstream output( name.str() );
+          Image2DWriter<Color>::write( image, output, true );
+          print( "Background render written to " + name.str() );
+        } );
+      std::ostringstream message;
+      message << "Background render " << k << " started.";
+      print( message.str() );
+      handled = true;
+    }
+  if ((e->key()==Qt::Key_P) && ptrScene != 0 )
+    {
+      qglviewer::KeyFrameInterpolator* path = camera()->keyFrameInterpolator( 1 );
+      if ( path == 0 || path->numberOfKeyFrames() == 0 )
+        print( "No camera path: define keyframes with Alt+F1." );
+      else
+        {
+          int w = camera()->screenWidth();
+          int h = camera()->screenHeight();
+          if ( modifiers == Qt::ShiftModifier ) { w /= 2; h /= 2; }
+          else if ( modifiers == Qt::NoModifier ) { w /= 8; h /= 8; }
+          // The view box of each keyframe is obtained by placing the
+          // camera on it, then the camera is put back.
+          qglviewer::Vec        position    = camera()->position();
+          qglviewer::Quaternion orientation = camera()->orientation();
+          std::shared_ptr< Animation > animation( new Animation );
+          for ( int i = 0; i < path->numberOfKeyFrames(); ++i )
+            {
+              qglviewer::Frame key = path->keyFrame( i );
+              camera()->setPosition( key.position() );
+              camera()->setOrientation( key.orientation() );
+              Point3 origin;
+              Vector3 dirUL, dirUR, dirLL, dirLR;
+              getViewBox( origin, dirUL, dirUR, dirLL, dirLR );
+              animation->addCameraKey( (Real) path->keyFrameTime( i ),
+                                       origin, dirUL, dirUR, dirLL, dirLR );
+            }
+          camera()->setPosition( position );
+          camera()->setOrientation( orientation );
+          std::shared_ptr< Scene > snapshot( ptrScene->snapshot() );
+          int depth = maxDepth;
+          int k     = myNbBackgroundRenders++;
+          startBackgroundRender( [=] () {
+              Renderer renderer( *snapshot );
+              renderer.setVerbose( false );
+              std::ostringstream prefix;
+              prefix << "frame" << k << "_";
+              int nb = animation->render( *snapshot, renderer, prefix.str(), 25.0f, w, h, depth );
+              std::ostringstream message;
+              message << nb << " frames written to " << prefix.str() << "*.ppm";
+              print( message.str() );
+            } );
+          std::ostringstream message;
+          message << "Camera path render " << k << " started.";
+          print( message.str() );
+        }
       handled = true;
     }
   if (e->key()==Qt::Key_D)
@@ -91,12 +241,32 @@ rt::Viewer::keyPressEvent(QKeyEvent *e)
         { maxDepth = std::max( 1, maxDepth - 1 ); handled = true; }
       if ( modifiers == Qt::NoModifier )
         { maxDepth = std::min( 20, maxDepth + 1 ); handled = true; }
-      std::cout << "Max depth is " << maxDepth << std::endl; 
+      std::ostringstream message;
+      message << "Max depth is " << maxDepth;
+      print( message.str() );
     }
     
   if (!handled) QGLViewer::keyPressEvent(e);
 }
 
+void
+rt::Viewer::getViewBox( Point3& origin, Vector3& dirUL, Vector3& dirUR,
+                        Vector3& dirLL, Vector3& dirLR ) const
+{
+  int w = camera()->screenWidth();
+  int h = camera()->screenHeight();
+  qglviewer::Vec orig, dir;
+  camera()->convertClickToLine( QPoint( 0,0 ), orig, dir );
+  origin = Vector3( orig );
+  dirUL  = Vector3( dir );
+  camera()->convertClickToLine( QPoint( w,0 ), orig, dir );
+  dirUR  = Vector3( dir );
+  camera()->convertClickToLine( QPoint( 0, h ), orig, dir );
+  dirLL  = Vector3( dir );
+  camera()->convertClickToLine( QPoint( w, h ), orig, dir );
+  dirLR  = Vector3( dir );
+}
+
 QString 
 rt::Viewer::helpString() const
 {
@@ -118,5 +288,8 @@ rt::Viewer::helpString() const
   text += "Press <b>R</b> to render the scene (low resolution).";
   text += "Press <b>Shift+R</b> to render the scene (medium resolution).";
   text += "Press <b>Ctrl+R</b> to render the scene (high resolution).";
+  text += "Renders run in the background, on a copy of the scene: the viewer stays usable.";
+  text += "Press <b>B</b> (<b>Shift+B</b>, <b>Ctrl+B</b>) to render the scene as background*.ppm.";
+  text += "Press <b>P</b> (<b>Shift+P</b>, <b>Ctrl+P</b>) to render the camera path of <b>F1</b> as frame*.ppm.";
   return text;
 }
@@ -6,14 +6,45 @@
 #ifndef _VIEWER_H_
 #define _VIEWER_H_
 
+#ifdef RT_HEADLESS
+
+// Headless build (core library, command-line renderer, tests): neither Qt
+// nor OpenGL is available. Only the OpenGL light identifiers are provided,
+// so that scenes are described the same way in both builds.
+typedef unsigned int GLenum;
+#define GL_LIGHT0 0x4000
+#define GL_LIGHT1 0x4001
+#define GL_LIGHT2 0x4002
+#define GL_LIGHT3 0x4003
+#define GL_LIGHT4 0x4004
+#define GL_LIGHT5 0x4005
+#define GL_LIGHT6 0x4006
+#define GL_LIGHT7 0x4007
+
+namespace rt {
+  /// The viewer only exists in the Qt build.
+  class Viewer;
+}
+
+#else // #ifdef RT_HEADLESS
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <QKeyEvent>
 #include <QGLViewer/qglviewer.h>
+#include "PointVector.h"
 
 namespace rt {
   
   /// Forward declaration of class Scene
   struct Scene;
+  /// Forward declaration of class RenderCache
+  struct RenderCache;
 
   /// This class displays the interface for placing the camera and the
   /// lights, and the user may call the renderer from it.
@@ -21,13 +52,14 @@ namespace rt {
   {
   public:
     /// Default constructor. Scene is empty.
-    Viewer() : QGLViewer(), ptrScene( 0 ), maxDepth( 6 ) {}
+    Viewer() : QGLViewer(), ptrScene( 0 ), ptrRenderCache( 0 ), myCachedRender( false ),
+               myNbBackgroundRenders( 0 ), maxDepth( 6 ) {}
+    /// Destructor.
+    ~Viewer();
     
-    /// Sets the scene
-    void setScene( rt::Scene& aScene )
-    {
-      ptrScene = &aScene;
-    }
+    /// Sets the scene (the renders of the previous one are waited for,
+    /// and the previous render is forgotten).
+    void setScene( rt::Scene& aScene );
     
     /// To call the protected method `drawLight`.
     void drawSomeLight( GLenum light ) const
@@ -49,13 +81,45 @@ namespace rt {
     virtual QString helpString() const;
     /// Celled when pressing a key.
     virtual void keyPressEvent(QKeyEvent *e);
+    /// Gives the view box of the current camera (see Renderer::setViewBox).
+    void getViewBox( Point3& origin, Vector3& dirUL, Vector3& dirUR,
+                     Vector3& dirLL, Vector3& dirLR ) const;
+    /// Runs \a render on a new thread, after joining the threads of the
+    /// renders that are finished.
+    void startBackgroundRender( std::function< void() > render );
+    /// Waits for all the background renders.
+    void joinBackgroundRenders();
+    /// Prints \a message on std::cout, one message at a time since the
+    /// background renders print too.
+    void print( const std::string& message );
     
     /// Stores the scene
     rt::Scene* ptrScene;
 
+    /// The previous render, reused by the next one (key R).
+    rt::RenderCache* ptrRenderCache;
+    /// 'true' while a render of key R uses ptrRenderCache.
+    std::atomic< bool > myCachedRender;
+
+    /// A render running in the background, and whether it is finished.
+    struct BackgroundRender {
+      std::thread                            thread;
+      std::shared_ptr< std::atomic< bool > > done;
+    };
+    /// The renders running in the background (keys R, B and P), each on
+    /// its own snapshot of the scene, so that the viewer stays usable.
+    /// They are waited for by the destructor.
+    std::vector< BackgroundRender > myBackgroundRenders;
+    /// The number of renders started by keys B and P (numbers their files).
+    int myNbBackgroundRenders;
+    /// Serialises the outputs of print().
+    std::mutex myOutputMutex;
+
     /// Maximum depth
     int maxDepth;
   };
 }
 
+#endif // #ifdef RT_HEADLESS
+
 #endif
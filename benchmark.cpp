@@ -0,0 +1,336 @@
+/**
+@file benchmark.cpp
+
+Times the rendering of the reference scene.
+
+Usage: benchmark [width] [height] [max_depth] [repetitions] [extra_lights] [particles]
+
+With extra_lights > 0, that many attenuated point lights are scattered
+above the ground, to measure light culling. With particles > 0, that
+many small spheres are added and the scene uses the uniform grid.
+It also times the relighting of the image after one light changed
+(see Relighter), the termination of deep rays (weight cutoff and
+russian roulette, at twice the given depth), the refraction kernels
+(one ray at a time and in batch, see Fresnel.h), soft shadows with the second light replaced by a
+spherical light (see AreaLight.h), a post-processing chain on the image (see
+ImageFilters.h), and compares the denoising of a render with one
+stochastic light per point (see Denoiser.h) to averaging several such
+renders.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include "Scene.h"
+#include "DemoScene.h"
+#include "Renderer.h"
+#include "Relighter.h"
+#include "AreaLight.h"
+#include "Fresnel.h"
+#include "ImageFilters.h"
+#include "Denoiser.h"
+#include "Image2D.h"
+#include "StaticScene.h"
+#include "EnvironmentMap.h"
+#include "Texture.h"
+
+using namespace std;
+using namespace rt;
+
+int main( int argc, char** argv )
+{
+  int width       = argc > 1 ? atoi( argv[ 1 ] ) : 320;
+  int height      = argc > 2 ? atoi( argv[ 2 ] ) : 240;
+  int max_depth   = argc > 3 ? atoi( argv[ 3 ] ) : 6;
+  int repetitions = argc > 4 ? atoi( argv[ 4 ] ) : 3;
+  int lights      = argc > 5 ? atoi( argv[ 5 ] ) : 0;
+  int particles   = argc > 6 ? atoi( argv[ 6 ] ) : 0;
+
+  Scene scene;
+  buildDemoScene( scene );
+  std::mt19937 random( 17 );
+  std::uniform_real_distribution< Real > uniform( -20.0f, 20.0f );
+  for ( int i = 0; i < lights; ++i )
+    {
+      PointLight* l = new PointLight( GL_LIGHT2,
+                                      Point4( uniform( random ), uniform( random ),
+                                              4.0f + 0.1f * uniform( random ), 1.0f ),
+                                      Color( 0.3, 0.3, 0.3 ) );
+      l->setAttenuation( 1.0f, 0.0f, 0.5f );
+      scene.addLight( l );
+    }
+  std::uniform_real_distribution< Real > unit( 0.0f, 1.0f );
+  for ( int i = 0; i < particles; ++i )
+    scene.addObject( new Sphere( Point3( uniform( random ), uniform( random ),
+                                         4.0f * unit( random ) ),
+                                 0.05f + 0.05f * unit( random ), Material::redPlastic() ) );
+  if ( particles > 0 )
+    {
+      scene.setAcceleration( Scene::Grid );
+      auto start = chrono::steady_clock::now();
+      scene.prepare();
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      cout << "grid build for " << scene.myObjects.size() << " objects: "
+           << elapsed.count() * 1000.0 << " ms" << endl;
+    }
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, width, height );
+  Image2D<Color> image;
+
+  double best = 0.0;
+  for ( int i = 0; i < repetitions; ++i )
+    {
+      auto start = chrono::steady_clock::now();
+      renderer.render( image, max_depth );
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      if ( i == 0 || elapsed.count() < best ) best = elapsed.count();
+    }
+  cout << "demo scene (+" << lights << " lights, +" << particles << " particles) " << width << "x" << height << " depth " << max_depth
+       << ": best " << best * 1000.0 << " ms over " << repetitions << " runs, "
+       << ( width * height ) / best / 1e6 << " Mpixels/s" << endl;
+  cout << "shadow cache: " << renderer.myShadowCacheHits << " hits / "
+       << renderer.myShadowCacheQueries << " queries" << endl;
+
+  // The demo scene as a Scene (virtual intersections) and as a
+  // StaticScene of spheres (inlined intersections), both linear.
+  {
+    Scene dynamic_scene;
+    StaticScene< Sphere > static_scene;
+    buildDemoScene( dynamic_scene );
+    buildDemoScene( static_scene );
+    Renderer dynamic_renderer( dynamic_scene );
+    BasicRenderer< StaticScene< Sphere > > static_renderer( static_scene );
+    dynamic_renderer.setVerbose( false );
+    static_renderer.setVerbose( false );
+    setDemoCamera( dynamic_renderer, width, height );
+    setDemoCamera( static_renderer, width, height );
+    Image2D<Color> out;
+    double dynamic_best = 0.0, static_best = 0.0;
+    for ( int i = 0; i < repetitions; ++i )
+      {
+        auto start = chrono::steady_clock::now();
+        dynamic_renderer.render( out, max_depth );
+        chrono::duration<double> dynamic_time = chrono::steady_clock::now() - start;
+        start = chrono::steady_clock::now();
+        static_renderer.render( out, max_depth );
+        chrono::duration<double> static_time = chrono::steady_clock::now() - start;
+        if ( i == 0 || dynamic_time.count() < dynamic_best ) dynamic_best = dynamic_time.count();
+        if ( i == 0 || static_time.count() < static_best ) static_best = static_time.count();
+      }
+    cout << "demo scene: Scene " << dynamic_best * 1000.0 << " ms, StaticScene "
+         << static_best * 1000.0 << " ms" << endl;
+  }
+
+  // Depth control: a deep render without and with ray termination.
+  {
+    Image2D<Color> deep;
+    const char* names[] = { "no termination", "weight cutoff", "cutoff + roulette" };
+    for ( int mode = 0; mode < 3; ++mode )
+      {
+        renderer.setMinWeight( mode == 0 ? 0.0f : 1.0f / 512.0f );
+        renderer.setRouletteDepth( mode == 2 ? 3 : -1 );
+        auto start = chrono::steady_clock::now();
+        renderer.render( deep, 2 * max_depth );
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << "depth " << 2 * max_depth << ", " << names[ mode ] << ": "
+             << elapsed.count() * 1000.0 << " ms, " << renderer.myCutoffRays << " rays cut, "
+             << renderer.myRouletteRays << " rays killed by the roulette" << endl;
+      }
+    renderer.setMinWeight( 1.0f / 512.0f );
+    renderer.setRouletteDepth( -1 );
+  }
+
+  // Background lookups: the procedural sky, and an environment map
+  // through its lookup table or through the angles of each direction.
+  {
+    // The rays of a wide camera, in scanline order.
+    const int n = 1 << 20;
+    std::vector< Ray > rays( n );
+    for ( int i = 0; i < n; ++i )
+      rays[ i ] = Ray( Point3( 0, 0, 0 ), Vector3( 1.0f, ( i % 1024 ) / 512.0f - 1.0f,
+                                                   1.0f - ( i / 1024 ) / 512.0f ) );
+    Image2D<Vector3> latlong( 2048, 1024 );
+    for ( int y = 0; y < latlong.h(); ++y )
+      for ( int x = 0; x < latlong.w(); ++x )
+        latlong.at( x, y ) = Vector3( x / 2048.0f, y / 1024.0f, ( x ^ y ) % 7 / 7.0f );
+    auto start = chrono::steady_clock::now();
+    EnvironmentMap environment( latlong );
+    chrono::duration<double> build = chrono::steady_clock::now() - start;
+    MyBackground sky;
+    Real sum = 0.0f;
+    start = chrono::steady_clock::now();
+    for ( const Ray& ray : rays ) sum += sky.backgroundColor( ray ).r();
+    chrono::duration<double> procedural = chrono::steady_clock::now() - start;
+    start = chrono::steady_clock::now();
+    for ( const Ray& ray : rays ) sum += environment.lookup( ray.direction )[ 0 ];
+    chrono::duration<double> table = chrono::steady_clock::now() - start;
+    start = chrono::steady_clock::now();
+    for ( const Ray& ray : rays ) sum += environment.lookupExact( ray.direction )[ 0 ];
+    chrono::duration<double> exact = chrono::steady_clock::now() - start;
+    cout << "background (ns/ray): procedural " << procedural.count() * 1e9 / n
+         << ", environment map " << table.count() * 1e9 / n
+         << " (" << exact.count() * 1e9 / n << " without table, built in "
+         << build.count() * 1000.0 << " ms) [" << sum << "]" << endl;
+  }
+
+  // Texture lookups in scanline order, through a cache holding the whole
+  // pyramid, or only 1 MB of it (a sixth).
+  {
+    Image2D<Color> image( 2048, 1024 );
+    for ( int y = 0; y < image.h(); ++y )
+      for ( int x = 0; x < image.w(); ++x )
+        image.at( x, y ) = Color( x / 2048.0f, y / 1024.0f, ( x ^ y ) % 7 / 7.0f );
+    auto start = chrono::steady_clock::now();
+    Texture::build( image, "benchmark_texture.rttx" );
+    chrono::duration<double> build = chrono::steady_clock::now() - start;
+    const int n = 1 << 20;
+    for ( std::size_t budget : { (std::size_t) 64 << 20, (std::size_t) 1 << 20 } )
+      {
+        TextureCache cache( budget );
+        Texture texture( cache, "benchmark_texture.rttx" );
+        Real sum = 0.0f;
+        start = chrono::steady_clock::now();
+        for ( int i = 0; i < n; ++i )
+          sum += texture.lookup( ( i % 1024 ) / 1024.0f, ( i / 1024 ) / 1024.0f, 1.0f / 1024.0f ).r();
+        chrono::duration<double> lookups = chrono::steady_clock::now() - start;
+        cout << "texture (" << ( budget >> 20 ) << " MB cache): "
+             << lookups.count() * 1e9 / n << " ns/lookup, "
+             << cache.myMisses << " tiles read, " << cache.myEvictions << " evicted"
+             << " (built in " << build.count() * 1000.0 << " ms) [" << sum << "]" << endl;
+      }
+    std::remove( "benchmark_texture.rttx" );
+  }
+
+  // Refraction kernels, on random directions and normals.
+  {
+    const int n = 1 << 20;
+    RefractionBatch batch;
+    batch.resize( n );
+    std::uniform_real_distribution< Real > coord( -1.0f, 1.0f );
+    for ( int i = 0; i < n; ++i )
+      {
+        Vector3 v( coord( random ), coord( random ), coord( random ) );
+        Vector3 N( coord( random ), coord( random ), coord( random ) );
+        v /= v.norm();
+        N /= N.norm();
+        batch.vx[ i ] = v[ 0 ]; batch.vy[ i ] = v[ 1 ]; batch.vz[ i ] = v[ 2 ];
+        batch.nx[ i ] = N[ 0 ]; batch.ny[ i ] = N[ 1 ]; batch.nz[ i ] = N[ 2 ];
+        batch.ratio[ i ] = 1.0f / 1.5f;
+      }
+    auto start = chrono::steady_clock::now();
+    Real sum = 0.0f;
+    for ( int i = 0; i < n; ++i )
+      {
+        Vector3 v( batch.vx[ i ], batch.vy[ i ], batch.vz[ i ] );
+        Vector3 N( batch.nx[ i ], batch.ny[ i ], batch.nz[ i ] );
+        bool    out = v.dot( N ) > 0.0f;
+        Real    r   = out ? 1.0f / batch.ratio[ i ] : batch.ratio[ i ];
+        Vector3 t;
+        Real    cos_t;
+        if ( refract( v, out ? -1.0f * N : N, r, t, cos_t ) )
+          sum += t[ 0 ] + schlick( r, std::fabs( v.dot( N ) ), cos_t );
+        else sum += 1.0f;
+      }
+    chrono::duration<double> scalar = chrono::steady_clock::now() - start;
+    start = chrono::steady_clock::now();
+    batch.compute();
+    chrono::duration<double> batched = chrono::steady_clock::now() - start;
+    cout << "refraction + Schlick: " << scalar.count() * 1e9 / n << " ns/ray one at a time, "
+         << batched.count() * 1e9 / n << " ns/ray in batch (checksum " << sum << ")" << endl;
+  }
+
+  // Soft shadows: full and adaptive sampling of a spherical light.
+  {
+    Scene soft;
+    buildDemoScene( soft );
+    PointLight* point = dynamic_cast< PointLight* >( soft.myLights[ 1 ] );
+    soft.myLights[ 1 ] = new SphereLight( GL_LIGHT1, Vector3( point->position.data() ),
+                                          1.0f, point->emission );
+    delete point;
+    Renderer soft_renderer( soft );
+    soft_renderer.setVerbose( false );
+    setDemoCamera( soft_renderer, width, height );
+    Image2D<Color> soft_image;
+    for ( bool adaptive : { false, true } )
+      {
+        soft_renderer.setAdaptiveShadows( adaptive );
+        auto start = chrono::steady_clock::now();
+        soft_renderer.render( soft_image, max_depth );
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << "soft shadows, " << ( adaptive ? "adaptive" : "full" ) << " sampling: "
+             << elapsed.count() * 1000.0 << " ms, "
+             << soft_renderer.myShadowRays << " shadow rays" << endl;
+      }
+  }
+
+  Relighter relighter;
+  relighter.render( renderer, image, max_depth );
+  PointLight* light = dynamic_cast< PointLight* >( scene.myLights[ 1 ] );
+  auto start = chrono::steady_clock::now();
+  light->emission = Color( 1.0, 0.8, 0.6 );
+  relighter.relight( renderer, image, { 1 } );
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "relighting one light: " << elapsed.count() * 1000.0 << " ms ("
+       << relighter.myEvaluations << " light evaluations)" << endl;
+
+  ImageSource    source( image );
+  GaussianBlur   blur( source, 1.0f );
+  Bloom          bloom( blur, 0.8f, 4.0f, 0.5f );
+  Resample       half( bloom, width / 2, height / 2 );
+  Image2D<Color> filtered;
+  for ( int threads : { 1, defaultThreadNumber() } )
+    {
+      start = chrono::steady_clock::now();
+      runFilter( half, filtered, threads );
+      elapsed = chrono::steady_clock::now() - start;
+      cout << "blur + bloom + resize, " << threads << " thread(s): "
+           << elapsed.count() * 1000.0 << " ms" << endl;
+    }
+
+  // Stochastic light selection: error against the render with all lights.
+  Image2D<Color> reference, noisy, denoised;
+  renderer.render( reference, max_depth );
+  auto rmse = [&] ( const Image2D<Color>& img ) {
+    double sum = 0.0;
+    for ( int y = 0; y < height; ++y )
+      for ( int x = 0; x < width; ++x )
+        {
+          Real d = distance( img.at( x, y ), reference.at( x, y ) );
+          sum += d * d;
+        }
+    return sqrt( sum / ( width * height ) );
+  };
+  renderer.setMaxLights( 1 );
+  for ( int samples : { 1, 4, 8 } )
+    {
+      vector< Color > sum( width * height, Color( 0.0, 0.0, 0.0 ) );
+      start = chrono::steady_clock::now();
+      for ( int s = 0; s < samples; ++s )
+        {
+          renderer.render( noisy, max_depth );
+          for ( int y = 0; y < height; ++y )
+            for ( int x = 0; x < width; ++x )
+              sum[ x + y * width ] = sum[ x + y * width ] + noisy.at( x, y );
+        }
+      for ( int y = 0; y < height; ++y )
+        for ( int x = 0; x < width; ++x )
+          noisy.at( x, y ) = sum[ x + y * width ] * ( 1.0f / samples );
+      elapsed = chrono::steady_clock::now() - start;
+      cout << "1 light per point, " << samples << " render(s): rmse " << rmse( noisy )
+           << ", " << elapsed.count() * 1000.0 << " ms" << endl;
+    }
+  RenderPasses   passes;
+  ATrousDenoiser denoiser;
+  start = chrono::steady_clock::now();
+  renderer.render( noisy, max_depth, &passes );
+  chrono::duration<double> render_time = chrono::steady_clock::now() - start;
+  start = chrono::steady_clock::now();
+  denoiser.denoise( noisy, passes, denoised );
+  elapsed = chrono::steady_clock::now() - start;
+  cout << "1 light per point, 1 render + denoise: rmse " << rmse( denoised ) << ", "
+       << render_time.count() * 1000.0 << " + " << elapsed.count() * 1000.0 << " ms" << endl;
+  return 0;
+}
@@ -47,6 +47,8 @@ namespace rt {
         Real rayIntersection(const Ray& ray, Point3& p){
 
         }
+
+        GraphicalObject* clone() const { return new PeriodicPlane( *this ); }
     };
 
 }
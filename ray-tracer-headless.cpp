@@ -0,0 +1,202 @@
+/**
+@file ray-tracer-headless.cpp
+
+Renders the reference scene without any window, e.g. on a render
+node or for profiling.
+
+Usage: ray-tracer-headless [--workers n] [--listen port] [--timeout s] [--tile size] [--mmap] [--env map] [--env-samples n] [width] [height] [max_depth] [output.ppm] [aov_basename]
+       ray-tracer-headless --worker host:port
+
+With aov_basename, the depth, normal, object id and albedo passes are
+also written as PFM images (see RenderPasses). With --workers n, the
+image is split into tiles rendered by n worker processes (see
+DistributedRenderer); the passes are not available in this mode. The
+workers are forked on this machine, unless --listen is given: the n
+workers are then processes started on any machine with --worker
+host:port, which connect to this one on the given TCP port (they must
+connect within 30 s; the environment map is not available in this
+mode). A worker taking more than s seconds (--timeout, 60 by default)
+to render a tile is dropped, and its tile rendered by another one. With
+--mmap, the output file is memory-mapped and rendered into in place
+(see MappedImage), which avoids keeping the image in memory. With --env,
+the background is the latitude-longitude environment map read from the
+given PFM or PPM file (see EnvironmentMap), which also lights the scene
+with n directions sampled per point (--env-samples, 16 by default, 0 for
+a background only).
+*/
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include "Scene.h"
+#include "DemoScene.h"
+#include "Renderer.h"
+#include "DistributedRenderer.h"
+#include "MappedImage.h"
+#include "Image2D.h"
+#include "Image2DWriter.h"
+#include "Image2DReader.h"
+#include "EnvironmentMap.h"
+
+using namespace std;
+using namespace rt;
+
+/// The scene identifier of the jobs sent to remote workers: the demo
+/// scene is the only one they know.
+const int DEMO_SCENE = 0;
+
+/// Builds the scene \a id for a remote worker.
+bool buildScene( Scene& scene, int id )
+{
+  if ( id != DEMO_SCENE ) return false;
+  buildDemoScene( scene );
+  return true;
+}
+
+/// Renders into \a image, with worker processes if \a workers > 0: forked
+/// ones, or remote ones connecting to the socket \a listener if it is >= 0.
+template <typename TImage>
+void renderInto( Renderer& renderer, TImage& image, int max_depth,
+                 int workers, int tile_size, double timeout, int listener,
+                 RenderPasses* passes )
+{
+  if ( workers == 0 )
+    {
+      renderer.render( image, max_depth, passes );
+      return;
+    }
+  DistributedRenderer distributed;
+  distributed.myWorkers     = workers;
+  distributed.myTileSize    = tile_size;
+  distributed.myTileTimeout = timeout;
+  if ( listener < 0 )
+    distributed.render( renderer, image, max_depth );
+  else if ( ! distributed.renderRemote( renderer, image, max_depth, listener, DEMO_SCENE ) )
+    cerr << "Not all of the " << workers << " workers connected." << endl;
+  if ( distributed.myDeadWorkers > 0 )
+    cerr << distributed.myDeadWorkers << " worker(s) lost, "
+         << distributed.myReassignedTiles << " tile(s) reassigned." << endl;
+}
+
+int main( int argc, char** argv )
+{
+  // Options come first, the remaining arguments are positional.
+  int    workers     = 0;
+  int    tile_size   = 64;
+  bool   mapped      = false;
+  string env_name;
+  int    env_samples = 16;
+  int    listen_port = -1;
+  double timeout     = 60.0;
+  string worker;
+  while ( argc > 1 && string( argv[ 1 ] ).compare( 0, 2, "--" ) == 0 )
+    {
+      string option = argv[ 1 ];
+      int    used   = 2;
+      if ( option == "--mmap" )                         { mapped = true; used = 1; }
+      else if ( option == "--workers" && argc > 2 )     workers     = atoi( argv[ 2 ] );
+      else if ( option == "--listen" && argc > 2 )      listen_port = atoi( argv[ 2 ] );
+      else if ( option == "--timeout" && argc > 2 )     timeout     = atof( argv[ 2 ] );
+      else if ( option == "--worker" && argc > 2 )      worker      = argv[ 2 ];
+      else if ( option == "--tile" && argc > 2 )        tile_size   = atoi( argv[ 2 ] );
+      else if ( option == "--env" && argc > 2 )         env_name    = argv[ 2 ];
+      else if ( option == "--env-samples" && argc > 2 ) env_samples = atoi( argv[ 2 ] );
+      else break;
+      argv[ used ] = argv[ 0 ];
+      argv += used;
+      argc -= used;
+    }
+  if ( ! worker.empty() )
+    {
+      // Worker mode: renders the tiles of a remote coordinator.
+      std::size_t colon = worker.rfind( ':' );
+      int         port  = colon == string::npos ? 0 : atoi( worker.c_str() + colon + 1 );
+      if ( port <= 0 || port > 65535 )
+        {
+          cerr << "Usage: " << argv[ 0 ] << " --worker host:port" << endl;
+          return 1;
+        }
+      if ( ! DistributedRenderer::work( worker.substr( 0, colon ), port, buildScene ) )
+        {
+          cerr << "Unable to work for " << worker << endl;
+          return 2;
+        }
+      return 0;
+    }
+  int    width     = argc > 1 ? atoi( argv[ 1 ] ) : 640;
+  int    height    = argc > 2 ? atoi( argv[ 2 ] ) : 480;
+  int    max_depth = argc > 3 ? atoi( argv[ 3 ] ) : 6;
+  string out_name  = argc > 4 ? argv[ 4 ] : "output.ppm";
+  string aov_name  = argc > 5 ? argv[ 5 ] : "";
+  if ( width <= 1 || height <= 1 || max_depth < 0 || workers < 0 || tile_size <= 0
+       || env_samples < 0 || listen_port > 65535
+       || ( listen_port >= 0 && ( workers == 0 || ! env_name.empty() ) )
+       || ( workers > 0 && ! aov_name.empty() ) )
+    {
+      cerr << "Usage: " << argv[ 0 ] << " [--workers n] [--listen port] [--timeout s] [--tile size] [--mmap] [--env map] [--env-samples n] [width] [height] [max_depth] [output.ppm] [aov_basename]" << endl;
+      return 1;
+    }
+
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  setDemoCamera( renderer, width, height );
+  std::unique_ptr< EnvironmentMap > environment;
+  if ( ! env_name.empty() )
+    {
+      ifstream input( env_name.c_str(), ios::binary );
+      Image2D<Vector3> latlong;
+      if ( ! Image2DReader<Vector3>::read( latlong, input ) )
+        {
+          cerr << "Unable to read the environment map " << env_name << endl;
+          return 2;
+        }
+      environment.reset( new EnvironmentMap( latlong ) );
+      renderer.setBackground( *environment );
+      if ( env_samples > 0 ) renderer.setEnvironmentLight( environment.get(), env_samples );
+    }
+  int listener = -1;
+  if ( listen_port >= 0 && ( listener = DistributedRenderer::listenOn( listen_port ) ) < 0 )
+    {
+      cerr << "Unable to listen on port " << listen_port << endl;
+      return 2;
+    }
+  RenderPasses  passes;
+  RenderPasses* ptr_passes = aov_name.empty() ? 0 : &passes;
+  if ( mapped )
+    {
+      MappedImage image = createMappedPPM( out_name, width, height );
+      if ( image.w() != width )
+        {
+          cerr << "Unable to map " << out_name << endl;
+          return 2;
+        }
+      renderInto( renderer, image, max_depth, workers, tile_size, timeout, listener,
+                  ptr_passes );
+      if ( ! image.container().sync() )
+        {
+          cerr << "Unable to write " << out_name << endl;
+          return 2;
+        }
+    }
+  else
+    {
+      Image2D<Color> image( width, height );
+      renderInto( renderer, image, max_depth, workers, tile_size, timeout, listener,
+                  ptr_passes );
+      ofstream output( out_name.c_str(), ios::binary );
+      if ( ! output.good() )
+        {
+          cerr << "Unable to open " << out_name << endl;
+          return 2;
+        }
+      Image2DWriter<Color>::write( image, output, false );
+      output.close();
+    }
+  if ( ! aov_name.empty() && ! passes.write( aov_name ) )
+    {
+      cerr << "Unable to write the passes " << aov_name << "_*.pfm" << endl;
+      return 2;
+    }
+  return 0;
+}
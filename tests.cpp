@@ -1,23 +1,1177 @@
 #include <iostream>
-#include "PointVecteur.h"
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include "PointVector.h"
+#include "Scene.h"
+#include "DemoScene.h"
+#include "Renderer.h"
+#include "Animation.h"
+#include "RenderCache.h"
+#include "Relighter.h"
+#include "DistributedRenderer.h"
+#include "MappedImage.h"
+#include "ImageFilters.h"
+#include "Denoiser.h"
+#include "AreaLight.h"
+#include "Image2DWriter.h"
+#include "StaticScene.h"
+#include "Image2DReader.h"
+#include "EnvironmentMap.h"
+#include "Texture.h"
 
 using namespace std;
 using namespace rt;
 
+/// The largest difference accepted between renders of the same pixels
+/// along different code paths (with or without passes, into a tiled
+/// image, in worker processes, from a snapshot, through StaticScene). The
+/// tests are built like the renderer, with floating-point contraction:
+/// a*b+c becomes a fused multiply-add or not depending on where the
+/// compiler inlines it, which changes the last bits of hit points and
+/// shading. 1024 ulps of a full channel, far below the 1/255 step of the
+/// 8-bit output.
+const Real RENDER_TOLERANCE = 1024.0f * std::numeric_limits< Real >::epsilon();
+
 bool testPointVecteur()
 {
   Point3 p = { 1.0, 0.0, 0.0 };
   cout << "p=" << p << endl;
-  Vecteur3 w = { 0.5, 3.0, 2.0 };
+  Vector3 w = { 0.5, 3.0, 2.0 };
   cout << "w=" << w << endl;
   cout << "p+w=" << p+w << endl;
   cout << "p-w=" << p-w << endl;
   cout << "||w||^2=" << w.dot(w) << endl;
-  return true;
+  return p.dot( w ) == 0.5f && ( p - w ).dot( p - w ) == 13.25f;
 }
 
-int main( int argc, char* argv[] )
+bool testRender()
 {
-  bool ok = testPointVecteur();
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 32, 24 );
+  Image2D<Color> image;
+  renderer.render( image, 3 );
+  Real sum = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      sum += image.at( x, y ).max();
+  cout << "render: mean max channel=" << sum / ( image.w() * image.h() ) << endl;
+  return image.w() == 32 && image.h() == 24 && sum > 0.0f;
+}
+
+bool testLightCuller()
+{
+  std::vector< Light* > lights;
+  for ( int i = 0; i < 10; ++i )
+    {
+      PointLight* l = new PointLight( GL_LIGHT0, Point4( 10.0f * i, 0, 0, 1 ),
+                                      Color( 1.0, 1.0, 1.0 ) );
+      l->setAttenuation( 1.0f, 0.0f, 1.0f );
+      lights.push_back( l );
+    }
+  lights.push_back( new PointLight( GL_LIGHT1, Point4( 0, 0, 1, 0 ), Color( 1.0, 1.0, 1.0 ) ) );
+  LightCuller culler;
+  culler.build( lights, 0.01f ); // radius is sqrt(99), about 9.95
+  const std::vector< int >& near = culler.lightsAt( Point3( 41.0f, 0.0f, 0.0f ) );
+  bool ok = std::find( near.begin(), near.end(), 4 ) != near.end()
+    && std::find( near.begin(), near.end(), 10 ) != near.end()
+    && std::find( near.begin(), near.end(), 0 ) == near.end()
+    && std::find( near.begin(), near.end(), 8 ) == near.end();
+  // A draw at 0 must not choose (nor go before) a null estimate.
+  struct Zero {
+    typedef unsigned int result_type;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 1u << 30; }
+    result_type operator()() { return 0; }
+  } zero;
+  std::vector< std::pair< int, Real > > chosen;
+  LightCuller::select( { 7, 8, 9 }, { 0.0f, 0.0f, 2.0f }, 2, zero, chosen );
+  ok = ok && chosen.size() == 2 && chosen[ 0 ].first == 9 && chosen[ 0 ].second == 0.5f;
+  cout << "light culler: " << near.size() << " lights near x=41" << endl;
+  for ( Light* l : lights ) delete l;
+  return ok;
+}
+
+bool testShadowCache()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> cached, uncached;
+  renderer.render( cached, 3 );
+  long hits = renderer.myShadowCacheHits;
+  renderer.setShadowCache( false );
+  renderer.render( uncached, 3 );
+  int diff = 0;
+  for ( int y = 0; y < cached.h(); ++y )
+    for ( int x = 0; x < cached.w(); ++x )
+      if ( distance( cached.at( x, y ), uncached.at( x, y ) ) > 1.0f / 255.0f ) ++diff;
+  cout << "shadow cache: " << hits << " hits, " << diff << " different pixels" << endl;
+  return hits > 0 && diff == 0;
+}
+
+bool testReflectance()
+{
+  // The top of a sphere seen from above, under three directional lights:
+  // one above it, one hidden by a small opaque sphere, one below it.
+  Scene scene;
+  Sphere* sphere = new Sphere( Point3( 0, 0, 0 ), 1.0f, Material::whitePlastic() );
+  scene.addObject( sphere );
+  scene.addObject( new Sphere( Point3( 3, 0, 4 ), 0.5f, Material::redPlastic() ) );
+  Color c( 0.2f, 0.2f, 0.2f );
+  scene.addLight( new PointLight( GL_LIGHT0, Point4( 0, 0, 1, 0 ), c ) );
+  scene.addLight( new PointLight( GL_LIGHT1, Point4( 1, 0, 1, 0 ), c ) );
+  scene.addLight( new PointLight( GL_LIGHT2, Point4( 0, 0, -1, 0 ), c ) );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  renderer.setLightThreshold( 0.0f );
+  setDemoCamera( renderer, 4, 3 );
+  renderer.prepare();
+  Ray   ray( Point3( 0, 0, 5 ), Vector3( 0, 0, -1 ), 1 );
+  Color result = renderer.illumination( ray, sphere, Point3( 0, 0, 1 ),
+                                        renderer.material( sphere, Point3( 0, 0, 1 ) ) );
+  // The first light only: diffuse and specular both at cos = 1, plus
+  // the ambient color. The light below casts no shadow ray.
+  const Material m = Material::whitePlastic();
+  Color expected( c.r() * ( m.diffuse.r() + m.specular.r() ) + m.ambient.r(),
+                  c.g() * ( m.diffuse.g() + m.specular.g() ) + m.ambient.g(),
+                  c.b() * ( m.diffuse.b() + m.specular.b() ) + m.ambient.b() );
+  cout << "reflectance: error " << distance( result, expected ) << ", "
+       << renderer.myShadowRays << " shadow rays" << endl;
+  return distance( result, expected ) < 1e-5f && renderer.myShadowRays == 2;
+}
+
+/// Adds \a n random small spheres in the box [-10,10]^3.
+void addParticles( Scene& scene, int n, unsigned int seed )
+{
+  std::mt19937 random( seed );
+  std::uniform_real_distribution< Real > uniform( -10.0f, 10.0f );
+  for ( int i = 0; i < n; ++i )
+    scene.addObject( new Sphere( Point3( uniform( random ), uniform( random ), uniform( random ) ),
+                                 0.2f + 0.02f * uniform( random ), Material::redPlastic() ) );
+}
+
+bool testUniformGrid()
+{
+  Scene linear, grid;
+  addParticles( linear, 2000, 3 );
+  addParticles( grid, 2000, 3 );
+  grid.setAcceleration( Scene::Grid );
+  grid.prepare( 4 );
+  std::mt19937 random( 5 );
+  std::uniform_real_distribution< Real > uniform( -15.0f, 15.0f );
+  int errors = 0, hits = 0;
+  for ( int i = 0; i < 2000; ++i )
+    {
+      Ray ray( Point3( uniform( random ), uniform( random ), uniform( random ) ),
+               Vector3( uniform( random ), uniform( random ), uniform( random ) ) );
+      GraphicalObject *o1, *o2;
+      Point3 p1( 0, 0, 0 ), p2( 0, 0, 0 );
+      Real d1 = linear.rayIntersection( ray, o1, p1 );
+      Real d2 = grid.rayIntersection( ray, o2, p2 );
+      if ( d1 <= 0 ) ++hits;
+      if ( ( d1 <= 0 ) != ( d2 <= 0 ) || ( d1 <= 0 && distance( p1, p2 ) > 1e-4f ) ) ++errors;
+    }
+  cout << "uniform grid: " << hits << " hits, " << errors << " differences" << endl;
+  return errors == 0 && hits > 0;
+}
+
+bool testGridRefit()
+{
+  Scene linear, grid;
+  addParticles( linear, 1000, 7 );
+  addParticles( grid, 1000, 7 );
+  grid.setAcceleration( Scene::Grid );
+  grid.prepare();
+  // Small moves (most objects keep their cells) and a few large ones.
+  std::vector< int > moved;
+  for ( int i = 0; i < 1000; i += 3 )
+    {
+      Vector3 t = ( i % 10 == 0 ) ? Vector3( 5.0f, 0.0f, 0.0f ) : Vector3( 0.0f, 0.01f, 0.0f );
+      linear.myObjects[ i ]->translate( t );
+      grid.myObjects[ i ]->translate( t );
+      moved.push_back( i );
+    }
+  grid.refit( moved );
+  std::mt19937 random( 11 );
+  std::uniform_real_distribution< Real > uniform( -15.0f, 15.0f );
+  int errors = 0;
+  for ( int i = 0; i < 2000; ++i )
+    {
+      Ray ray( Point3( uniform( random ), uniform( random ), uniform( random ) ),
+               Vector3( uniform( random ), uniform( random ), uniform( random ) ) );
+      GraphicalObject *o1, *o2;
+      Point3 p1( 0, 0, 0 ), p2( 0, 0, 0 );
+      Real d1 = linear.rayIntersection( ray, o1, p1 );
+      Real d2 = grid.rayIntersection( ray, o2, p2 );
+      if ( ( d1 <= 0 ) != ( d2 <= 0 ) || ( d1 <= 0 && distance( p1, p2 ) > 1e-4f ) ) ++errors;
+    }
+  cout << "grid refit: " << grid.myGrid.loose().size() << " loose objects, "
+       << errors << " differences" << endl;
+  return errors == 0;
+}
+
+bool testAnimation()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  scene.setAcceleration( Scene::Grid );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 16, 12 );
+  Animation animation;
+  animation.addCameraKey( 0.0f, renderer.myOrigin, renderer.myDirUL, renderer.myDirUR,
+                          renderer.myDirLL, renderer.myDirLR );
+  animation.addCameraKey( 1.0f, renderer.myOrigin + Vector3( 1.0f, 0.0f, 0.0f ),
+                          renderer.myDirUL, renderer.myDirUR, renderer.myDirLL, renderer.myDirLR );
+  Sphere* sphere = dynamic_cast< Sphere* >( scene.myObjects[ 0 ] );
+  Point3 center  = sphere->center;
+  animation.addObjectKey( sphere, 0.0f, Vector3( 0.0f, 0.0f, 0.0f ) );
+  animation.addObjectKey( sphere, 1.0f, Vector3( 0.0f, 0.0f, 2.0f ) );
+  int nb = animation.render( scene, renderer, "test_frame", 2.0f, 16, 12, 2 );
+  cout << "animation: " << nb << " frames" << endl;
+  return nb == 3 && distance( sphere->center, center ) < 1e-5f;
+}
+
+bool testRenderCache()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 64, 48 );
+  Image2D<Color> reference, image;
+  renderer.render( reference, 3 );
+  RenderCache cache;
+  cache.render( renderer, image, 3 );
+  Real first = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      first = std::max( first, distance( image.at( x, y ), reference.at( x, y ) ) );
+  cache.render( renderer, image, 3 );
+  bool reused = cache.myReused == 64 * 48;
+  // A small camera move: most pixels come from the previous frame.
+  Vector3 t( 0.05f, 0.0f, 0.0f );
+  renderer.setViewBox( renderer.myOrigin + t, renderer.myDirUL, renderer.myDirUR,
+                       renderer.myDirLL, renderer.myDirLR );
+  cache.render( renderer, image, 3 );
+  renderer.render( reference, 3 );
+  Real error = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      error += distance( image.at( x, y ), reference.at( x, y ) );
+  error /= image.w() * image.h();
+  cout << "render cache: " << cache.myReused << " reused, " << cache.myShaded << " shaded, "
+       << cache.myTraced << " traced, mean error " << error;
+  bool moved = cache.myReused + cache.myShaded + cache.myTraced == 64 * 48
+    && cache.myTraced < 64 * 48 / 2 && error < 0.02f;
+  auto maxDifference = [&] () {
+    renderer.render( reference, 3 );
+    Real d = 0.0f;
+    for ( int y = 0; y < image.h(); ++y )
+      for ( int x = 0; x < image.w(); ++x )
+        d = std::max( d, distance( image.at( x, y ), reference.at( x, y ) ) );
+    return d;
+  };
+  // A light edited after a reprojection: everything is traced again.
+  PointLight* light = dynamic_cast< PointLight* >( scene.myLights[ 1 ] );
+  light->position = Point4( -6, 2, 8, 1 );
+  scene.lightChanged( 1 );
+  cache.render( renderer, image, 3 );
+  Real d1 = maxDifference();
+  bool retraced = cache.myTraced == 64 * 48;
+  // Then only relit, here from a snapshot of the scene.
+  light->emission = Color( 1.0, 0.5, 0.2 );
+  scene.lightChanged( 1 );
+  std::unique_ptr< Scene > copy( scene.snapshot() );
+  renderer.setScene( *copy );
+  cache.render( renderer, image, 3 );
+  renderer.setScene( scene );
+  Real d2 = maxDifference();
+  bool relit = cache.myShaded == 64 * 48;
+  // An edited material: everything is traced again.
+  Sphere* bronze = dynamic_cast< Sphere* >( scene.myObjects[ 0 ] );
+  bronze->material.diffuse = Color( 0.1, 0.2, 0.9 );
+  scene.objectsChanged();
+  cache.render( renderer, image, 3 );
+  Real d3 = maxDifference();
+  bool edited = cache.myTraced == 64 * 48;
+  cout << ", differences " << d1 << " " << d2 << " " << d3 << endl;
+  return first < 1e-4f && reused && moved && retraced && relit && edited
+    && d1 < 1e-4f && d2 < 1e-4f && d3 < 1e-4f;
+}
+
+bool testRenderPasses()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 32, 24 );
+  Image2D<Color> reference, image;
+  RenderPasses passes;
+  renderer.render( reference, 3 );
+  renderer.render( image, 3, &passes );
+  int differences = 0, hits = 0;
+  bool consistent = true;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      {
+        if ( distance( image.at( x, y ), reference.at( x, y ) ) > RENDER_TOLERANCE ) ++differences;
+        int id = passes.objectId.at( x, y );
+        if ( id < 0 ) continue;
+        ++hits;
+        // The depth gives back the hit point, whose normal is the normal pass.
+        Ray     ray = renderer.eyeRay( x, y, 0 );
+        Point3  p   = ray.origin + passes.depth.at( x, y ) * ray.direction;
+        Vector3 n   = scene.myObjects[ id ]->getNormal( p );
+        consistent  = consistent && ( n / n.norm() ).dot( passes.normal.at( x, y ) ) > 0.999f;
+      }
+  bool written = passes.write( "test_aov" );
+  std::ifstream input( "test_aov_depth.pfm", std::ios::binary | std::ios::ate );
+  long size = (long) input.tellg();
+  cout << "render passes: " << hits << " hits, " << differences << " differences, "
+       << size << " bytes of depth" << endl;
+  return differences == 0 && hits > 0 && consistent && written
+    && size == (long) ( string( "Pf\n32 24\n-1.0\n" ).size() + 32 * 24 * sizeof( float ) );
+}
+
+bool testRelighter()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 48, 36 );
+  Image2D<Color> reference, image;
+  auto maxDifference = [&] () {
+    renderer.render( reference, 4 );
+    Real d = 0.0f;
+    for ( int y = 0; y < image.h(); ++y )
+      for ( int x = 0; x < image.w(); ++x )
+        d = std::max( d, distance( image.at( x, y ), reference.at( x, y ) ) );
+    return d;
+  };
+  Relighter relighter;
+  relighter.render( renderer, image, 4 );
+  Real d0 = maxDifference();
+  long full = relighter.myEvaluations;
+  // Moves and tints one light.
+  PointLight* light = dynamic_cast< PointLight* >( scene.myLights[ 1 ] );
+  light->position = Point4( -6, 2, 8, 1 );
+  light->emission = Color( 1.0, 0.5, 0.2 );
+  relighter.relight( renderer, image, { 1 } );
+  Real d1 = maxDifference();
+  long partial = relighter.myEvaluations;
+  // Changes an opaque material, then the transparent one.
+  Sphere* bronze = dynamic_cast< Sphere* >( scene.myObjects[ 0 ] );
+  bronze->material.diffuse   = Color( 0.1, 0.2, 0.9 );
+  bronze->material.shinyness = 5.0f;
+  relighter.updateMaterials( renderer, image, { bronze } );
+  Real d2 = maxDifference();
+  Sphere* bubble = dynamic_cast< Sphere* >( scene.myObjects[ 3 ] );
+  bubble->material.diffuse = Color( 0.5, 1.0, 0.5 );
+  relighter.updateMaterials( renderer, image, { bubble } );
+  Real d3 = maxDifference();
+  cout << "relighter: differences " << d0 << " " << d1 << " " << d2 << " " << d3
+       << ", " << partial << "/" << full << " light evaluations to relight" << endl;
+  return d0 < 1e-4f && d1 < 1e-4f && d2 < 1e-4f && d3 < 1e-4f && 2 * partial == full;
+}
+
+bool testDistributedRenderer()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 50, 40 );
+  Image2D<Color> reference, image;
+  renderer.render( reference, 3 );
+  // Three workers, one of which dies on its second tile.
+  DistributedRenderer distributed;
+  distributed.myWorkers   = 3;
+  distributed.myTileSize  = 16;
+  distributed.myFailAfter = 1;
+  bool started = distributed.render( renderer, image, 3 );
+  auto maxDifference = [&] () {
+    Real d = 0.0f;
+    for ( int y = 0; y < image.h(); ++y )
+      for ( int x = 0; x < image.w(); ++x )
+        d = std::max( d, distance( image.at( x, y ), reference.at( x, y ) ) );
+    return d;
+  };
+  Real d          = maxDifference();
+  int  dead       = distributed.myDeadWorkers;
+  int  reassigned = distributed.myReassignedTiles;
+  bool failed = started && distributed.myDeadWorkers == 1
+    && distributed.myReassignedTiles == 1 && distributed.myLocalTiles == 0;
+  // One of which hangs on its first tile, and is dropped after a timeout.
+  distributed.myFailAfter   = -1;
+  distributed.myHangAfter   = 0;
+  distributed.myTileTimeout = 0.5;
+  image = Image2D<Color>();
+  started = distributed.render( renderer, image, 3 );
+  Real dh = maxDifference();
+  bool hung = started && distributed.myDeadWorkers == 1
+    && distributed.myReassignedTiles == 1 && distributed.myLocalTiles == 0;
+  // Two remote workers, forked here, connecting over TCP.
+  distributed.myHangAfter = -1;
+  distributed.myWorkers   = 2;
+  int listener = DistributedRenderer::listenOn( 0 );
+  int port     = DistributedRenderer::localPort( listener );
+  std::vector< pid_t > pids;
+  for ( int k = 0; k < 2 && listener >= 0; ++k )
+    {
+      pid_t pid = fork();
+      if ( pid == 0 )
+        {
+          close( listener );
+          bool ok = DistributedRenderer::work( "127.0.0.1", port, [] ( Scene& s, int id ) {
+              buildDemoScene( s );
+              return id == 7;
+            } );
+          _exit( ok ? 0 : 1 );
+        }
+      pids.push_back( pid );
+    }
+  image = Image2D<Color>();
+  started = listener >= 0
+    && distributed.renderRemote( renderer, image, 3, listener, 7 );
+  Real dr = maxDifference();
+  bool remote = started && distributed.myDeadWorkers == 0 && distributed.myLocalTiles == 0;
+  for ( pid_t pid : pids )
+    {
+      int status = 1;
+      waitpid( pid, &status, 0 );
+      remote = remote && WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+    }
+  if ( listener >= 0 ) close( listener );
+  cout << "distributed: " << dead << " dead worker, " << reassigned
+       << " tile reassigned, difference " << d
+       << ", hung worker difference " << dh << ", remote difference " << dr << endl;
+  return failed && hung && remote
+    && d <= RENDER_TOLERANCE && dh <= RENDER_TOLERANCE && dr <= RENDER_TOLERANCE;
+}
+
+bool testMappedImage()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> reference;
+  renderer.render( reference, 3 );
+  std::ostringstream expected;
+  Image2DWriter<Color>::write( reference, expected, false );
+  {
+    // An image of another size keeps its file: nothing is rendered.
+    MappedImage small = createMappedPPM( "test_mapped.ppm", 20, 15 );
+    if ( renderer.render( small, 3 ) || small.w() != 20 ) return false;
+  }
+  {
+    MappedImage image = createMappedPPM( "test_mapped.ppm", 40, 30 );
+    if ( image.w() != 40 ) return false;
+    renderer.render( image, 3 );
+    if ( ! image.container().sync() ) return false;
+  }
+  std::ifstream input( "test_mapped.ppm", std::ios::binary );
+  std::string written( ( std::istreambuf_iterator<char>( input ) ), std::istreambuf_iterator<char>() );
+  std::string pixels = expected.str();
+  pixels = pixels.substr( pixels.size() - 40 * 30 * 3 );
+  bool ok = written.compare( 0, 13, "P6\n40 30\n255\n" ) == 0
+    && written.size() == 13 + pixels.size()
+    && written.compare( 13, std::string::npos, pixels ) == 0;
+  cout << "mapped image: " << written.size() << " bytes written in place" << endl;
   return ok;
 }
+
+template <typename TLayout>
+bool checkLayout( const char* name )
+{
+  typedef Image2D< Color, std::vector< Color >, TLayout > Image;
+  Image          image( 37, 21 );
+  Image2D<Color> reference( 37, 21 );
+  for ( int y = 0; y < 21; ++y )
+    for ( int x = 0; x < 37; ++x )
+      {
+        image.at( x, y )     = Color( x / 37.0f, y / 21.0f, 0.5f );
+        reference.at( x, y ) = Color( x / 37.0f, y / 21.0f, 0.5f );
+      }
+  Image2D<Color> row_major = image.toRowMajor();
+  int differences = 0;
+  for ( int y = 0; y < 21; ++y )
+    for ( int x = 0; x < 37; ++x )
+      if ( distance( image.at( x, y ), reference.at( x, y ) ) != 0.0f
+           || distance( row_major.at( x, y ), reference.at( x, y ) ) != 0.0f )
+        ++differences;
+  std::ostringstream written, expected;
+  Image2DWriter<Color>::write( image, written, false );
+  Image2DWriter<Color>::write( reference, expected, false );
+  // The iterators go line by line, the storage iterators over the container.
+  auto it = reference.begin();
+  for ( const Color& c : image )
+    if ( distance( c, *it++ ) != 0.0f ) ++differences;
+  long nb = std::distance( image.storageBegin(), image.storageEnd() );
+  cout << "layout " << name << ": " << differences << " differences, "
+       << nb << " stored pixels" << endl;
+  return differences == 0 && written.str() == expected.str() && nb >= 37 * 21
+    && it == reference.end();
+}
+
+bool testImageLayouts()
+{
+  bool ok = checkLayout< TiledLayout< 8 > >( "tiled 8x8" );
+  ok = checkLayout< MortonLayout< 3 > >( "morton 8x8" ) && ok;
+  // Renders into a tiled image.
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> reference;
+  Image2D< Color, std::vector< Color >, TiledLayout< 16 > > tiled;
+  renderer.render( reference, 2 );
+  renderer.render( tiled, 2 );
+  Real d = 0.0f;
+  for ( int y = 0; y < 30; ++y )
+    for ( int x = 0; x < 40; ++x )
+      d = std::max( d, distance( tiled.at( x, y ), reference.at( x, y ) ) );
+  return ok && d <= RENDER_TOLERANCE;
+}
+
+bool testImageFilters()
+{
+  // A noisy image with an edge.
+  std::mt19937 random( 5 );
+  std::uniform_real_distribution< Real > noise( -0.1f, 0.1f );
+  Image2D<Color> image( 60, 42 );
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      {
+        Real v = ( x < 30 ? 0.2f : 0.8f ) + noise( random );
+        image.at( x, y ) = Color( v, 0.5f * v, 0.3f );
+      }
+  ImageSource source( image );
+  // The separable blur against a direct 2D convolution.
+  GaussianBlur blur( source, 1.5f );
+  Image2D<Color> blurred, blurred4;
+  runFilter( blur, blurred, 1 );
+  runFilter( blur, blurred4, 4 );
+  std::vector< Real > kernel = gaussianKernel( 1.5f );
+  int r = (int) kernel.size() / 2;
+  Real d = 0.0f, d4 = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      {
+        Real sum = 0.0f;
+        for ( int j = -r; j <= r; ++j )
+          for ( int i = -r; i <= r; ++i )
+            sum += kernel[ i + r ] * kernel[ j + r ]
+              * image.at( std::max( 0, std::min( image.w() - 1, x + i ) ),
+                          std::max( 0, std::min( image.h() - 1, y + j ) ) ).r();
+        d  = std::max( d, std::fabs( sum - blurred.at( x, y ).r() ) );
+        d4 = std::max( d4, distance( blurred.at( x, y ), blurred4.at( x, y ) ) );
+      }
+  // Blurring an image in place gives the same result.
+  Image2D<Color> in_place = image;
+  ImageSource    in_place_source( in_place );
+  GaussianBlur   in_place_blur( in_place_source, 1.5f );
+  runFilter( in_place_blur, in_place, 4 );
+  Real di = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      di = std::max( di, distance( in_place.at( x, y ), blurred.at( x, y ) ) );
+  // Downsampling by 2 with a box filter averages 2x2 blocks.
+  Resample half( source, 30, 21, Resample::Box );
+  Image2D<Color> small;
+  runFilter( half, small );
+  Real ds = 0.0f;
+  for ( int y = 0; y < small.h(); ++y )
+    for ( int x = 0; x < small.w(); ++x )
+      {
+        Real avg = 0.25f * ( image.at( 2 * x, 2 * y ).r() + image.at( 2 * x + 1, 2 * y ).r()
+                             + image.at( 2 * x, 2 * y + 1 ).r() + image.at( 2 * x + 1, 2 * y + 1 ).r() );
+        ds = std::max( ds, std::fabs( avg - small.at( x, y ).r() ) );
+      }
+  // Denoising keeps the edge and removes most of the noise.
+  BilateralDenoise denoise( source, 3, 2.0f, 0.15f );
+  Image2D<Color> clean;
+  runFilter( denoise, clean );
+  Real error_before = 0.0f, error_after = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      {
+        Real v = x < 30 ? 0.2f : 0.8f;
+        error_before += std::fabs( image.at( x, y ).r() - v );
+        error_after  += std::fabs( clean.at( x, y ).r() - v );
+      }
+  // A whole chain in one pass.
+  Bloom          bloom( blur, 0.7f, 2.0f, 0.5f );
+  Resample       thumbnail( bloom, 20, 14, Resample::Mitchell );
+  Image2D<Color> result;
+  runFilter( thumbnail, result );
+  cout << "filters: blur error " << d << ", threads " << d4 << ", in place " << di
+       << ", box resize " << ds
+       << ", denoise " << error_before << " -> " << error_after << endl;
+  return d < 1e-5f && d4 == 0.0f && di == 0.0f && ds < 1e-5f && error_after < 0.3f * error_before
+    && result.w() == 20 && result.h() == 14;
+}
+
+bool testDenoiser()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 128, 96 );
+  Image2D<Color> reference, noisy, denoised;
+  RenderPasses   passes;
+  renderer.render( reference, 2 );
+  // One light chosen at random per point: noisy.
+  renderer.setMaxLights( 1 );
+  renderer.render( noisy, 2, &passes );
+  ATrousDenoiser denoiser;
+  denoiser.denoise( noisy, passes, denoised );
+  Real error_noisy = 0.0f, error_denoised = 0.0f;
+  for ( int y = 0; y < noisy.h(); ++y )
+    for ( int x = 0; x < noisy.w(); ++x )
+      {
+        Real dn = distance( noisy.at( x, y ), reference.at( x, y ) );
+        Real dd = distance( denoised.at( x, y ), reference.at( x, y ) );
+        error_noisy    += dn * dn;
+        error_denoised += dd * dd;
+      }
+  cout << "denoiser: squared error " << error_noisy << " -> " << error_denoised << endl;
+  return error_denoised < 0.5f * error_noisy;
+}
+
+bool testAreaLights()
+{
+  // A ground (large sphere), a ball above it, and a square light above
+  // the ball; a small spherical light under a second ball.
+  Scene scene;
+  scene.addObject( new Sphere( Point3( 0, 0, -1000 ), 1000.0f, Material::whitePlastic() ) );
+  scene.addObject( new Sphere( Point3( 0, 0, 2 ), 1.0f, Material::redPlastic() ) );
+  scene.addObject( new Sphere( Point3( 20, 0, 8 ), 1.0f, Material::redPlastic() ) );
+  QuadLight*   quad   = new QuadLight( GL_LIGHT0, Point3( 0, 0, 5 ), Vector3( 2, 0, 0 ),
+                                       Vector3( 0, 2, 0 ), Color( 1.0, 1.0, 1.0 ) );
+  SphereLight* sphere = new SphereLight( GL_LIGHT1, Point3( 20, 0, 5 ), 0.5f,
+                                         Color( 1.0, 1.0, 1.0 ) );
+  scene.addLight( quad );
+  scene.addLight( sphere );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  renderer.prepare();
+  Color white( 1.0, 1.0, 1.0 );
+  // Umbra under the ball, penumbra around, full light far from it.
+  Real umbra = renderer.softShadow( 0, Point3( 0, 0, 0 ), white ).max();
+  Real lit   = renderer.softShadow( 0, Point3( 6, 0, 0 ), white ).max();
+  int  penumbra = 0;
+  for ( Real x = 0.0f; x < 6.0f; x += 0.1f )
+    {
+      Real v = renderer.softShadow( 0, Point3( x, 0, 0 ), white ).max();
+      if ( v > 0.0f && v < 1.0f ) ++penumbra;
+    }
+  // The ball above the spherical light does not shadow the ground.
+  Real below = renderer.softShadow( 1, Point3( 20, 0, 0 ), white ).max();
+  // The shadows are sampled from the lights baked by prepare().
+  quad->position[ 0 ] += 100.0f;
+  Real baked = renderer.softShadow( 0, Point3( 0, 0, 0 ), white ).max();
+  quad->position[ 0 ] -= 100.0f;
+
+  // Adaptive sampling casts fewer rays for about the same image.
+  renderer.setLookAt( Point3( 4.0f, -10.0f, 8.0f ), Point3( 4.0f, 0.0f, 0.0f ),
+                      Vector3( 0.0f, 0.0f, 1.0f ), 45.0f, 4.0f / 3.0f );
+  renderer.setResolution( 64, 48 );
+  Image2D<Color> adaptive, full;
+  renderer.render( adaptive, 1 );
+  long adaptive_rays = renderer.myShadowRays;
+  renderer.setAdaptiveShadows( false );
+  renderer.render( full, 1 );
+  long full_rays = renderer.myShadowRays;
+  Real error = 0.0f;
+  for ( int y = 0; y < full.h(); ++y )
+    for ( int x = 0; x < full.w(); ++x )
+      error += distance( adaptive.at( x, y ), full.at( x, y ) );
+  error /= full.w() * full.h();
+  cout << "area lights: umbra " << umbra << ", lit " << lit << ", " << penumbra
+       << " penumbra points, below " << below << ", shadow rays " << adaptive_rays
+       << " (adaptive) / " << full_rays << ", mean difference " << error << endl;
+  return umbra == 0.0f && lit == 1.0f && penumbra > 5 && below == 1.0f && baked == 0.0f
+    && 2 * adaptive_rays < full_rays && error < 0.01f;
+}
+
+bool testRayTermination()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 64, 48 );
+  Image2D<Color> reference, cut, roulette;
+  renderer.setMinWeight( 0.0f );
+  renderer.render( reference, 4 );
+  renderer.setMinWeight( 1.0f / 512.0f );
+  renderer.render( cut, 4 );
+  long cut_rays = renderer.myCutoffRays;
+  Real cut_error = 0.0f;
+  for ( int y = 0; y < cut.h(); ++y )
+    for ( int x = 0; x < cut.w(); ++x )
+      cut_error = std::max( cut_error, distance( cut.at( x, y ), reference.at( x, y ) ) );
+  // The russian roulette is unbiased: the mean of several renders
+  // converges to the reference.
+  renderer.setRouletteDepth( 1 );
+  const int n = 16;
+  std::vector< Color > sum( 64 * 48, Color( 0.0, 0.0, 0.0 ) );
+  long killed = 0;
+  for ( int i = 0; i < n; ++i )
+    {
+      renderer.render( roulette, 4 );
+      killed += renderer.myRouletteRays;
+      for ( int y = 0; y < roulette.h(); ++y )
+        for ( int x = 0; x < roulette.w(); ++x )
+          sum[ x + y * 64 ] += roulette.at( x, y );
+    }
+  Real mean_bias = 0.0f;
+  for ( int y = 0; y < reference.h(); ++y )
+    for ( int x = 0; x < reference.w(); ++x )
+      {
+        Color d = sum[ x + y * 64 ] * ( 1.0f / n ) - reference.at( x, y );
+        mean_bias += ( d.r() + d.g() + d.b() ) / 3.0f;
+      }
+  mean_bias /= 64 * 48;
+  cout << "ray termination: " << cut_rays << " rays cut, error " << cut_error << ", "
+       << killed << " rays killed by the roulette, mean bias " << mean_bias << endl;
+  return cut_rays > 0 && cut_error < 3.0f / 255.0f && killed > 0
+    && std::fabs( mean_bias ) < 0.005f;
+}
+
+bool testFresnel()
+{
+  // Snell's law, and the batch kernel agrees with the scalar one.
+  std::mt19937 random( 5 );
+  std::uniform_real_distribution< Real > uniform( -1.0f, 1.0f );
+  const int n = 1000;
+  RefractionBatch batch;
+  batch.resize( n );
+  Real snell = 0.0f, batch_error = 0.0f;
+  int  tir = 0;
+  for ( int i = 0; i < n; ++i )
+    {
+      Vector3 v( uniform( random ), uniform( random ), uniform( random ) );
+      Vector3 N( uniform( random ), uniform( random ), uniform( random ) );
+      v /= v.norm();
+      N /= N.norm();
+      batch.vx[ i ] = v[ 0 ]; batch.vy[ i ] = v[ 1 ]; batch.vz[ i ] = v[ 2 ];
+      batch.nx[ i ] = N[ 0 ]; batch.ny[ i ] = N[ 1 ]; batch.nz[ i ] = N[ 2 ];
+      batch.ratio[ i ] = 1.0f / 1.5f;
+    }
+  batch.compute();
+  for ( int i = 0; i < n; ++i )
+    {
+      Vector3 v( batch.vx[ i ], batch.vy[ i ], batch.vz[ i ] );
+      Vector3 N( batch.nx[ i ], batch.ny[ i ], batch.nz[ i ] );
+      bool    out = v.dot( N ) > 0.0f;
+      Vector3 n   = out ? -1.0f * N : N;
+      Real    r   = out ? 1.5f : 1.0f / 1.5f;
+      Vector3 t;
+      Real    cos_t, f = 1.0f;
+      if ( refract( v, n, r, t, cos_t ) )
+        {
+          Real sin_i = v.cross( n ).norm();
+          Real sin_t = t.cross( n ).norm();
+          snell = std::max( snell, std::fabs( r * sin_i - sin_t ) );
+          f = schlick( r, -n.dot( v ), cos_t );
+        }
+      else { t = Vector3( 0.0f, 0.0f, 0.0f ); ++tir; }
+      Vector3 tb( batch.tx[ i ], batch.ty[ i ], batch.tz[ i ] );
+      batch_error = std::max( batch_error, distance( t, tb ) );
+      batch_error = std::max( batch_error, std::fabs( f - batch.reflectance[ i ] ) );
+    }
+  Real r0 = schlick( 1.0f / 1.5f, 1.0f, 1.0f );
+
+  // The relighter shades like the renderer with Fresnel weighting.
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  renderer.setFresnel( true );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> image, relit;
+  renderer.render( image, 4 );
+  Relighter relighter;
+  relighter.render( renderer, relit, 4 );
+  Real relight_error = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      relight_error = std::max( relight_error, distance( image.at( x, y ), relit.at( x, y ) ) );
+  cout << "fresnel: snell error " << snell << ", batch error " << batch_error << ", "
+       << tir << " total reflections, r0 " << r0 << ", relighter error " << relight_error << endl;
+  return snell < 1e-5f && batch_error < 1e-5f && tir > 0 && std::fabs( r0 - 0.04f ) < 1e-6f
+    && relight_error < 1e-4f;
+}
+
+bool testRay()
+{
+  Ray any( Point3( 0, 0, 0 ), Vector3( 3, 0, -4 ) );
+  Vector3 unit( 0.6f, 0.0f, -0.8f );
+  Ray normalized( Point3( 0, 0, 0 ), unit, 1, Ray::Normalized() );
+  bool ok = distance( any.direction, unit ) < 1e-6f
+    && normalized.direction == unit
+    && any.sign[ 0 ] == 0 && any.sign[ 2 ] == 1
+    && std::fabs( any.inv_direction[ 2 ] * any.direction[ 2 ] - 1.0f ) < 1e-6f
+    && std::isinf( any.inv_direction[ 1 ] );
+  cout << "ray: inverse direction " << any.inv_direction << ", signs " << any.sign[ 0 ]
+       << any.sign[ 1 ] << any.sign[ 2 ] << endl;
+  return ok;
+}
+
+bool testIntersection()
+{
+  Sphere sphere( Point3( 0, 0, 10 ), 2.0f, Material::redPlastic() );
+  Ray    ray( Point3( 0, 0, 0 ), Vector3( 0, 0, 1 ), 1, Ray::Normalized() );
+  Ray    inside( Point3( 0, 0, 10 ), Vector3( 0, 0, 1 ), 1, Ray::Normalized() );
+  Ray    away( Point3( 0, 0, 0 ), Vector3( 0, 0, -1 ), 1, Ray::Normalized() );
+  Real   near = -1.0f, far = -1.0f, in = -1.0f, t;
+  bool ok = sphere.intersect( ray, 0.0f, 100.0f, near ) && near == 8.0f
+    && ! sphere.intersect( ray, 0.0f, 7.0f, t )           // culled by t_max
+    && sphere.intersect( ray, 9.0f, 100.0f, far ) && far == 12.0f
+    && ! sphere.intersect( ray, 12.5f, 100.0f, t )
+    && sphere.intersect( inside, 0.0f, 100.0f, in ) && in == 2.0f
+    && ! sphere.intersect( away, 0.0f, 100.0f, t );
+  // The closest hit of the scene, and its interval.
+  Scene scene;
+  buildDemoScene( scene );
+  GraphicalObject* object;
+  Ray toward( Point3( -20, 0, 0 ), Vector3( 1, 0, 0 ), 1, Ray::Normalized() );
+  Real closest;
+  bool hit  = scene.intersect( toward, 0.0f, 100.0f, object, closest );
+  ok = ok && hit && closest == 18.0f && object == scene.myObjects[ 0 ];
+  bool none = scene.intersect( toward, 0.0f, 17.0f, object, t );
+  cout << "intersection: near " << near << ", far " << far << ", inside " << in
+       << ", scene hit at " << closest << endl;
+  return ok && ! none;
+}
+
+bool testSelfIntersection()
+{
+  // Far from the origin, a fixed offset would be lost in rounding.
+  Point3 c( 1000.0f, 1000.0f, 0.0f );
+  Sphere sphere( c, 1.0f, Material::glass() );
+  Ray    ray( Point3( 990.0f, 1000.3f, 0.1f ), Vector3( 1, 0, 0 ), 1 );
+  Real   t = 0.0f, far = 0.0f, u;
+  bool ok = sphere.intersect( ray, 0.0f, 100.0f, t );
+  Ray out( ray.origin + t * ray.direction, Vector3( -1, 0.5f, 0 ), 1 );
+  Ray in( out.origin, Vector3( 1, 0, 0 ), 1 );
+  out.leaveFrom( &sphere );
+  in.leaveFrom( &sphere );
+  ok = ok && ! sphere.intersect( out, out.t_min, 100.0f, u )
+    && sphere.intersect( in, in.t_min, 100.0f, far )
+    && std::fabs( far - 2.0f * sqrt( 1.0f - 0.3f * 0.3f - 0.1f * 0.1f ) ) < 1e-3f;
+  // A shadow ray crosses the four surfaces of a thin glass shell.
+  Scene scene;
+  Material revert = Material::glass();
+  revert.setRefractiveIndices( 1.0f, 1.5f );
+  scene.addObject( new Sphere( c, 1.0f, Material::glass() ) );
+  scene.addObject( new Sphere( c, 0.999f, revert ) );
+  Renderer renderer( scene );
+  Color white( 1.0, 1.0, 1.0 );
+  Real  light = renderer.shadow( ray, white ).max();
+  Real  k     = 1.0f * 0.98f;
+  cout << "self intersection: far side at " << far << ", light through shell "
+       << light << endl;
+  return ok && std::fabs( light - k * k * k * k ) < 1e-4f;
+}
+
+bool testStaticScene()
+{
+  Scene scene;
+  StaticScene< Sphere > spheres;
+  buildDemoScene( scene );
+  buildDemoScene( spheres );
+  Renderer renderer( scene );
+  BasicRenderer< StaticScene< Sphere > > static_renderer( spheres );
+  renderer.setVerbose( false );
+  static_renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  setDemoCamera( static_renderer, 40, 30 );
+  Image2D<Color> image, static_image;
+  renderer.render( image, 3 );
+  static_renderer.render( static_image, 3 );
+  Real d = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      d = std::max( d, distance( image.at( x, y ), static_image.at( x, y ) ) );
+  cout << "static scene: " << spheres.objects< Sphere >().size() << " spheres, max difference "
+       << d << endl;
+  return spheres.myObjects.size() == scene.myObjects.size() && d <= RENDER_TOLERANCE;
+}
+
+bool testBakedLights()
+{
+  PointLight far( GL_LIGHT0, Point4( 0, 0, 2, 0 ), Color( 1.0, 1.0, 1.0 ) );
+  PointLight near( GL_LIGHT1, Point4( 2, 4, 6, 2 ), Color( 1.0, 0.5, 0.2 ) );
+  near.setAttenuation( 1.0f, 0.5f, 0.25f );
+  BakedLight bf, bn;
+  bool ok = far.bake( bf ) && near.bake( bn )
+    && bf.type == BakedLight::Directional && bn.type == BakedLight::Attenuated;
+  Real d = 0.0f;
+  for ( Point3 p : { Point3( 0, 0, 0 ), Point3( 5, -2, 1 ), Point3( -3, 7, 2 ) } )
+    {
+      d = std::max( d, distance( bf.direction( p ), far.direction( p ) ) );
+      d = std::max( d, distance( bn.direction( p ), near.direction( p ) ) );
+      d = std::max( d, distance( bf.color( p ), far.color( p ) ) );
+      d = std::max( d, distance( bn.color( p ), near.color( p ) ) );
+    }
+  // The renderer keeps the snapshot taken by prepare().
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.prepare();
+  Vector3 before = renderer.lightDirection( 1, Point3( 0, 0, 0 ) );
+  dynamic_cast< PointLight* >( scene.myLights[ 1 ] )->position = Point4( 10, 4, 2, 1 );
+  Vector3 after = renderer.lightDirection( 1, Point3( 0, 0, 0 ) );
+  cout << "baked lights: max difference " << d << endl;
+  return ok && d < 1e-6f && distance( before, after ) == 0.0f;
+}
+
+bool testSceneSnapshot()
+{
+  Scene scene;
+  buildDemoScene( scene );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> reference, image;
+  renderer.render( reference, 3 );
+  std::unique_ptr< Scene > snapshot( scene.snapshot() );
+  bool ok = snapshot->myObjects.size() == scene.myObjects.size()
+    && snapshot->myLights.size() == scene.myLights.size()
+    && snapshot->myObjects[ 0 ] != scene.myObjects[ 0 ];
+  // The snapshot is rendered while the scene is edited.
+  std::thread render( [&] () {
+      Renderer background( *snapshot );
+      background.setVerbose( false );
+      setDemoCamera( background, 40, 30 );
+      background.render( image, 3 );
+    } );
+  PointLight* light = dynamic_cast< PointLight* >( scene.myLights[ 1 ] );
+  for ( int i = 0; i < 100; ++i )
+    {
+      scene.myObjects[ 0 ]->translate( Vector3( 0.0f, 0.0f, 0.01f ) );
+      light->position[ 0 ] += 0.1f;
+    }
+  render.join();
+  Real d = 0.0f;
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      d = std::max( d, distance( image.at( x, y ), reference.at( x, y ) ) );
+  cout << "scene snapshot: max difference " << d << endl;
+  return ok && d <= RENDER_TOLERANCE;
+}
+
+bool testEnvironmentMap()
+{
+  // A smooth map (the direction of each texel as a color), read back
+  // from a PFM file.
+  const int w = 256, h = 128;
+  Image2D<Vector3> latlong( w, h );
+  for ( int y = 0; y < h; ++y )
+    for ( int x = 0; x < w; ++x )
+      {
+        Real theta = M_PI * ( y + 0.5f ) / h;
+        Real phi   = 2.0 * M_PI * ( x + 0.5f ) / w - M_PI;
+        latlong.at( x, y ) = Vector3( 1.0f + sin( theta ) * cos( phi ),
+                                      1.0f + sin( theta ) * sin( phi ), 1.0f + cos( theta ) );
+      }
+  std::stringstream file;
+  Image2DWriter<Vector3>::write( latlong, file, false );
+  Image2D<Vector3> read;
+  bool ok = Image2DReader<Vector3>::read( read, file ) && read.w() == w && read.h() == h
+    && distance( read.at( 5, 7 ), latlong.at( 5, 7 ) ) == 0.0f;
+  EnvironmentMap smooth( read );
+  std::mt19937 random( 23 );
+  std::uniform_real_distribution< Real > uniform( 0.0f, 1.0f );
+  Real error = 0.0f, map_error = 0.0f;
+  for ( int i = 0; i < 10000; ++i )
+    {
+      Vector3 d( uniform( random ) - 0.5f, uniform( random ) - 0.5f, uniform( random ) - 0.5f );
+      d /= d.norm();
+      error     = std::max( error, distance( smooth.lookup( d ), smooth.lookupExact( d ) ) );
+      map_error = std::max( map_error, distance( smooth.lookupExact( d ), Vector3( 1, 1, 1 ) + d ) );
+    }
+  // A dim map with a bright spot: most samples go to the spot, with the
+  // density given by pdf().
+  Image2D<Vector3> spot( 64, 32, Vector3( 0.01f, 0.01f, 0.01f ) );
+  for ( int y = 10; y < 13; ++y )
+    for ( int x = 40; x < 44; ++x )
+      spot.at( x, y ) = Vector3( 50.0f, 50.0f, 50.0f );
+  EnvironmentMap sky( spot );
+  int  in_spot = 0, n = 10000;
+  Real pdf_error = 0.0f;
+  for ( int i = 0; i < n; ++i )
+    {
+      Vector3 d;
+      Real p = sky.sample( uniform( random ), uniform( random ), d );
+      pdf_error = std::max( pdf_error, std::fabs( p - sky.pdf( d ) ) / p );
+      if ( sky.lookupExact( d )[ 0 ] > 1.0f ) ++in_spot;
+    }
+  // Image-based lighting: a uniform environment of radiance 0.5 lights
+  // the top of a matte ball with half its diffuse color. The ground under
+  // the ball does not see the cone of directions it hides, which is a
+  // quarter of the light (sin^2 of its half angle of 30 degrees).
+  Scene    scene;
+  Material matte( Color( 0, 0, 0 ), Color( 0.8, 0.8, 0.8 ), Color( 0, 0, 0 ) );
+  Sphere*  ground = new Sphere( Point3( 0, 0, -1000 ), 1000.0f, matte );
+  Sphere*  ball   = new Sphere( Point3( 0, 0, 2 ), 1.0f, matte );
+  scene.addObject( ground );
+  scene.addObject( ball );
+  EnvironmentMap uniform_sky( Image2D<Vector3>( 32, 16, Vector3( 0.5f, 0.5f, 0.5f ) ) );
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  renderer.setEnvironmentLight( &uniform_sky, 64 );
+  renderer.prepare();
+  Vector3 up( 0, 0, 1 );
+  Real    top = 0.0f, under = 0.0f;
+  for ( int i = 0; i < 100; ++i )
+    {
+      top   += renderer.environmentLight( matte, up, up, ball, Point3( 0, 0, 3 ) ).g() / 100;
+      under += renderer.environmentLight( matte, up, up, ground, Point3( 0, 0, 0 ) ).g() / 100;
+    }
+  cout << "environment map: lookup error " << error << " (map error " << map_error << "), "
+       << in_spot << "/" << n
+       << " samples in the spot, pdf error " << pdf_error
+       << ", lighting " << top << " (top) " << under << " (under)" << endl;
+  return ok && error < 1e-3f && map_error < 1e-3f && in_spot > 0.9 * n && pdf_error < 1e-3f
+    && std::fabs( top - 0.4f ) < 0.01f && std::fabs( under - 0.3f ) < 0.01f;
+}
+
+bool testTextures()
+{
+  // A 200x100 checkerboard of 10x10 squares, in tiles of 16x16 texels.
+  Image2D<Color> image( 200, 100 );
+  for ( int y = 0; y < image.h(); ++y )
+    for ( int x = 0; x < image.w(); ++x )
+      image.at( x, y ) = ( x / 10 + y / 10 ) % 2 ? Color( 1, 1, 1 ) : Color( 0, 0, 0.4f );
+  bool ok = Texture::build( image, "test_texture.rttx", 16 );
+  // A budget of 8 tiles (of 768 bytes), shared by 4 threads.
+  TextureCache cache( 8 * 16 * 16 * 3 );
+  Texture texture( cache, "test_texture.rttx" );
+  ok = ok && texture.isValid() && texture.w() == 200 && texture.h() == 100
+    && texture.levels() == 8; // 200x100 ... 1x1
+  ok = ok && distance( texture.texel( 0, 37, 81 ), image.at( 37, 81 ) ) < 0.01f
+    && distance( texture.texel( 2, 2, 2 ), Color( 0.5f, 0.5f, 0.7f ) ) < 0.01f
+    && distance( texture.lookup( 0.5f, 0.5f, 1.0f ), Color( 0.5f, 0.5f, 0.7f ) ) < 0.01f;
+  std::atomic< int > errors( 0 );
+  std::vector< std::thread > threads;
+  for ( int k = 0; k < 4; ++k )
+    threads.emplace_back( [&, k] {
+        std::mt19937 random( k );
+        std::uniform_int_distribution< int > X( 0, 199 ), Y( 0, 99 );
+        for ( int i = 0; i < 5000; ++i )
+          {
+            int x = X( random ), y = Y( random );
+            if ( distance( texture.texel( 0, x, y ), image.at( x, y ) ) > 0.01f ) ++errors;
+          }
+      } );
+  for ( std::thread& t : threads ) t.join();
+  std::size_t bytes = cache.bytes();
+  // A textured sphere: the diffuse color is modulated by the texture.
+  Material m = Material::whitePlastic();
+  m.texture  = &texture;
+  Sphere sphere( Point3( 0, 0, 0 ), 2.0f, m );
+  Real u, v;
+  sphere.textureCoordinates( sphere.localize( 45, 90 ), u, v );
+  Color c = sphere.getMaterial( sphere.localize( 45, 90 ), 0.0f ).diffuse;
+  ok = ok && std::fabs( u - 0.25f ) < 1e-4f && std::fabs( v - 0.25f ) < 1e-4f
+    && distance( c, Color( 0.7f, 0.7f, 0.7f ) * texture.lookup( u, v, 0.0f ) ) < 1e-4f
+    && distance( sphere.getMaterial( Point3( 2, 0, 0 ) ).diffuse, m.diffuse ) == 0.0f;
+  // Corrupt files are rejected, and their textures ignored.
+  bool rejected = ! Texture::build( image, "test_texture_bad.rttx", 0 );
+  {
+    std::ifstream input( "test_texture.rttx", std::ios::binary );
+    std::string   bytes( ( std::istreambuf_iterator< char >( input ) ),
+                         std::istreambuf_iterator< char >() );
+    std::int32_t  zero = 0;
+    std::string   no_tile = bytes;
+    no_tile.replace( 12, 4, reinterpret_cast< const char* >( &zero ), 4 );
+    for ( const std::string& bad : { no_tile, bytes.substr( 0, bytes.size() - 1 ) } )
+      {
+        std::ofstream( "test_texture_bad.rttx", std::ios::binary ) << bad;
+        Texture corrupt( cache, "test_texture_bad.rttx" );
+        Material  cm = Material::whitePlastic();
+        cm.texture   = &corrupt;
+        Sphere    cs( Point3( 0, 0, 0 ), 2.0f, cm );
+        rejected = rejected && ! corrupt.isValid() && corrupt.levels() == 0
+          && distance( cs.getMaterial( cs.localize( 45, 90 ), 0.0f ).diffuse, cm.diffuse ) == 0.0f;
+      }
+    std::remove( "test_texture_bad.rttx" );
+  }
+  // The relighter filters textures as the renderer does.
+  Scene scene;
+  buildDemoScene( scene );
+  dynamic_cast< Sphere* >( scene.myObjects[ 0 ] )->material.texture = &texture;
+  Renderer renderer( scene );
+  renderer.setVerbose( false );
+  setDemoCamera( renderer, 40, 30 );
+  Image2D<Color> rendered, relit;
+  renderer.render( rendered, 4 );
+  Relighter relighter;
+  relighter.render( renderer, relit, 4 );
+  Real relight_error = 0.0f;
+  for ( int y = 0; y < rendered.h(); ++y )
+    for ( int x = 0; x < rendered.w(); ++x )
+      relight_error = std::max( relight_error, distance( rendered.at( x, y ), relit.at( x, y ) ) );
+  cout << "textures: " << errors << " wrong texels, " << bytes << " cached bytes, "
+       << cache.myHits << " hits, " << cache.myMisses << " misses, "
+       << cache.myEvictions << " evictions, relighter error " << relight_error
+       << ( rejected ? ", corrupt files rejected" : ", corrupt files accepted" ) << endl;
+  return ok && rejected && errors == 0 && bytes <= 8 * 16 * 16 * 3 && cache.myEvictions > 0
+    && relight_error < 1e-4f;
+}
+
+int main()
+{
+  bool ok = testPointVecteur();
+  ok = testRender() && ok;
+  ok = testLightCuller() && ok;
+  ok = testShadowCache() && ok;
+  ok = testReflectance() && ok;
+  ok = testUniformGrid() && ok;
+  ok = testGridRefit() && ok;
+  ok = testAnimation() && ok;
+  ok = testRenderCache() && ok;
+  ok = testRenderPasses() && ok;
+  ok = testRelighter() && ok;
+  ok = testDistributedRenderer() && ok;
+  ok = testMappedImage() && ok;
+  ok = testImageLayouts() && ok;
+  ok = testImageFilters() && ok;
+  ok = testDenoiser() && ok;
+  ok = testAreaLights() && ok;
+  ok = testRayTermination() && ok;
+  ok = testFresnel() && ok;
+  ok = testRay() && ok;
+  ok = testIntersection() && ok;
+  ok = testSelfIntersection() && ok;
+  ok = testStaticScene() && ok;
+  ok = testBakedLights() && ok;
+  ok = testSceneSnapshot() && ok;
+  ok = testEnvironmentMap() && ok;
+  ok = testTextures() && ok;
+  cout << ( ok ? "All tests passed." : "Some tests FAILED." ) << endl;
+  return ok ? 0 : 1;
+}